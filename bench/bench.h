@@ -0,0 +1,33 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+
+// Runs it over and over until enough time has passed to trust the clock,
+// and prints how long one call took on average.
+template<typename Function>
+static double bench(const char *name, Function &&function)
+{
+    using Clock = std::chrono::steady_clock;
+    size_t iterations = 64;
+    while (true) {
+        const Clock::time_point start = Clock::now();
+        for (size_t i=0; i<iterations; i++) {
+            function();
+        }
+        const Clock::duration elapsed = Clock::now() - start;
+        if (elapsed >= std::chrono::milliseconds(250)) {
+            const double nanoseconds = std::chrono::duration<double, std::nano>(elapsed).count() / double(iterations);
+            printf("%-48s %10.1f ns\n", name, nanoseconds);
+            return nanoseconds;
+        }
+        iterations *= 2;
+    }
+}
+
+// So the compiler can't throw away what we're measuring
+template<typename T>
+static void keep(const T &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
@@ -0,0 +1,81 @@
+// Picking the fields out of cast payloads with the scanner, against the
+// std::regex searches that were used before (copied here from the old
+// util.h and loop.h, one regex per field for each message).
+
+#include "castjson.h"
+#include "bench.h"
+#include "payloads.h"
+
+#include <cerrno>
+#include <regex>
+#include <string>
+
+static std::string regexExtract(const std::string &regexstr, const std::string &payload)
+{
+    std::regex regex(regexstr);
+    std::smatch match;
+    if (!std::regex_search(payload, match, regex) || match.size() != 2) {
+        return "";
+    }
+    return match[1].str();
+}
+
+static bool extractNumber(const std::string &regex, const std::string &payload, double *number)
+{
+    const std::string numberString = regexExtract(regex, payload);
+    if (numberString.empty()) {
+        return false;
+    }
+    char *endptr = nullptr;
+    const char *startptr = numberString.c_str();
+    const double converted = strtod(startptr, &endptr);
+    if (endptr == startptr || errno == ERANGE || !std::isfinite(converted)) {
+        return false;
+    }
+    *number = converted;
+
+    return true;
+}
+
+// What the old handleMessage() looked up for each type of message
+static void regexFields(const std::string &payload)
+{
+    const std::string type = regexExtract(R"--("type"\s*:\s*"([^"]+)")--", payload);
+    keep(type);
+    if (type == "MEDIA_STATUS") {
+        double duration = 0., currentTime = 0.;
+        keep(extractNumber(R"--("duration"\s*:\s*([0-9.]+))--", payload, &duration));
+        keep(extractNumber(R"--("currentTime"\s*:\s*([0-9.]+))--", payload, &currentTime));
+        keep(duration);
+        keep(currentTime);
+        keep(regexExtract(R"--("playerState"\s*:\s*"([A-Z]+)")--", payload));
+        keep(regexExtract(R"--("mediaSessionId"\s*:\s*([0-9]+))--", payload));
+        keep(regexExtract(R"--("contentId"\s*:\s*"([A-Za-z0-9_-]+)")--", payload));
+        keep(regexExtract(R"--("playerState"\s*:\s*(-?[0-9]+))--", payload));
+    } else if (type == "RECEIVER_STATUS") {
+        keep(regexExtract(R"--("displayName"\s*:\s*"([^"]+)")--", payload));
+        keep(regexExtract(R"--("sessionId"\s*:\s*"([^"]+)")--", payload));
+    }
+}
+
+int main()
+{
+    for (const std::pair<const char*, const char*> &payload : {
+            std::make_pair("PING", payloads::ping),
+            std::make_pair("RECEIVER_STATUS", payloads::receiverStatus),
+            std::make_pair("MEDIA_STATUS", payloads::mediaStatus)
+    }) {
+        const std::string name = payload.first;
+        const std::string json = payload.second;
+
+        bench(("scanPayload " + name).c_str(), [&]() {
+            cc::PayloadFields fields;
+            keep(cc::scanPayload(json, &fields));
+            keep(fields);
+        });
+        bench(("std::regex " + name).c_str(), [&]() {
+            regexFields(json);
+        });
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+// How long it takes to parse and serialize realistic cast messages, so
+// changes to the protobuf code can be checked for regressions.
+
+#include "castchannel.h"
+#include "bench.h"
+#include "payloads.h"
+
+#include <random>
+#include <vector>
+
+static std::vector<uint8_t> encode(const char *payload, const char *source)
+{
+    CastMessageView message;
+    message._source_id = source;
+    message._destination_id = "sender-0";
+    message._namespace = cc::ns::strings[cc::ns::Media];
+    message._payload_utf8 = payload;
+    std::vector<uint8_t> encoded(message.size());
+    message.write(encoded.data(), encoded.data() + encoded.size());
+    return encoded;
+}
+
+// Lots of varints of about the given size, so the branches can't be learned
+static std::vector<uint8_t> varints(const int bits)
+{
+    std::mt19937_64 random(bits);
+    std::vector<uint8_t> encoded(1024 * 10 + 8);
+    uint8_t *out = encoded.data();
+    for (int i=0; i<1024; i++) {
+        const uint64_t value = (random() & ((bits == 64 ? 0 : 1ULL << bits) - 1)) | 1ULL << (bits - 1);
+        out = pb::writeVarint(out, value);
+    }
+    encoded.resize(out - encoded.data());
+    return encoded;
+}
+
+int main()
+{
+    const std::vector<uint8_t> ping = encode(payloads::ping, "Tr@n$p0rt-0");
+    const std::vector<uint8_t> receiverStatus = encode(payloads::receiverStatus, "receiver-0");
+    const std::vector<uint8_t> mediaStatus = encode(payloads::mediaStatus, "8c1f3d6a-93b8-4a3e-b4a9-5e2c0b8e7f21");
+
+    for (const std::pair<const char*, const std::vector<uint8_t>*> &frame : {
+            std::make_pair("PING", &ping),
+            std::make_pair("RECEIVER_STATUS", &receiverStatus),
+            std::make_pair("MEDIA_STATUS", &mediaStatus)
+    }) {
+        const std::vector<uint8_t> &encoded = *frame.second;
+        const std::string name = frame.first;
+
+        CastMessageView view;
+        bench(("CastMessageView::parse " + name).c_str(), [&]() {
+            keep(view.parse(encoded.data(), encoded.size()));
+            keep(view);
+        });
+        CastMessage message;
+        bench(("CastMessage::parse " + name).c_str(), [&]() {
+            keep(message.parse(encoded.data(), encoded.size()));
+            keep(message);
+        });
+
+        std::vector<uint8_t> buffer(encoded.size());
+        bench(("CastMessageView::write " + name).c_str(), [&]() {
+            keep(view.write(buffer.data(), buffer.data() + buffer.size()));
+            keep(buffer);
+        });
+        bench(("CastMessage::write " + name).c_str(), [&]() {
+            keep(message.write(buffer.data(), buffer.data() + buffer.size()));
+            keep(buffer);
+        });
+    }
+
+    for (const int bits : {7, 14, 35, 64}) {
+        const std::vector<uint8_t> encoded = varints(bits);
+        const std::string name = "readVarint x1024, " + std::to_string(pb::varintSize(1ULL << (bits - 1))) + " bytes";
+        bench(name.c_str(), [&]() {
+            const uint8_t *data = encoded.data();
+            const uint8_t *end = data + encoded.size();
+            uint64_t value = 0;
+            while (data < end && pb::readVarint(data, end, &value)) {
+                keep(value);
+            }
+        });
+    }
+    return 0;
+}
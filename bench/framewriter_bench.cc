@@ -0,0 +1,130 @@
+// Rendering a frame to send with FrameWriter, against how sendMessage() did
+// it before with ec::cls_protoc3. The old CastMessage is copied here as it
+// was, ec_protobuf.h comes out of git history (see CMakeLists.txt).
+
+#include "castframes.h"
+#include "bench.h"
+#include "ec_protobuf.h"
+#include "payloads.h"
+
+#include <string>
+
+class OldCastMessage : public ec::cls_protoc3<std::basic_string<uint8_t>>
+{
+    enum  {
+        id_protocol_version = 1,
+        id_source_id = 2,
+        id_destination_id = 3,
+        id_namespace = 4,
+        id_payload_type = 5,
+        id_payload_utf8 = 6,
+        id_payload_binary = 7
+    };
+
+public:
+    enum ProtocolVersion : uint32_t {
+        CASTV2_1_0 = 0
+    };
+    enum PayloadType : uint32_t {
+        STRING = 0,
+        BINARY = 1
+    };
+
+    uint32_t _protocol_version = CASTV2_1_0;
+    std::string _source_id;
+    std::string _destination_id;
+    std::string _namespace;
+    uint32_t _payload_type = STRING;
+    std::string _payload_utf8;
+    std::basic_string<uint8_t> _payload_binary;
+
+    void reset() override {
+        _protocol_version = CASTV2_1_0;
+        _source_id.clear();
+        _destination_id.clear();
+        _namespace.clear();
+        _payload_type = STRING;
+        _payload_utf8.clear();
+        _payload_binary.clear();
+    }
+protected:
+    size_t size_content() override {
+        return
+            size_var(id_protocol_version, _protocol_version, true) +
+            size_str(id_source_id, _source_id.c_str()) +
+            size_str(id_destination_id, _destination_id.c_str()) +
+            size_str(id_namespace, _namespace.c_str()) +
+            size_var(id_payload_type, _payload_type, true) +
+            size_str(id_payload_utf8, _payload_utf8.c_str()) +
+            size_cls(id_payload_binary, _payload_binary.data(), _payload_binary.size());
+    }
+    bool out_content(std::basic_string<uint8_t> *pout) override {
+        return
+            out_var(pout, id_protocol_version, _protocol_version, true) &&
+            out_str(pout, id_source_id, _source_id.c_str()) &&
+            out_str(pout, id_destination_id, _destination_id.c_str()) +
+            out_str(pout, id_namespace, _namespace.c_str()) &&
+            out_var(pout, id_payload_type, _payload_type, true) &&
+            out_str(pout, id_payload_utf8, _payload_utf8.c_str()) &&
+            out_cls(pout, id_payload_binary, _payload_binary.data(), _payload_binary.size());
+    }
+    bool on_cls(uint32_t, const void*, size_t) override { return false; }
+    bool on_var(uint32_t, uint64_t) override { return false; }
+    bool on_fix32(uint32_t, const void*) override { return false; }
+    bool on_fix64(uint32_t, const void*) override { return false; }
+};
+
+// The old sendMessage(), up to where it wrote the buffer
+static std::basic_string<uint8_t> oldFrame(const std::string &ns, const std::string &dest, const std::string &message)
+{
+    OldCastMessage msg;
+    msg._payload_type = OldCastMessage::STRING;
+    msg._protocol_version = OldCastMessage::CASTV2_1_0;
+    msg._namespace = ns;
+    msg._source_id = "sender-0";
+    msg._destination_id = dest.empty() ? "receiver-0" : dest;
+    msg._payload_utf8 = message;
+
+    const uint32_t byteSize = htonl(uint32_t(msg.size()));
+    std::basic_string<uint8_t> buffer(sizeof byteSize, '\0');
+    memcpy(buffer.data(), &byteSize, sizeof byteSize);
+    if (!msg.serialize(&buffer)) {
+        buffer.clear();
+    }
+    return buffer;
+}
+
+int main()
+{
+    const std::string dest = "8c1f3d6a-93b8-4a3e-b4a9-5e2c0b8e7f21";
+    const std::string getStatus = "{  \"type\": \"GET_STATUS\",  \"requestId\": 12,  \"mediaSessionId\": \"1\"}";
+    // A LOAD with a lot of custom data, more than fits inline
+    const std::string load = "{\"type\":\"LOAD\",\"media\":{\"contentId\":\"dQw4w9WgXcQ\"},\"customData\":{\"data\":\"" + std::string(6000, 'x') + "\"}}";
+
+    cc::FrameTemplates templates;
+    for (const std::pair<const char*, std::string> &payload : {
+            std::make_pair("GET_STATUS", getStatus),
+            std::make_pair("MEDIA_STATUS sized", std::string(payloads::mediaStatus)),
+            std::make_pair("6 KB LOAD", load)
+    }) {
+        const std::string name = payload.first;
+        const std::string &text = payload.second;
+
+        // Sanity check, they should come out the same
+        cc::FrameWriter check(templates.header(dest, cc::ns::Media));
+        const std::basic_string_view<uint8_t> frame = check.append(text).finish();
+        if (std::basic_string<uint8_t>(frame) != oldFrame(cc::ns::strings[cc::ns::Media], dest, text)) {
+            fprintf(stderr, "Frames for %s differ\n", name.c_str());
+            return 1;
+        }
+
+        bench(("FrameWriter " + name).c_str(), [&]() {
+            cc::FrameWriter writer(templates.header(dest, cc::ns::Media));
+            keep(writer.append(text).finish());
+        });
+        bench(("cls_protoc3::serialize " + name).c_str(), [&]() {
+            keep(oldFrame(cc::ns::strings[cc::ns::Media], dest, text));
+        });
+    }
+    return 0;
+}
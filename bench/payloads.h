@@ -0,0 +1,13 @@
+#pragma once
+
+// What a chromecast running YouTube sends us, captured and trimmed a bit
+namespace payloads
+{
+
+static const char ping[] = R"json({"type":"PING"})json";
+
+static const char receiverStatus[] = R"json({"requestId":1,"status":{"applications":[{"appId":"233637DE","appType":"WEB","displayName":"YouTube","iconUrl":"","isIdleScreen":false,"launchedFromCloud":false,"namespaces":[{"name":"urn:x-cast:com.google.cast.debugoverlay"},{"name":"urn:x-cast:com.google.cast.cac"},{"name":"urn:x-cast:com.google.cast.media"},{"name":"urn:x-cast:com.google.youtube.mdx"}],"sessionId":"8c1f3d6a-93b8-4a3e-b4a9-5e2c0b8e7f21","statusText":"YouTube","transportId":"8c1f3d6a-93b8-4a3e-b4a9-5e2c0b8e7f21","universalAppId":"233637DE"}],"userEq":{},"volume":{"controlType":"attenuation","level":0.4000000059604645,"muted":false,"stepInterval":0.05000000074505806}},"type":"RECEIVER_STATUS"})json";
+
+static const char mediaStatus[] = R"json({"type":"MEDIA_STATUS","status":[{"mediaSessionId":1,"playbackRate":1,"playerState":"PLAYING","currentTime":132.846,"supportedMediaCommands":274447,"volume":{"level":1,"muted":false},"activeTrackIds":[],"media":{"contentId":"dQw4w9WgXcQ","streamType":"BUFFERED","mediaCategory":"VIDEO","contentType":"x-youtube/video","metadata":{"metadataType":0,"title":"Rick Astley - Never Gonna Give You Up (Official Music Video)","subtitle":"Rick Astley","images":[{"url":"https://i.ytimg.com/vi/dQw4w9WgXcQ/hqdefault.jpg"}]},"duration":212.061,"tracks":[],"breakClips":[],"breaks":[]},"currentItemId":1,"items":[{"itemId":1,"media":{"contentId":"dQw4w9WgXcQ","streamType":"BUFFERED","mediaCategory":"VIDEO","contentType":"x-youtube/video","duration":212.061},"orderId":0},{"itemId":2,"media":{"contentId":"yPYZpwSpKmA","streamType":"BUFFERED","mediaCategory":"VIDEO","contentType":"x-youtube/video"},"orderId":1}],"preloadedItemId":2,"repeatMode":"REPEAT_OFF","customData":{"playerState":1}}],"requestId":0})json";
+
+} // namespace payloads
@@ -0,0 +1,95 @@
+// Checking payloads for valid UTF-8, against going through them a byte at a
+// time. A MEDIA_STATUS with a long queue is around 60 KB, mostly ASCII unless
+// the titles aren't.
+
+#include "simd.h"
+#include "bench.h"
+
+#include <string>
+
+// A byte at a time, with the same checks
+static bool bytewiseIsValidUtf8(const char *text, size_t size)
+{
+    const uint8_t *pos = reinterpret_cast<const uint8_t*>(text);
+    const uint8_t *end = pos + size;
+    while (pos != end) {
+        const uint8_t lead = *pos;
+        if (lead < 0x80) {
+            pos++;
+            continue;
+        }
+        size_t length = 0;
+        uint8_t low = 0x80, high = 0xBF;
+        if (lead < 0xC2) {
+            return false;
+        } else if (lead < 0xE0) {
+            length = 2;
+        } else if (lead < 0xF0) {
+            length = 3;
+            if (lead == 0xE0) {
+                low = 0xA0;
+            } else if (lead == 0xED) {
+                high = 0x9F;
+            }
+        } else if (lead < 0xF5) {
+            length = 4;
+            if (lead == 0xF0) {
+                low = 0x90;
+            } else if (lead == 0xF4) {
+                high = 0x8F;
+            }
+        } else {
+            return false;
+        }
+        if (size_t(end - pos) < length || pos[1] < low || pos[1] > high) {
+            return false;
+        }
+        for (size_t i=2; i<length; i++) {
+            if ((pos[i] & 0xC0) != 0x80) {
+                return false;
+            }
+        }
+        pos += length;
+    }
+    return true;
+}
+
+// A queue of this many items, all with the same title
+static std::string mediaStatus(const std::string &title, const int items)
+{
+    std::string ret = "{\"type\":\"MEDIA_STATUS\",\"status\":[{\"mediaSessionId\":1,\"playerState\":\"PLAYING\",\"items\":[";
+    for (int i=0; i<items; i++) {
+        if (i) {
+            ret += ",";
+        }
+        ret += "{\"itemId\":" + std::to_string(i) + ",\"media\":{\"contentId\":\"dQw4w9WgXcQ\",\"streamType\":\"BUFFERED\","
+            "\"contentType\":\"x-youtube/video\",\"metadata\":{\"metadataType\":0,\"title\":\"" + title + "\"}},\"orderId\":" + std::to_string(i) + "}";
+    }
+    ret += "]}]}";
+    return ret;
+}
+
+int main()
+{
+    for (const std::pair<const char*, std::string> &payload : {
+            std::make_pair("ASCII titles", mediaStatus("Rick Astley - Never Gonna Give You Up (Official Music Video)", 280)),
+            std::make_pair("Japanese titles", mediaStatus("\xe3\x83\xaa\xe3\x83\x83\xe3\x82\xaf\xe3\x83\xbb\xe3\x82\xa2\xe3\x82\xb9\xe3\x83\x88\xe3\x83\xaa\xe3\x83\xbc"
+                    "\xe3\x80\x8c\xe3\x82\xae\xe3\x83\x96\xe3\x83\xbb\xe3\x83\xa6\xe3\x83\xbc\xe3\x83\xbb\xe3\x82\xa2\xe3\x83\x83\xe3\x83\x97\xe3\x80\x8d", 280))
+    }) {
+        const std::string name = std::string(payload.first) + ", " + std::to_string(payload.second.size() / 1024) + " KB";
+        const std::string &text = payload.second;
+        if (!simd::isValidUtf8(text.data(), text.size()) || !bytewiseIsValidUtf8(text.data(), text.size())) {
+            fprintf(stderr, "%s isn't valid?\n", name.c_str());
+            return 1;
+        }
+
+        const double simd = bench(("isValidUtf8 " + name).c_str(), [&]() {
+            keep(simd::isValidUtf8(text.data(), text.size()));
+        });
+        const double bytewise = bench(("byte at a time " + name).c_str(), [&]() {
+            keep(bytewiseIsValidUtf8(text.data(), text.size()));
+        });
+        printf("%-48s %10.2f / %.2f GB/s\n", "", double(text.size()) / simd, double(text.size()) / bytewise);
+    }
+    return 0;
+}
@@ -0,0 +1,68 @@
+// Finding the next segment with the skip plan, against scanning all the
+// segments every time like it used to. Lots of segments so it shows.
+
+#include "skipplan.h"
+#include "bench.h"
+
+#include <random>
+
+// What currentSegmentEnd() used to do on every MEDIA_STATUS
+static double linearSegmentEnd(const std::vector<Segment> &segments, const double position)
+{
+    for (const Segment &segment : segments) {
+        if (segment.begin <= position && segment.end > position) {
+            return segment.end;
+        }
+    }
+    return -1;
+}
+
+int main()
+{
+    for (const int count : {10, 1000, 100000}) {
+        std::mt19937_64 random(count);
+        const double length = count * 60.;
+        std::uniform_real_distribution<double> anywhere(0., length);
+        std::uniform_real_distribution<double> duration(1., 30.);
+        std::vector<Segment> segments;
+        for (int i=0; i<count; i++) {
+            const double begin = anywhere(random);
+            segments.push_back({begin, begin + duration(random)});
+        }
+        std::vector<double> seeks(4096);
+        for (double &position : seeks) {
+            position = anywhere(random);
+        }
+        const std::string suffix = ", " + std::to_string(count) + " segments";
+
+        bench(("SkipPlan::compile" + suffix).c_str(), [&]() {
+            SkipPlan plan(segments);
+            keep(plan);
+        });
+
+        // Playing along, with a status update every half second
+        const SkipPlan plan(segments);
+        double position = 0.;
+        bench(("SkipPlan::containing, playing" + suffix).c_str(), [&]() {
+            position += 0.5;
+            if (position > length) {
+                position = 0.;
+            }
+            keep(plan.containing(position));
+        });
+        size_t seek = 0;
+        bench(("SkipPlan::containing, seeking" + suffix).c_str(), [&]() {
+            keep(plan.containing(seeks[seek++ % seeks.size()]));
+        });
+
+        position = 0.;
+        bench(("linear scan, playing" + suffix).c_str(), [&]() {
+            position += 0.5;
+            if (position > length) {
+                position = 0.;
+            }
+            keep(linearSegmentEnd(segments, position));
+        });
+    }
+    return 0;
+}
@@ -1,6 +1,38 @@
 #pragma once
 
-#include "ec_protobuf.h"
+#include "protoschema.h"
+
+#include <string_view>
+
+namespace cc
+{
+namespace ns {
+enum Namespace {
+    Connection = 0,
+    Receiver,
+    Heartbeat,
+    Media,
+    NamespacesCount
+};
+static const char *strings[ns::NamespacesCount] = {
+    "urn:x-cast:com.google.cast.tp.connection",
+    "urn:x-cast:com.google.cast.receiver",
+    "urn:x-cast:com.google.cast.tp.heartbeat",
+    "urn:x-cast:com.google.cast.media"
+};
+
+// Returns NamespacesCount for anything we don't know about
+inline Namespace fromString(const std::string_view name)
+{
+    for (int i=0; i<NamespacesCount; i++) {
+        if (name == strings[i]) {
+            return Namespace(i);
+        }
+    }
+    return NamespacesCount;
+}
+}// namespace ns
+} // namespace cc
 
 // message CastMessage {
 //   enum ProtocolVersion { CASTV2_1_0 = 0; }
@@ -17,19 +49,8 @@
 //   optional bytes payload_binary = 7;
 // }
 
-class CastMessage : public ec::cls_protoc3<std::basic_string<uint8_t>>
+struct CastMessage
 {
-    enum  {
-        id_protocol_version = 1,
-        id_source_id = 2,
-        id_destination_id = 3,
-        id_namespace = 4,
-        id_payload_type = 5,
-        id_payload_utf8 = 6,
-        id_payload_binary = 7
-    };
-
-public:
     enum ProtocolVersion : uint32_t {
         CASTV2_1_0 = 0
     };
@@ -44,83 +65,88 @@ public:
     std::string _namespace;
     uint32_t _payload_type = STRING;
     std::string _payload_utf8;
-    std::basic_string<uint8_t> _payload_binary;
-
-    void reset() override {
-        _protocol_version = CASTV2_1_0;
-        _source_id.clear();
-        _destination_id.clear();
-        _namespace.clear();
-        _payload_type = STRING;
-        _payload_utf8.clear();
-        _payload_binary.clear();
-    }
-protected:
-    size_t size_content() override {
-        return
-            size_var(id_protocol_version, _protocol_version, true) +
-            size_str(id_source_id, _source_id.c_str()) +
-            size_str(id_destination_id, _destination_id.c_str()) +
-            size_str(id_namespace, _namespace.c_str()) +
-            size_var(id_payload_type, _payload_type, true) +
-            size_str(id_payload_utf8, _payload_utf8.c_str()) +
-            size_cls(id_payload_binary, _payload_binary.data(), _payload_binary.size());
-    }
-    bool out_content(std::basic_string<uint8_t> *pout) override {
-        return
-            out_var(pout, id_protocol_version, _protocol_version, true) &&
-            out_str(pout, id_source_id, _source_id.c_str()) &&
-            out_str(pout, id_destination_id, _destination_id.c_str()) +
-            out_str(pout, id_namespace, _namespace.c_str()) &&
-            out_var(pout, id_payload_type, _payload_type, true) &&
-            out_str(pout, id_payload_utf8, _payload_utf8.c_str()) &&
-            out_cls(pout, id_payload_binary, _payload_binary.data(), _payload_binary.size());
-    }
-    bool on_cls(uint32_t field_number, const void* pdata, size_t sizedata) override {
-        switch(field_number) {
-        case id_source_id:
-            _source_id.assign((const char*)pdata, sizedata);
-            break;
-        case id_destination_id:
-            _destination_id.assign((const char*)pdata, sizedata);
-            break;
-        case id_namespace:
-            _namespace.assign((const char*)pdata, sizedata);
-            break;
-        case id_payload_utf8:
-            _payload_utf8.assign((const char*)pdata, sizedata);
-            break;
-        case id_payload_binary:
-            _payload_binary.assign((const unsigned char*)pdata, sizedata);
-            break;
-        default:
-            printf("Unknown cls field %u\n", field_number);
-            return false;
-        }
-        return true;
-    }
-    bool on_var(uint32_t field_number, uint64_t val) override {
-        switch (field_number) {
-        case id_protocol_version:
-            _protocol_version = val;
-            break;
-        case id_payload_type:
-            _payload_type = val;
-            break;
-        default:
-            printf("Unknown var field %u\n", field_number);
-            return false;
-        }
-        return true;
-    }
-    bool on_fix32(uint32_t field_number, const void* pval) override {
-        (void)pval;
-        printf("Unknown fix32 %u\n", field_number);
+    pb::Bytes _payload_binary;
+
+    bool parse(const void *data, size_t size);
+    size_t size() const;
+    uint8_t *write(uint8_t *out, const uint8_t *end) const;
+};
+
+using CastMessageSchema = pb::Schema<
+    pb::Field<1, &CastMessage::_protocol_version, pb::Required>,
+    pb::Field<2, &CastMessage::_source_id, pb::Required>,
+    pb::Field<3, &CastMessage::_destination_id, pb::Required>,
+    pb::Field<4, &CastMessage::_namespace, pb::Required>,
+    pb::Field<5, &CastMessage::_payload_type, pb::Required>,
+    pb::Field<6, &CastMessage::_payload_utf8>,
+    pb::Field<7, &CastMessage::_payload_binary>
+>;
+
+inline bool CastMessage::parse(const void *data, size_t size)
+{
+    *this = CastMessage();
+    return CastMessageSchema::parse(this, data, size);
+}
+
+inline size_t CastMessage::size() const
+{
+    return CastMessageSchema::size(*this);
+}
+
+inline uint8_t *CastMessage::write(uint8_t *out, const uint8_t *end) const
+{
+    return CastMessageSchema::write(*this, out, end);
+}
+
+// The same message, but without copying anything. The views point into the
+// buffer it was parsed from (or the strings it is sent from), so they're only
+// valid as long as that is. The namespace is looked up while parsing so it can
+// be switched on.
+struct CastMessageView
+{
+    uint32_t _protocol_version = CastMessage::CASTV2_1_0;
+    std::string_view _source_id;
+    std::string_view _destination_id;
+    std::string_view _namespace;
+    cc::ns::Namespace _namespace_id = cc::ns::NamespacesCount;
+    uint32_t _payload_type = CastMessage::STRING;
+    std::string_view _payload_utf8;
+    std::basic_string_view<uint8_t> _payload_binary;
+
+    bool parse(const void *data, size_t size);
+    size_t size() const;
+    uint8_t *write(uint8_t *out, const uint8_t *end) const;
+};
+
+// Comes last, so frames can be encoded up to it ahead of time
+using CastPayloadField = pb::Field<6, &CastMessageView::_payload_utf8>;
+
+using CastMessageViewSchema = pb::Schema<
+    pb::Field<1, &CastMessageView::_protocol_version, pb::Required>,
+    pb::Field<2, &CastMessageView::_source_id, pb::Required>,
+    pb::Field<3, &CastMessageView::_destination_id, pb::Required>,
+    pb::Field<4, &CastMessageView::_namespace, pb::Required>,
+    pb::Field<5, &CastMessageView::_payload_type, pb::Required>,
+    CastPayloadField,
+    pb::Field<7, &CastMessageView::_payload_binary>
+>;
+
+inline bool CastMessageView::parse(const void *data, size_t size)
+{
+    *this = CastMessageView();
+    if (!CastMessageViewSchema::parse(this, data, size)) {
         return false;
     }
-    bool on_fix64(uint32_t field_number, const void* pval) override {
-        (void)pval;
-        printf("Unknown fix64 %u\n", field_number);
-        return true;
-    }
-};
+    _namespace_id = cc::ns::fromString(_namespace);
+    return true;
+}
+
+inline size_t CastMessageView::size() const
+{
+    return CastMessageViewSchema::size(*this);
+}
+
+inline uint8_t *CastMessageView::write(uint8_t *out, const uint8_t *end) const
+{
+    return CastMessageViewSchema::write(*this, out, end);
+}
@@ -0,0 +1,245 @@
+#pragma once
+
+#include "castchannel.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+
+extern "C" {
+#include <arpa/inet.h>
+}
+
+namespace cc
+{
+
+namespace msg
+{
+enum Type {
+    Connect = 0,
+    Ping,
+    Pong,
+    GetStatus,
+    MediaStatus,
+    SimpleMessageCount
+};
+
+}//namespace msgs
+
+// Renders a frame into a buffer on the stack. Everything in front of the
+// payload is the same for every message to a destination, so that is
+// encoded once (see FrameTemplates) and copied in. The payload is appended
+// after room for its length, and the lengths are filled in at the end.
+// Bigger messages (a LOAD with lots of custom data) move to the heap, up to
+// the most the chromecast accepts.
+class FrameWriter
+{
+public:
+    // Plenty for the messages we send normally, they're all tiny
+    static constexpr size_t InlineSize = 2048;
+
+    // Same as Connection::MaxMessageSize, plus the frame length
+    static constexpr size_t MaxMessageSize = 64 * 1024;
+    static constexpr size_t MaxFrameSize = sizeof(uint32_t) + MaxMessageSize;
+
+    explicit FrameWriter(const pb::Bytes &header) :
+        m_headerSize(header.size()),
+        m_payloadStart(sizeof(uint32_t) + header.size() + MaxLengthSize),
+        m_end(0)
+    {
+        if (reserve(m_payloadStart)) {
+            memcpy(m_buffer + sizeof(uint32_t), header.data(), header.size());
+        }
+        m_end = m_payloadStart;
+    }
+
+    // It points into itself
+    FrameWriter(const FrameWriter&) = delete;
+    FrameWriter &operator=(const FrameWriter&) = delete;
+
+    FrameWriter &append(const std::string_view text)
+    {
+        if (!reserve(text.size())) {
+            return *this;
+        }
+        memcpy(m_buffer + m_end, text.data(), text.size());
+        m_end += text.size();
+        return *this;
+    }
+
+    FrameWriter &append(const int value)
+    {
+        if (!reserve(std::numeric_limits<int>::digits10 + 2)) {
+            return *this;
+        }
+        char *begin = reinterpret_cast<char*>(m_buffer + m_end);
+        const std::to_chars_result result = std::to_chars(begin, reinterpret_cast<char*>(m_buffer + m_capacity), value);
+        if (result.ec != std::errc()) {
+            m_overflow = true;
+            return *this;
+        }
+        m_end += result.ptr - begin;
+        return *this;
+    }
+
+    // Same format as std::to_string()
+    FrameWriter &append(const double value)
+    {
+        if (m_overflow) {
+            return *this;
+        }
+        int length = snprintf(reinterpret_cast<char*>(m_buffer + m_end), m_capacity - m_end, "%f", value);
+        if (length >= 0 && size_t(length) >= m_capacity - m_end) {
+            // Huge numbers are really long in %f
+            if (!reserve(size_t(length) + 1)) {
+                return *this;
+            }
+            length = snprintf(reinterpret_cast<char*>(m_buffer + m_end), m_capacity - m_end, "%f", value);
+        }
+        if (length < 0 || size_t(length) >= m_capacity - m_end) {
+            m_overflow = true;
+            return *this;
+        }
+        m_end += length;
+        return *this;
+    }
+
+    std::string_view payload() const
+    {
+        if (m_end > m_capacity) { // not even the header fit
+            return {};
+        }
+        return std::string_view(reinterpret_cast<const char*>(m_buffer + m_payloadStart), m_end - m_payloadStart);
+    }
+
+    // Returns the whole frame, or an empty view if it didn't fit
+    std::basic_string_view<uint8_t> finish()
+    {
+        if (m_overflow) {
+            return {};
+        }
+        // The header is usually shorter than the payload, so move that to
+        // close the gap left by the reserved length instead
+        const size_t payloadSize = m_end - m_payloadStart;
+        const size_t lengthSize = pb::varintSize(payloadSize);
+        const size_t start = MaxLengthSize - lengthSize;
+        if (m_end - start > MaxFrameSize) {
+            m_overflow = true;
+            return {};
+        }
+        memmove(m_buffer + start + sizeof(uint32_t), m_buffer + sizeof(uint32_t), m_headerSize);
+        pb::writeVarint(m_buffer + m_payloadStart - lengthSize, payloadSize);
+
+        const uint32_t frameSize = htonl(uint32_t(m_end - start - sizeof(uint32_t)));
+        memcpy(m_buffer + start, &frameSize, sizeof frameSize);
+        return std::basic_string_view<uint8_t>(m_buffer + start, m_end - start);
+    }
+
+private:
+    // Messages are 64kb max, so the length always fits in three bytes
+    static constexpr size_t MaxLengthSize = 3;
+
+    // Makes room for this much more, on the heap if it doesn't fit inline
+    bool reserve(const size_t size)
+    {
+        if (m_overflow) {
+            return false;
+        }
+        if (size <= m_capacity - m_end) {
+            return true;
+        }
+        // The gap for the length is still there, so this can be a bit more
+        // than a frame without the result being too big
+        const size_t limit = MaxFrameSize + MaxLengthSize;
+        if (size > limit - m_end) {
+            m_overflow = true;
+            return false;
+        }
+        const size_t capacity = std::min(std::max(m_capacity * 2, m_end + size), limit);
+        std::unique_ptr<uint8_t[]> heap(new uint8_t[capacity]);
+        memcpy(heap.get(), m_buffer, std::min(m_end, m_capacity));
+        m_heap = std::move(heap);
+        m_buffer = m_heap.get();
+        m_capacity = capacity;
+        return true;
+    }
+
+    uint8_t m_inline[InlineSize];
+    std::unique_ptr<uint8_t[]> m_heap;
+    uint8_t *m_buffer = m_inline;
+    size_t m_capacity = InlineSize;
+    const size_t m_headerSize;
+    const size_t m_payloadStart;
+    size_t m_end;
+    bool m_overflow = false;
+};
+
+// The parts of the frames we send to one destination over and over, encoded
+// the first time they're needed and thrown away if the destination changes.
+class FrameTemplates
+{
+public:
+    static constexpr const char *payloads[msg::SimpleMessageCount] = {
+        "{\"type\": \"CONNECT\"}",
+        "{\"type\": \"PING\"}",
+        "{\"type\": \"PONG\"}",
+        "{\"type\": \"GET_STATUS\", \"requestId\": 1}",
+        "{\"type\": \"MEDIA_STATUS\"}"
+    };
+
+    // Everything before the payload for a message in the namespace
+    const pb::Bytes &header(const std::string_view destination, const ns::Namespace urn)
+    {
+        const std::string_view dest = destination.empty() ? "receiver-0" : destination;
+        if (dest != m_destination) {
+            m_destination = dest;
+            for (int i=0; i<ns::NamespacesCount; i++) {
+                m_headers[i].clear();
+                for (int type=0; type<msg::SimpleMessageCount; type++) {
+                    m_frames[type][i].clear();
+                }
+            }
+        }
+        pb::Bytes &header = m_headers[urn];
+        if (!header.empty()) {
+            return header;
+        }
+
+        CastMessageView message;
+        message._payload_type = CastMessage::STRING;
+        message._protocol_version = CastMessage::CASTV2_1_0;
+        message._namespace = ns::strings[urn];
+        message._source_id = "sender-0";
+        message._destination_id = m_destination;
+
+        // The payload is left out when it's empty, so we add its key ourselves
+        header.resize(message.size() + pb::varintSize(CastPayloadField::key));
+        uint8_t *end = message.write(header.data(), header.data() + header.size());
+        pb::writeVarint(end, CastPayloadField::key);
+        return header;
+    }
+
+    // A whole frame for a message that never changes
+    std::basic_string_view<uint8_t> simple(const std::string_view destination, const msg::Type type, const ns::Namespace urn)
+    {
+        const pb::Bytes &head = header(destination, urn);
+        pb::Bytes &frame = m_frames[type][urn];
+        if (frame.empty()) {
+            FrameWriter writer(head);
+            frame = writer.append(payloads[type]).finish();
+        }
+        return frame;
+    }
+
+private:
+    std::string m_destination;
+    pb::Bytes m_headers[ns::NamespacesCount];
+    pb::Bytes m_frames[msg::SimpleMessageCount][ns::NamespacesCount];
+};
+
+} // namespace cc
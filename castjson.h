@@ -0,0 +1,317 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <string_view>
+
+namespace cc
+{
+
+// The fields we care about in the JSON payloads from the chromecast. The
+// strings point into the payload (raw, escapes are not decoded), so it has
+// to outlive this. Except for type, which is only taken from the top level,
+// it's the first occurrence anywhere outside the queue items, like a regex
+// search would find.
+struct PayloadFields
+{
+    std::string_view type;
+    std::string_view playerState;
+    std::string_view mediaSessionId; // the digits, it's just sent back
+    std::string_view contentId;
+    std::string_view sessionId;
+    std::string_view displayName;
+
+    bool hasCurrentTime = false;
+    double currentTime = 0.;
+    bool hasDuration = false;
+    double duration = 0.;
+    bool hasPlaybackRate = false;
+    double playbackRate = 0.;
+
+    // YouTube puts its own numeric player state in customData
+    bool hasCustomPlayerState = false;
+    int customPlayerState = 0;
+
+    // The queue, if it sent it. contentId above is never from in here.
+    struct QueueItem {
+        int itemId = -1;
+        std::string_view contentId;
+    };
+    static constexpr int MaxQueueItems = 8;
+    QueueItem queueItems[MaxQueueItems];
+    int queueItemCount = 0;
+    int currentItemId = -1;
+    int preloadedItemId = -1;
+
+    // Internal, where the items array is while scanning
+    int itemsDepth = 0;
+    int itemsSeen = 0;
+};
+
+namespace json
+{
+
+inline bool isSpace(const char c)
+{
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+inline bool isNumberChar(const char c)
+{
+    return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+// pos is at the opening quote, returns the position after the closing quote
+// or npos if it's unterminated
+inline size_t readString(const std::string_view json, size_t pos, std::string_view *value)
+{
+    const size_t start = pos + 1;
+    for (pos = start; pos < json.size(); pos++) {
+        if (json[pos] == '\\') {
+            pos++;
+        } else if (json[pos] == '"') {
+            *value = json.substr(start, pos - start);
+            return pos + 1;
+        }
+    }
+    return std::string_view::npos;
+}
+
+inline bool toDouble(const std::string_view token, double *number)
+{
+    // Numbers are short, and strtod wants it terminated
+    char buffer[64];
+    if (token.empty() || token.size() >= sizeof buffer) {
+        return false;
+    }
+    memcpy(buffer, token.data(), token.size());
+    buffer[token.size()] = '\0';
+    char *end = nullptr;
+    const double converted = strtod(buffer, &end);
+    if (end != buffer + token.size() || !std::isfinite(converted)) {
+        return false;
+    }
+    *number = converted;
+    return true;
+}
+
+// IDs and states are ints, anything else (too big, fractions) isn't one
+inline bool toInt(const std::string_view token, int *value)
+{
+    double number = 0.;
+    if (!toDouble(token, &number) || number != std::trunc(number) ||
+            number < std::numeric_limits<int>::min() || number > std::numeric_limits<int>::max()) {
+        return false;
+    }
+    *value = int(number);
+    return true;
+}
+
+// Only what the old regex took, it goes back to the chromecast as it is
+inline bool isDigits(const std::string_view token)
+{
+    return !token.empty() && std::all_of(token.begin(), token.end(), [](const char c) {
+        return c >= '0' && c <= '9';
+    });
+}
+
+inline PayloadFields::QueueItem *currentQueueItem(PayloadFields *fields, const int depth)
+{
+    if (!fields->itemsDepth || depth <= fields->itemsDepth || fields->itemsSeen == 0) {
+        return nullptr;
+    }
+    if (fields->itemsSeen > PayloadFields::MaxQueueItems) {
+        return nullptr;
+    }
+    return &fields->queueItems[fields->itemsSeen - 1];
+}
+
+inline void storeString(PayloadFields *fields, const std::string_view key, const std::string_view value, const int depth)
+{
+    if (fields->itemsDepth && depth > fields->itemsDepth) {
+        PayloadFields::QueueItem *item = currentQueueItem(fields, depth);
+        if (item && key == "contentId" && item->contentId.data() == nullptr) {
+            item->contentId = value;
+        }
+        return;
+    }
+
+    std::string_view *target = nullptr;
+    switch(key.size()) {
+    case 4:
+        if (key == "type" && depth == 1) target = &fields->type;
+        break;
+    case 9:
+        if (key == "contentId") target = &fields->contentId;
+        else if (key == "sessionId") target = &fields->sessionId;
+        break;
+    case 11:
+        if (key == "playerState") target = &fields->playerState;
+        else if (key == "displayName") target = &fields->displayName;
+        break;
+    default:
+        break;
+    }
+    if (target && target->data() == nullptr) {
+        *target = value;
+    }
+}
+
+inline void storeNumber(PayloadFields *fields, const std::string_view key, const std::string_view token, const int depth)
+{
+    bool *has = nullptr;
+    double *target = nullptr;
+    int *id = nullptr;
+    if (fields->itemsDepth && depth > fields->itemsDepth) {
+        PayloadFields::QueueItem *item = currentQueueItem(fields, depth);
+        if (item && depth == fields->itemsDepth + 1 && key == "itemId") {
+            id = &item->itemId;
+        }
+    } else if (key == "currentItemId" && fields->currentItemId < 0) {
+        id = &fields->currentItemId;
+    } else if (key == "preloadedItemId" && fields->preloadedItemId < 0) {
+        id = &fields->preloadedItemId;
+    }
+    if (id) {
+        toInt(token, id);
+        return;
+    }
+    if (fields->itemsDepth && depth > fields->itemsDepth) {
+        return;
+    }
+
+    switch(key.size()) {
+    case 8:
+        if (key == "duration") { has = &fields->hasDuration; target = &fields->duration; }
+        break;
+    case 11:
+        if (key == "currentTime") {
+            has = &fields->hasCurrentTime;
+            target = &fields->currentTime;
+        } else if (key == "playerState" && !fields->hasCustomPlayerState) {
+            fields->hasCustomPlayerState = toInt(token, &fields->customPlayerState);
+            return;
+        }
+        break;
+    case 12:
+        if (key == "playbackRate") { has = &fields->hasPlaybackRate; target = &fields->playbackRate; }
+        break;
+    case 14:
+        if (key == "mediaSessionId" && fields->mediaSessionId.data() == nullptr && isDigits(token)) {
+            fields->mediaSessionId = token;
+        }
+        return;
+    default:
+        break;
+    }
+    if (has && !*has) {
+        *has = toDouble(token, target);
+    }
+}
+
+} // namespace json
+
+// Picks out all the fields in one pass, without allocating anything.
+// Returns false if the payload is cut off or isn't JSON, whatever was
+// found before that is still filled in.
+inline bool scanPayload(const std::string_view payload, PayloadFields *fields)
+{
+    // One bit per level, set if it's an object, so we know whether a string
+    // after a comma is a key or not. Deeper than this is just treated as
+    // arrays, we don't care about anything that deep anyways.
+    uint64_t objects = 0;
+    int depth = 0;
+    bool expectKey = false;
+
+    size_t pos = 0;
+    while (pos < payload.size()) {
+        const char c = payload[pos];
+        switch(c) {
+        case '{':
+        case '[':
+            depth++;
+            if (depth < 64) {
+                objects = (objects & ~(uint64_t(1) << depth)) | (uint64_t(c == '{') << depth);
+            }
+            if (c == '{' && fields->itemsDepth && depth == fields->itemsDepth + 1) {
+                fields->itemsSeen++;
+                if (fields->queueItemCount < PayloadFields::MaxQueueItems) {
+                    fields->queueItemCount++;
+                }
+            }
+            expectKey = c == '{';
+            pos++;
+            continue;
+        case '}':
+        case ']':
+            if (depth == 0) {
+                return false;
+            }
+            if (depth == fields->itemsDepth) {
+                fields->itemsDepth = 0;
+            }
+            depth--;
+            expectKey = false;
+            pos++;
+            continue;
+        case ',':
+            expectKey = depth < 64 && (objects >> depth & 1);
+            pos++;
+            continue;
+        case '"':
+            break;
+        default:
+            pos++;
+            continue;
+        }
+
+        std::string_view string;
+        pos = json::readString(payload, pos, &string);
+        if (pos == std::string_view::npos) {
+            return false;
+        }
+        if (!expectKey) {
+            continue;
+        }
+        expectKey = false;
+
+        while (pos < payload.size() && json::isSpace(payload[pos])) {
+            pos++;
+        }
+        if (pos >= payload.size() || payload[pos] != ':') {
+            return false;
+        }
+        pos++;
+        while (pos < payload.size() && json::isSpace(payload[pos])) {
+            pos++;
+        }
+        if (pos >= payload.size()) {
+            return false;
+        }
+
+        if (payload[pos] == '"') {
+            std::string_view value;
+            pos = json::readString(payload, pos, &value);
+            if (pos == std::string_view::npos) {
+                return false;
+            }
+            json::storeString(fields, string, value, depth);
+        } else if (json::isNumberChar(payload[pos])) {
+            const size_t start = pos;
+            while (pos < payload.size() && json::isNumberChar(payload[pos])) {
+                pos++;
+            }
+            json::storeNumber(fields, string, payload.substr(start, pos - start), depth);
+        } else if (payload[pos] == '[' && string == "items" && !fields->itemsDepth && !fields->itemsSeen) {
+            fields->itemsDepth = depth + 1;
+        }
+        // Objects, arrays and literals are handled by the loop
+    }
+    return depth == 0;
+}
+
+} // namespace cc
@@ -1,96 +1,54 @@
 #pragma once
 
 #include "globals.h"
-#include "connection.h"
+#include "session.h"
 #include "castchannel.h"
+#include "castframes.h"
 #include <fstream>
 
 namespace cc
 {
-    static std::string dest;
-    static std::string mediaSession;
 
-bool sendMessage(const Connection &conn, const std::string &ns, const std::string &message)
+static bool sendFrame(Session &session, const ns::Namespace urn, const std::basic_string_view<uint8_t> frame, const std::string_view payload)
 {
     if (s_verbose) {
-        std::cout << "Sending to '" << dest << "': '" << ns << ": '" << message << "'" << std::endl;
+        const std::string &dest = session.dest;
+        std::cout << "Sending to '" << session.name << "/" << dest << "': '" << ns::strings[urn] << ": '" << payload << "'" << std::endl;
     }
-
-    CastMessage msg;
-    msg._payload_type = CastMessage::STRING;
-    msg._protocol_version = CastMessage::CASTV2_1_0;
-    msg._namespace = ns;
-    msg._source_id = "sender-0";
-    msg._destination_id = dest.empty() ? "receiver-0" : dest;
-    msg._payload_utf8 = message;
-
-    const uint32_t byteSize = htonl(uint32_t(msg.size()));
-    std::basic_string<uint8_t> buffer(sizeof byteSize, '\0');
-    memcpy(buffer.data(), &byteSize, sizeof byteSize);
-
-    std::basic_string<uint8_t> contents;
-    contents.reserve(1024);
-    if (!msg.serialize(&buffer)) {
-        puts("Failed to serialize");
+    // Nothing goes out before the handshake is done
+    if (session.connection.state != Connection::Connected) {
+        printf("Not connected to %s yet\n", session.name.c_str());
+        return false;
+    }
+    if (frame.empty()) {
+        puts("Message too big");
         return false;
     }
-    return conn.write(buffer);
+    return session.connection.write(frame.data(), frame.size());
 }
-namespace ns {
-enum Namespace {
-    Connection = 0,
-    Receiver,
-    Heartbeat,
-    Media,
-    NamespacesCount
-};
-static const char *strings[ns::NamespacesCount] = {
-    "urn:x-cast:com.google.cast.tp.connection",
-    "urn:x-cast:com.google.cast.receiver",
-    "urn:x-cast:com.google.cast.tp.heartbeat",
-    "urn:x-cast:com.google.cast.media"
-};
-}// namespace ns
 
-namespace msg
+static bool sendFrame(Session &session, const ns::Namespace urn, FrameWriter *writer)
 {
-enum Type {
-    Connect = 0,
-    Ping,
-    Pong,
-    GetStatus,
-    MediaStatus,
-    SimpleMessageCount
-};
-
-}//namespace msgs
+    const std::basic_string_view<uint8_t> frame = writer->finish();
+    return sendFrame(session, urn, frame, writer->payload());
+}
 
-static int s_requestId = 1;
-bool sendSimple(const Connection &conn, const msg::Type type, const ns::Namespace urn)
+bool sendSimple(Session &session, const msg::Type type, const ns::Namespace urn)
 {
-    static const char *msgs[msg::SimpleMessageCount] = {
-        "{\"type\": \"CONNECT\"}",
-        "{\"type\": \"PING\"}",
-        "{\"type\": \"PONG\"}",
-        "{\"type\": \"GET_STATUS\", \"requestId\": 1}",
-        "{\"type\": \"MEDIA_STATUS\"}"
-    };
-
     if (urn >= ns::NamespacesCount) {
         return false;
     }
     if (type >= msg::SimpleMessageCount) {
         return false;
     }
-    if (type == msg::GetStatus && mediaSession != "") {
-        return sendMessage(conn,
-                ns::strings[ns::Media],
-                "{ "
+    if (type == msg::GetStatus && !session.mediaSession.empty()) {
+        FrameWriter writer(session.frames.header(session.dest, ns::Media));
+        writer.append("{ "
                 " \"type\": \"GET_STATUS\", "
-                " \"requestId\": " + std::to_string(s_requestId++) + ", "
-                " \"mediaSessionId\": \"" + mediaSession + "\""
-                "}"
-            );
+                " \"requestId\": ").append(session.requestId++).append(", "
+                " \"mediaSessionId\": \"").append(session.mediaSession).append("\""
+                "}");
+        return sendFrame(session, ns::Media, &writer);
     }
 
     const bool wasVerbose = s_verbose;
@@ -98,64 +56,61 @@ bool sendSimple(const Connection &conn, const msg::Type type, const ns::Namespac
         // too much spam
         s_verbose = false;
     }
-    const bool ret = sendMessage(conn, ns::strings[urn], msgs[type]);
+    const bool ret = sendFrame(session, urn, session.frames.simple(session.dest, type, urn), FrameTemplates::payloads[type]);
     s_verbose = wasVerbose;
     return ret;
 }
 
-bool seek(const Connection &conn, double position)
+bool seek(Session &session, double position)
 {
-    if (mediaSession.empty()) {
+    if (session.mediaSession.empty()) {
         std::cerr << "Can't seek without media session" << std::endl;
         return false;
     }
-    return sendMessage(conn,
-            ns::strings[ns::Media],
-            "{ "
+    FrameWriter writer(session.frames.header(session.dest, ns::Media));
+    writer.append("{ "
             " \"type\": \"SEEK\", "
-            " \"requestId\": " + std::to_string(s_requestId++) + ", "
-            " \"mediaSessionId\": \"" + mediaSession + "\", "
-            " \"currentTime\": " + std::to_string(position) +
-            "}"
-        );
+            " \"requestId\": ").append(session.requestId++).append(", "
+            " \"mediaSessionId\": \"").append(session.mediaSession).append("\", "
+            " \"currentTime\": ").append(position).append(
+            "}");
+    return sendFrame(session, ns::Media, &writer);
 }
 
-bool sendSimpleMedia(const Connection &conn, const std::string &command)
+bool sendSimpleMedia(Session &session, const std::string_view command)
 {
-    if (mediaSession.empty()) {
+    if (session.mediaSession.empty()) {
         std::cerr << "Can't seek without media session" << std::endl;
         return false;
     }
-    return sendMessage(conn,
-            ns::strings[ns::Media],
-            "{ "
-            " \"type\": \"" + command + "\", "
-            " \"requestId\": " + std::to_string(s_requestId++) + ", "
-            " \"mediaSessionId\": \"" + mediaSession + "\" "
-            "}"
-        );
+    FrameWriter writer(session.frames.header(session.dest, ns::Media));
+    writer.append("{ "
+            " \"type\": \"").append(command).append("\", "
+            " \"requestId\": ").append(session.requestId++).append(", "
+            " \"mediaSessionId\": \"").append(session.mediaSession).append("\" "
+            "}");
+    return sendFrame(session, ns::Media, &writer);
 }
 
 
-bool loadMedia(const Connection &conn, const std::string &video, double position)
+bool loadMedia(Session &session, const std::string &video, double position)
 {
     if (video.empty()) {
         puts("Can't load empty video");
         return false;
     }
-    return sendMessage(conn,
-            ns::strings[ns::Media],
-            "{ "
+    FrameWriter writer(session.frames.header(session.dest, ns::Media));
+    writer.append("{ "
             " \"type\": \"LOAD\", "
-            " \"requestId\": " + std::to_string(s_requestId++) + ", "
+            " \"requestId\": ").append(session.requestId++).append(", "
             " \"media\": {"
-            "   \"contentId\": \"" + video + "\", "
+            "   \"contentId\": \"").append(video).append("\", "
             "   \"streamType\": \"BUFFERED\", "
             "   \"contentType\": \"x-youtube/video\" "
             " }, "
-            " \"currentTime\": " + std::to_string(position) +
-            "}"
-        );
+            " \"currentTime\": ").append(position).append(
+            "}");
+    return sendFrame(session, ns::Media, &writer);
 }
 
 } //namespace cc
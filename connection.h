@@ -1,7 +1,9 @@
 #pragma once
 
 #include "globals.h"
+#include "reactor.h"
 #include "ssl.h"
+#include "util.h"
 
 #include <string>
 #include <iostream>
@@ -17,10 +19,30 @@ extern "C" {
 #include <sys/socket.h>
 }
 
+#include <algorithm>
 #include <cassert>
+#include <vector>
+#include <functional>
+#include <memory>
+#include <string_view>
+
+// Where to connect to, and optionally which way to go there
+struct Endpoint
+{
+    sockaddr_storage address{};
+    std::string interfaceName;
+    sockaddr_storage localAddress{}; // AF_UNSPEC if we don't care
+};
 
 struct Connection
 {
+    enum State {
+        Disconnected,
+        Connecting,
+        Handshaking,
+        Connected
+    };
+
     // Chromecasts use self-signed certs
     static int verify_callback(int, ssl::X509_STORE_CTX*) {
         return 1;
@@ -36,6 +58,15 @@ struct Connection
     }
 
     ~Connection() {
+        if (m_reactor) {
+            closeCandidates();
+            if (m_connectTimer) {
+                m_reactor->unwatch(m_connectTimer->fd);
+            }
+            if (state == Handshaking) {
+                m_reactor->unwatch(fd);
+            }
+        }
         if (handle) {
             ssl::SSL_free(handle);
         }
@@ -47,110 +78,315 @@ struct Connection
         }
     }
 
-    bool connect(const sockaddr_in &address)
+    // Connects to whichever of the endpoints answers first (happy eyeballs),
+    // so a device with both an IPv4 and an IPv6 address gets the fastest one,
+    // and then does the TLS handshake. It all happens on the reactor, so a
+    // device that is slow to answer or stalls halfway through the handshake
+    // never holds up anything else. onDone is called once, with whether it
+    // worked, within CONNECT_TIMEOUT. Returns false if there was nothing to
+    // try, onDone isn't called then.
+    bool connect(reactor::Reactor *reactor, const std::vector<Endpoint> &endpoints, std::function<void(bool connected)> onDone)
     {
-	fd = ::socket(PF_INET, SOCK_STREAM, 0);
-        if (fd < 0) {
-            perror("Failed to open socket");
-            return false;
+        m_reactor = reactor;
+        for (const Endpoint &endpoint : endpoints) {
+            const int candidate = openSocket(endpoint);
+            if (candidate < 0) {
+                continue;
+            }
+            m_candidates.push_back({candidate, addressToString(reinterpret_cast<const sockaddr*>(&endpoint.address))});
+            reactor->watch(candidate, reactor::Writable, [this, candidate](uint32_t) {
+                onCandidateReady(candidate);
+            });
         }
-        int timeout = PING_INTERVAL * 1000;
-        int ret = ::setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout, sizeof timeout);
-        if (ret != 0) {
-            perror("Failed to set socket timeout");
+        if (m_candidates.empty()) {
             return false;
         }
+        state = Connecting;
+        m_onConnected = std::move(onDone);
 
-        std::string addressString = std::string(inet_ntoa(address.sin_addr)) + ":" + std::to_string(ntohs(address.sin_port));
-        ret = ::connect(fd, (const struct sockaddr*)(&address), sizeof address);
-        if (ret != 0) {
-            perror(("Failed to connect to " + addressString).c_str());
-            return false;
+        if (!m_connectTimer) {
+            m_connectTimer = std::make_unique<reactor::Timer>();
         }
+        m_peerName = m_candidates[0].name;
+        reactor->watchTimer(m_connectTimer.get(), [this]() {
+            fprintf(stderr, "Timed out %s %s\n", state == Handshaking ? "during TLS handshake with" : "connecting to", m_peerName.c_str());
+            finishConnect(false);
+        });
+        m_connectTimer->start(std::chrono::seconds(CONNECT_TIMEOUT));
+        return true;
+    }
 
-        // Do ssl connection
-        ssl::SSL_set_fd(handle, fd);
-        ret = ssl::SSL_connect(handle);
-        if (ret != 1) {
-            fprintf(stderr, "SSL error: %d\n", ssl::SSL_get_error(handle, ret));
+    // Sends what the socket has room for right away, the rest goes out from
+    // flush() when the reactor says it's writable. Returns false if the
+    // connection is broken.
+    bool write(const void *data, size_t size)
+    {
+        if (m_writing.size() + m_pending.size() + size > MaxQueued) {
+            fputs("Not sending anything, too much is queued up already\n", stderr);
             return false;
         }
+        m_pending.append(static_cast<const char*>(data), size);
+        return flush();
+    }
 
+    // SSL_write() wants the same buffer again if it has to be retried, so
+    // new messages queue up in pending while writing is in flight
+    bool flush()
+    {
+        while (true) {
+            if (m_writing.empty()) {
+                if (m_pending.empty()) {
+                    break;
+                }
+                m_writing.swap(m_pending);
+            }
+            const int ret = ssl::SSL_write(handle, m_writing.data(), int(m_writing.size()));
+            if (ret <= 0) {
+                const int error = ssl::SSL_get_error(handle, ret);
+                if (error != ssl::SSL_ERROR_WANT_READ && error != ssl::SSL_ERROR_WANT_WRITE) {
+                    fprintf(stderr, "SSL write error: %d\n", error);
+                    return false;
+                }
+                break;
+            }
+            m_writing.clear();
+        }
+        // Only bother the reactor when it changes, most writes go straight out
+        const bool waitForWritable = !m_writing.empty();
+        if (m_reactor && waitForWritable != m_waitingForWritable) {
+            m_waitingForWritable = waitForWritable;
+            m_reactor->setEvents(fd, reactor::Readable | (waitForWritable ? uint32_t(reactor::Writable) : 0u));
+        }
         return true;
     }
 
-    template<typename T>
-    bool write(const std::basic_string<T> &data) const {
-        return size_t(ssl::SSL_write(handle, data.data(), data.size())) == data.size();
+    bool hasQueued() const {
+        return !m_writing.empty() || !m_pending.empty();
     }
 
-    std::string read(int size) {
-        std::string buffer(size, '\0');
-        int amount = ssl::SSL_read(handle, buffer.data(), buffer.size());
-        if (amount < 0) {
-            fprintf(stderr, "SSL read error: %d\n", ssl::SSL_get_error(handle, amount));
-            return "";
+    enum FrameResult {
+        Frame,
+        Incomplete,
+        InvalidFrame
+    };
+
+    // Reads whatever the socket has for us without blocking, until it runs
+    // dry or the read buffer is full. Returns false on errors, eof is set if
+    // the other end closed the connection.
+    bool receive()
+    {
+        if (!readBuffer) {
+            readBuffer.reset(new char[ReadBufferSize]);
         }
-        if (amount == 0) {
-            eof = true;
+        // Only a partial message is left, move it to the front to make room
+        if (readStart > 0) {
+            memmove(readBuffer.get(), readBuffer.get() + readStart, readEnd - readStart);
+            readEnd -= readStart;
+            readStart = 0;
         }
+        while (readEnd < ReadBufferSize) {
+            const int amount = ssl::SSL_read(handle, readBuffer.get() + readEnd, int(ReadBufferSize - readEnd));
+            if (amount > 0) {
+                readEnd += amount;
+                continue;
+            }
+            const int error = ssl::SSL_get_error(handle, amount);
+            if (error == ssl::SSL_ERROR_WANT_READ) {
+                return true;
+            }
+            if (error == ssl::SSL_ERROR_ZERO_RETURN || (error == ssl::SSL_ERROR_SYSCALL && amount == 0)) {
+                eof = true;
+                return true;
+            }
+            fprintf(stderr, "SSL read error: %d\n", error);
+            return false;
+        }
+        return true;
+    }
 
-        buffer.resize(amount);
-        return buffer;
+    // If OpenSSL has decrypted more than fit in the buffer the socket won't
+    // wake us up for it, so it has to be drained before we go back to sleep
+    bool hasPending() const {
+        return ssl::SSL_pending(handle) > 0;
     }
 
+    // Returns a view of the next complete length-prefixed message in the read
+    // buffer, valid until the next call to receive()
+    FrameResult nextFrame(std::string_view *frame)
+    {
+        const size_t available = readEnd - readStart;
+        if (available < sizeof(uint32_t)) {
+            return Incomplete;
+        }
+        uint32_t length = 0;
+        memcpy(&length, readBuffer.get() + readStart, sizeof length);
+        length = ntohl(length);
+        if (length > MaxMessageSize) {
+            printf("Message length out of range: %u\n", length);
+            return InvalidFrame;
+        }
+        if (available - sizeof(uint32_t) < length) {
+            return Incomplete;
+        }
+        *frame = std::string_view(readBuffer.get() + readStart + sizeof(uint32_t), length);
+        readStart += sizeof(uint32_t) + length;
+        return Frame;
+    }
+
+    // Starts a non-blocking connect, returns the socket or -1 on failure
+    static int openSocket(const Endpoint &endpoint)
+    {
+        const int family = endpoint.address.ss_family;
+        const int candidate = ::socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (candidate < 0) {
+            perror("Failed to open socket");
+            return -1;
+        }
+        int timeout = PING_INTERVAL * 1000;
+        if (::setsockopt(candidate, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout, sizeof timeout) != 0) {
+            perror("Failed to set socket timeout");
+            close(candidate);
+            return -1;
+        }
+
+        // If we know which interface the other end is on we go through that
+        // directly, instead of trusting the routing table on multi-homed hosts.
+        // Binding to the device needs CAP_NET_RAW, otherwise the source address is the next best thing
+        const std::string &interfaceName = endpoint.interfaceName;
+        if (!interfaceName.empty() && ::setsockopt(candidate, SOL_SOCKET, SO_BINDTODEVICE, interfaceName.c_str(), interfaceName.size()) != 0 &&
+                endpoint.localAddress.ss_family == family) {
+            const socklen_t localSize = family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+            if (::bind(candidate, reinterpret_cast<const sockaddr*>(&endpoint.localAddress), localSize) != 0 && s_verbose) {
+                perror(("Failed to bind to " + interfaceName).c_str());
+            }
+        }
+
+        const socklen_t addressSize = family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+        if (::connect(candidate, reinterpret_cast<const sockaddr*>(&endpoint.address), addressSize) != 0 && errno != EINPROGRESS) {
+            perror(("Failed to connect to " + addressToString(reinterpret_cast<const sockaddr*>(&endpoint.address))).c_str());
+            close(candidate);
+            return -1;
+        }
+        return candidate;
+    }
+
+    // 64kb max according to the spec, so the buffer always has room for the
+    // rest of a message once what's before it has been handled
+    static constexpr size_t MaxMessageSize = 64 * 1024;
+    static constexpr size_t ReadBufferSize = sizeof(uint32_t) + MaxMessageSize;
+
+    // What we send is tiny, if this much hasn't gone out the other end isn't reading
+    static constexpr size_t MaxQueued = 4 * MaxMessageSize;
+
+    // Only allocated for connections that actually read messages
+    std::unique_ptr<char[]> readBuffer;
+    size_t readStart = 0;
+    size_t readEnd = 0;
+
     bool eof = false;
     const ssl::SSL_METHOD *method = nullptr;
     ssl::SSL_CTX *ctx = nullptr;
     ssl::SSL *handle = nullptr;
     int fd = -1;
-};
-
-static std::string downloadFile(const std::string &hostname, const int port, const std::string &filePath)
-{
-    struct sockaddr_in serverAddress;
-    serverAddress.sin_family = AF_INET;
-    serverAddress.sin_port = htons(port);
+    State state = Disconnected;
 
-    if (s_verbose) {
-        printf("Downloading: %s:%d/%s\n", hostname.c_str(), port, filePath.c_str());
-    }
+private:
+    struct Candidate {
+        int fd = -1;
+        std::string name;
+    };
 
-    struct hostent *hostinfo = gethostbyname(hostname.c_str());
+    void onCandidateReady(const int candidate)
+    {
+        std::vector<Candidate>::iterator it = std::find_if(m_candidates.begin(), m_candidates.end(), [candidate](const Candidate &c) {
+            return c.fd == candidate;
+        });
+        if (it == m_candidates.end()) {
+            return;
+        }
+        int error = 0;
+        socklen_t errorSize = sizeof error;
+        getsockopt(candidate, SOL_SOCKET, SO_ERROR, &error, &errorSize);
+        if (error != 0) {
+            fprintf(stderr, "Failed to connect to %s: %s\n", it->name.c_str(), strerror(error));
+            m_reactor->unwatch(candidate);
+            close(candidate);
+            m_candidates.erase(it);
+            if (m_candidates.empty()) {
+                finishConnect(false);
+            }
+            return;
+        }
+        if (s_verbose) {
+            printf("Connected to %s\n", it->name.c_str());
+        }
 
-    if (hostinfo == nullptr) {
-        perror(("Failed to resolve " + hostname).c_str());
-        return "";
+        // We have a winner, drop the rest
+        m_peerName = it->name;
+        m_candidates.erase(it);
+        closeCandidates();
+        fd = candidate;
+        state = Handshaking;
+        ssl::SSL_set_fd(handle, fd);
+        m_reactor->watch(fd, reactor::Writable, [this](uint32_t) {
+            handshake();
+        });
+        handshake();
     }
 
-    serverAddress.sin_addr = *(struct in_addr*) hostinfo->h_addr;
-
-    Connection connection;
-    if (!connection.connect(serverAddress)) {
-        std::cerr << "Failed to connect to " << hostname << std::endl;
-        return "";
+    void handshake()
+    {
+        const int ret = ssl::SSL_connect(handle);
+        if (ret == 1) {
+            state = Connected;
+            finishConnect(true);
+            return;
+        }
+        const int error = ssl::SSL_get_error(handle, ret);
+        if (error == ssl::SSL_ERROR_WANT_READ || error == ssl::SSL_ERROR_WANT_WRITE) {
+            m_reactor->setEvents(fd, error == ssl::SSL_ERROR_WANT_READ ? reactor::Readable : reactor::Writable);
+            return;
+        }
+        fprintf(stderr, "SSL error: %d\n", error);
+        finishConnect(false);
     }
 
-    const std::string request =
-        "GET " + filePath + " HTTP/1.1\r\n" +
-        "Host: " + hostname + "\r\n"
-        "User-Agent: fuckifiknow/1.0\r\n"
-        "Accept: */*\r\n"
-        "\r\n";
-
-    if (!connection.write(request)) {
-        puts("Failed to write GET request");
-        return "";
+    // The socket is left unwatched either way, whoever uses it watches it themselves
+    void finishConnect(const bool connected)
+    {
+        m_reactor->unwatch(m_connectTimer->fd);
+        m_connectTimer->stop();
+        closeCandidates();
+        if (fd >= 0) {
+            m_reactor->unwatch(fd);
+        }
+        if (!connected) {
+            state = Disconnected;
+        }
+        // It might be the last thing we do, the callback is allowed to get rid of us
+        const std::function<void(bool)> onDone = std::move(m_onConnected);
+        m_onConnected = nullptr;
+        if (onDone) {
+            onDone(connected);
+        }
     }
-    const std::string response = connection.read(1024 * 1024); // idk, 1MB should be enough
-
-    const char *endOfHeaderMarker = "\r\n\r\n";
-    // Just ignore all the header shit
-    std::string::size_type endOfHeader = response.find(endOfHeaderMarker);
-    if (endOfHeader == std::string::npos) {
-        puts("Failed to find end of header in returned data");
-        return "";
+
+    void closeCandidates()
+    {
+        for (const Candidate &candidate : m_candidates) {
+            m_reactor->unwatch(candidate.fd);
+            close(candidate.fd);
+        }
+        m_candidates.clear();
     }
 
-    return response.substr(endOfHeader + strlen(endOfHeaderMarker));
-}
+    reactor::Reactor *m_reactor = nullptr;
+    std::vector<Candidate> m_candidates;
+    std::string m_peerName; // for error messages
+    std::unique_ptr<reactor::Timer> m_connectTimer; // only for the connections we set up ourselves
+    std::function<void(bool)> m_onConnected;
+
+    std::string m_writing;
+    std::string m_pending;
+    bool m_waitingForWritable = false;
+};
@@ -0,0 +1,442 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+extern "C" {
+#include <netinet/in.h>
+}
+
+// Allocation-free parsing of DNS packets, everything points back into the
+// packet so it has to outlive whatever is parsed out of it.
+namespace dns
+{
+
+enum Type : uint16_t {
+    A = 1,
+    CNAME = 5,
+    PTR = 12,
+    TXT = 16,
+    AAAA = 28,
+    SRV = 33,
+    ANY = 255
+};
+
+static constexpr uint16_t ClassIN = 1;
+
+// mdns reuses the top bit of the class, for cache flush in answers and
+// "unicast response please" in questions
+static constexpr uint16_t ClassMask = 0x7fff;
+static constexpr uint16_t CacheFlush = 0x8000;
+static constexpr uint16_t UnicastResponse = 0x8000;
+
+static constexpr size_t HeaderSize = 12;
+static constexpr size_t MaxNameLength = 255;
+
+inline uint16_t read16(const uint8_t *data)
+{
+    return uint16_t(data[0] << 8 | data[1]);
+}
+
+inline uint32_t read32(const uint8_t *data)
+{
+    return uint32_t(data[0]) << 24 | uint32_t(data[1]) << 16 | uint32_t(data[2]) << 8 | data[3];
+}
+
+inline char toLower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? char(c + 'a' - 'A') : c;
+}
+
+// A possibly compressed name somewhere in a packet
+struct Name
+{
+    const uint8_t *packet = nullptr;
+    size_t packetSize = 0;
+    size_t offset = 0;
+
+    // Calls callback(std::string_view label) for each label, callback can
+    // return false to stop early. Returns false if the name is malformed.
+    template<typename Callback>
+    bool forEachLabel(Callback callback) const
+    {
+        if (!packet) {
+            return false;
+        }
+        size_t pos = offset;
+        size_t totalLength = 0;
+        // Only allow pointers backwards, so we can't loop forever
+        size_t limit = packetSize;
+
+        while (pos < packetSize) {
+            const uint8_t length = packet[pos];
+            if (length == 0) {
+                return true;
+            }
+            if ((length & 0xc0) == 0xc0) {
+                if (pos + 1 >= packetSize) {
+                    return false;
+                }
+                const size_t target = (length & 0x3f) << 8 | packet[pos + 1];
+                if (target >= limit || target >= pos) {
+                    return false;
+                }
+                limit = target;
+                pos = target;
+                continue;
+            }
+            if (length & 0xc0) { // reserved label types
+                return false;
+            }
+            if (pos + 1 + length > packetSize) {
+                return false;
+            }
+            totalLength += length + 1;
+            if (totalLength > MaxNameLength) {
+                return false;
+            }
+            if (!callback(std::string_view(reinterpret_cast<const char*>(packet + pos + 1), length))) {
+                return true;
+            }
+            pos += 1 + length;
+        }
+        return false;
+    }
+
+    bool isValid() const
+    {
+        return forEachLabel([](std::string_view) { return true; });
+    }
+
+    // Case-insensitive comparison against a dotted name, trailing dot is optional
+    bool equals(std::string_view dotted) const
+    {
+        if (!dotted.empty() && dotted.back() == '.') {
+            dotted.remove_suffix(1);
+        }
+        bool matches = true;
+        const bool valid = forEachLabel([&](std::string_view label) {
+            if (dotted.size() < label.size()) {
+                matches = false;
+                return false;
+            }
+            for (size_t i=0; i<label.size(); i++) {
+                if (toLower(label[i]) != toLower(dotted[i])) {
+                    matches = false;
+                    return false;
+                }
+            }
+            dotted.remove_prefix(label.size());
+            if (!dotted.empty()) {
+                if (dotted.front() != '.') {
+                    matches = false;
+                    return false;
+                }
+                dotted.remove_prefix(1);
+            }
+            return true;
+        });
+        return valid && matches && dotted.empty();
+    }
+
+    bool equals(const Name &other) const
+    {
+        char buffer[MaxNameLength + 1];
+        const size_t length = other.toString(buffer, sizeof buffer);
+        return length > 0 && equals(std::string_view(buffer, length));
+    }
+
+    // Writes it dotted with a trailing dot, returns the length or 0 on failure
+    size_t toString(char *buffer, size_t size) const
+    {
+        size_t length = 0;
+        bool fits = true;
+        const bool valid = forEachLabel([&](std::string_view label) {
+            if (length + label.size() + 1 >= size) {
+                fits = false;
+                return false;
+            }
+            memcpy(buffer + length, label.data(), label.size());
+            length += label.size();
+            buffer[length++] = '.';
+            return true;
+        });
+        if (!valid || !fits || length == 0) {
+            return 0;
+        }
+        buffer[length] = '\0';
+        return length;
+    }
+
+    std::string toString() const
+    {
+        char buffer[MaxNameLength + 1];
+        return std::string(buffer, toString(buffer, sizeof buffer));
+    }
+
+    // The first label, e. g. the instance name of a service
+    std::string_view firstLabel() const
+    {
+        std::string_view ret;
+        forEachLabel([&](std::string_view label) {
+            ret = label;
+            return false;
+        });
+        return ret;
+    }
+};
+
+struct Record
+{
+    Name name;
+    uint16_t type = 0;
+    uint16_t rrclass = 0;
+    uint32_t ttl = 0;
+    const uint8_t *packet = nullptr;
+    size_t packetSize = 0;
+    size_t rdataOffset = 0;
+    uint16_t rdataLength = 0;
+
+    std::string_view rdata() const
+    {
+        return std::string_view(reinterpret_cast<const char*>(packet + rdataOffset), rdataLength);
+    }
+
+    bool ptr(Name *target) const
+    {
+        if (type != PTR) {
+            return false;
+        }
+        *target = Name{packet, packetSize, rdataOffset};
+        return target->isValid();
+    }
+
+    bool cname(Name *target) const
+    {
+        if (type != CNAME) {
+            return false;
+        }
+        *target = Name{packet, packetSize, rdataOffset};
+        return target->isValid();
+    }
+
+    bool srv(uint16_t *priority, uint16_t *weight, uint16_t *port, Name *target) const
+    {
+        if (type != SRV || rdataLength < 7) {
+            return false;
+        }
+        const uint8_t *data = packet + rdataOffset;
+        *priority = read16(data);
+        *weight = read16(data + 2);
+        *port = read16(data + 4);
+        *target = Name{packet, packetSize, rdataOffset + 6};
+        return target->isValid();
+    }
+
+    bool a(in_addr *address) const
+    {
+        if (type != A || rdataLength != sizeof(in_addr)) {
+            return false;
+        }
+        memcpy(address, packet + rdataOffset, sizeof(in_addr));
+        return true;
+    }
+
+    bool aaaa(in6_addr *address) const
+    {
+        if (type != AAAA || rdataLength != sizeof(in6_addr)) {
+            return false;
+        }
+        memcpy(address, packet + rdataOffset, sizeof(in6_addr));
+        return true;
+    }
+
+    // Looks up key=value in a TXT record, returns false if the key isn't there
+    bool txt(std::string_view key, std::string_view *value) const
+    {
+        if (type != TXT) {
+            return false;
+        }
+        const std::string_view data = rdata();
+        size_t pos = 0;
+        while (pos < data.size()) {
+            const size_t length = uint8_t(data[pos]);
+            pos++;
+            if (pos + length > data.size()) {
+                return false;
+            }
+            const std::string_view entry = data.substr(pos, length);
+            pos += length;
+
+            if (entry.size() < key.size() || (entry.size() > key.size() && entry[key.size()] != '=')) {
+                continue;
+            }
+            bool matches = true;
+            for (size_t i=0; i<key.size(); i++) {
+                if (toLower(entry[i]) != toLower(key[i])) {
+                    matches = false;
+                    break;
+                }
+            }
+            if (!matches) {
+                continue;
+            }
+            *value = entry.size() > key.size() ? entry.substr(key.size() + 1) : std::string_view();
+            return true;
+        }
+        return false;
+    }
+};
+
+struct Header
+{
+    uint16_t id = 0;
+    uint16_t flags = 0;
+    uint16_t questions = 0;
+    uint16_t answers = 0;
+    uint16_t authorities = 0;
+    uint16_t additionals = 0;
+
+    bool isResponse() const { return flags & 0x8000; }
+    uint8_t responseCode() const { return flags & 0xf; }
+};
+
+class Parser
+{
+public:
+    enum Section {
+        Questions,
+        Answers,
+        Authorities,
+        Additionals,
+        End
+    };
+
+    Parser(const uint8_t *data, size_t size) :
+        m_data(data),
+        m_size(size)
+    {
+        if (size < HeaderSize) {
+            m_error = true;
+            return;
+        }
+        header.id = read16(data);
+        header.flags = read16(data + 2);
+        header.questions = read16(data + 4);
+        header.answers = read16(data + 6);
+        header.authorities = read16(data + 8);
+        header.additionals = read16(data + 10);
+        m_pos = HeaderSize;
+        m_remaining = header.questions;
+        advanceSection();
+    }
+
+    bool isValid() const { return !m_error; }
+    Section section() const { return m_section; }
+
+    bool nextQuestion(Name *name, uint16_t *type, uint16_t *qclass)
+    {
+        if (m_error || m_section != Questions) {
+            return false;
+        }
+        const size_t end = skipName(m_pos);
+        if (!end || end + 4 > m_size) {
+            m_error = true;
+            return false;
+        }
+        *name = Name{m_data, m_size, m_pos};
+        *type = read16(m_data + end);
+        *qclass = read16(m_data + end + 2);
+        m_pos = end + 4;
+        m_remaining--;
+        advanceSection();
+        return true;
+    }
+
+    // Skips any questions left, and then walks all the resource records
+    bool nextRecord(Record *record)
+    {
+        Name name;
+        uint16_t type, qclass;
+        while (m_section == Questions) {
+            if (!nextQuestion(&name, &type, &qclass)) {
+                return false;
+            }
+        }
+        if (m_error || m_section == End) {
+            return false;
+        }
+        const size_t end = skipName(m_pos);
+        if (!end || end + 10 > m_size) {
+            m_error = true;
+            return false;
+        }
+        record->name = Name{m_data, m_size, m_pos};
+        record->type = read16(m_data + end);
+        record->rrclass = read16(m_data + end + 2);
+        record->ttl = read32(m_data + end + 4);
+        record->rdataLength = read16(m_data + end + 8);
+        record->rdataOffset = end + 10;
+        record->packet = m_data;
+        record->packetSize = m_size;
+        if (record->rdataOffset + record->rdataLength > m_size) {
+            m_error = true;
+            return false;
+        }
+        m_pos = record->rdataOffset + record->rdataLength;
+        m_remaining--;
+        m_recordSection = m_section;
+        advanceSection();
+        return true;
+    }
+
+    // Which section the last record returned from nextRecord() was in
+    Section recordSection() const { return m_recordSection; }
+
+    Header header;
+
+private:
+    // Returns the position right after the name, or 0 if it's malformed
+    size_t skipName(size_t pos) const
+    {
+        while (pos < m_size) {
+            const uint8_t length = m_data[pos];
+            if (length == 0) {
+                return pos + 1;
+            }
+            if ((length & 0xc0) == 0xc0) {
+                return pos + 2 <= m_size ? pos + 2 : 0;
+            }
+            if (length & 0xc0) {
+                return 0;
+            }
+            pos += 1 + length;
+        }
+        return 0;
+    }
+
+    void advanceSection()
+    {
+        while (m_remaining == 0 && m_section != End) {
+            m_section = Section(m_section + 1);
+            switch(m_section) {
+            case Answers: m_remaining = header.answers; break;
+            case Authorities: m_remaining = header.authorities; break;
+            case Additionals: m_remaining = header.additionals; break;
+            default: break;
+            }
+        }
+    }
+
+    const uint8_t *m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_pos = 0;
+    int m_remaining = 0;
+    Section m_section = Questions;
+    Section m_recordSection = Questions;
+    bool m_error = false;
+};
+
+} // namespace dns
@@ -6,27 +6,28 @@
 
 #define PROGRESS_WIDTH 40
 #define PING_INTERVAL 30
+#define MDNS_MAX_QUERY_INTERVAL 3600
+#define RECONNECT_DELAY 10
+#define CONNECT_TIMEOUT 10
+#define SKIP_MERGE_GAP 1.
+#define SKIP_SYNC_AHEAD 2
+#define CACHE_TTL (24 * 3600)
+#define SPONSOR_HASH_PREFIX 4 // the API recommends 4, longer is less private
+#define CACHE_NEGATIVE_TTL 3600 // new videos get segments soon after release
+#define SEGMENT_FETCH_CONCURRENCY 2
+#define SEGMENT_RETRY_DELAY 60 // after a failed fetch, so every status update doesn't try again
+#define HTTP_TIMEOUT 10
+#define DNS_NEGATIVE_TTL 30
+#define HTTP_IDLE_TIMEOUT 30 // servers tend to give up on idle connections after a minute or so
 
 static bool s_running = true;
 static bool s_verbose = false;
 static bool s_adblock = false;
-static bool s_youtube = false;
 
 struct Segment {
     double begin = 0.;
     double end = 0.;
 };
 
-static std::vector<Segment> currentSegments;
-static double nextSegmentStart = -1.;
-
-static std::string currentVideo;
-static double s_currentPosition = -1.;
-static double currentDuration = -1.;
-static double s_lastPositionFetched = -1;
-static bool currentlyPlaying = false;
-static time_t s_lastSeek = 0;
-static time_t s_lastPing = 0;
-static std::string s_currentStatus;
-
 static std::set<std::string> s_categories;
+static std::set<std::string> s_devices; // only attach to these, if set
@@ -0,0 +1,848 @@
+#pragma once
+
+#include "globals.h"
+#include "connection.h"
+#include "inflate.h"
+#include "reactor.h"
+#include "resolver.h"
+#include "ssl.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <sys/socket.h>
+}
+
+namespace http
+{
+
+using DataCallback = std::function<bool(const char *data, size_t size)>;
+
+// Content-Encoding: gzip, decompressed a buffer at a time as it arrives
+class Inflater
+{
+public:
+    Inflater() = default;
+    Inflater(const Inflater&) = delete;
+    Inflater &operator=(const Inflater&) = delete;
+
+    ~Inflater()
+    {
+        if (m_stream) {
+            zlib::inflateEnd(m_stream);
+        }
+    }
+
+    // Reuses the zlib state if we've been used before
+    bool start()
+    {
+        m_done = false;
+        if (m_stream) {
+            return zlib::inflateReset(m_stream);
+        }
+        m_stream = zlib::inflateStart();
+        return m_stream != nullptr;
+    }
+
+    bool feed(const char *data, size_t size, const DataCallback &onData)
+    {
+        size_t produced = 0;
+        // It might have more for us even if it's eaten everything
+        while ((size > 0 || produced == sizeof m_buffer) && !m_done) {
+            size_t consumed = 0;
+            const zlib::Result result = zlib::inflate(m_stream, data, size, &consumed, m_buffer, sizeof m_buffer, &produced);
+            if (result == zlib::Error) {
+                return false;
+            }
+            data += consumed;
+            size -= consumed;
+            if (produced && !onData(m_buffer, produced)) {
+                return false;
+            }
+            m_done = result == zlib::StreamEnd;
+            if (!consumed && !produced) {
+                break;
+            }
+        }
+        return true;
+    }
+
+    bool isDone() const { return m_done; }
+
+private:
+    zlib::Stream *m_stream = nullptr;
+    bool m_done = false;
+    char m_buffer[16384];
+};
+
+// Decodes a response as it arrives: the status line, the headers we care
+// about, and then the body, either Content-Length long, chunked, or until
+// the connection closes, and gzipped or not. reset() it for the next one on
+// the same connection.
+class ResponseDecoder
+{
+public:
+    // Stops at the end of the response, consumed is set to how much of the
+    // data belonged to it. Returns false if the response is broken, or onData
+    // returned false.
+    bool feed(const char *data, size_t size, const DataCallback &onData, size_t *consumed)
+    {
+        const size_t total = size;
+        *consumed = 0;
+        while (size > 0 && m_state != Done) {
+            size_t used = 0;
+            switch(m_state) {
+            case Head: {
+                const size_t before = m_head.size();
+                m_head.append(data, size);
+                const size_t end = m_head.find("\r\n\r\n", before >= 3 ? before - 3 : 0);
+                if (end == std::string::npos) {
+                    if (m_head.size() > MaxHeadSize) {
+                        puts("HTTP header too big");
+                        return false;
+                    }
+                    *consumed = total;
+                    return true;
+                }
+                used = end + 4 - before;
+                m_head.resize(end + 2);
+                if (!parseHead()) {
+                    return false;
+                }
+                break;
+            }
+            case Body:
+                used = m_hasLength ? size_t(std::min<uint64_t>(size, m_remaining)) : size;
+                if (used && !deliver(data, used, onData)) {
+                    return false;
+                }
+                if (m_hasLength) {
+                    m_remaining -= used;
+                    if (m_remaining == 0 && !complete()) {
+                        return false;
+                    }
+                }
+                break;
+            case ChunkData:
+                used = size_t(std::min<uint64_t>(size, m_remaining));
+                if (!deliver(data, used, onData)) {
+                    return false;
+                }
+                m_remaining -= used;
+                if (m_remaining == 0) {
+                    m_state = ChunkEnd;
+                }
+                break;
+            case ChunkSize:
+            case ChunkEnd:
+            case Trailers: {
+                const char *newline = static_cast<const char*>(memchr(data, '\n', size));
+                used = newline ? size_t(newline - data + 1) : size;
+                if (m_line.size() + used > MaxLineSize) {
+                    puts("HTTP chunk header too long");
+                    return false;
+                }
+                m_line.append(data, used);
+                if (newline && !parseLine()) {
+                    return false;
+                }
+                break;
+            }
+            case Done:
+                break;
+            }
+            data += used;
+            size -= used;
+        }
+        *consumed = total - size;
+        return true;
+    }
+
+    // The connection closed, returns false if the response is incomplete
+    bool finish()
+    {
+        if (m_state == Body && !m_hasLength) {
+            return complete();
+        }
+        return m_state == Done;
+    }
+
+    bool isDone() const { return m_state == Done; }
+
+    // If we've gotten any of it yet
+    bool isStarted() const { return m_state != Head || !m_head.empty(); }
+
+    void reset()
+    {
+        std::unique_ptr<Inflater> inflater = std::move(m_inflater);
+        *this = ResponseDecoder();
+        m_inflater = std::move(inflater);
+    }
+
+    int status = -1;
+    bool keepAlive = false; // if the server is fine with another request after this
+
+private:
+    static constexpr size_t MaxHeadSize = 64 * 1024;
+    static constexpr size_t MaxLineSize = 1024;
+
+    enum State {
+        Head,
+        Body,
+        ChunkSize,
+        ChunkData,
+        ChunkEnd,
+        Trailers,
+        Done
+    };
+
+    static bool startsWithNoCase(const std::string &string, size_t pos, const char *prefix)
+    {
+        const size_t length = strlen(prefix);
+        return string.size() >= pos + length && strncasecmp(string.c_str() + pos, prefix, length) == 0;
+    }
+
+    bool parseHead()
+    {
+        if (sscanf(m_head.c_str(), "HTTP/%*d.%*d %d", &status) != 1) {
+            puts("Invalid HTTP response");
+            return false;
+        }
+        // Just informational, the real one comes after
+        if (status >= 100 && status < 200) {
+            m_head.clear();
+            status = -1;
+            return true;
+        }
+
+        int minorVersion = 0;
+        sscanf(m_head.c_str(), "HTTP/%*d.%d", &minorVersion);
+        keepAlive = minorVersion >= 1;
+
+        bool chunked = false;
+        size_t pos = m_head.find("\r\n") + 2;
+        while (pos < m_head.size()) {
+            const size_t end = m_head.find("\r\n", pos);
+            if (startsWithNoCase(m_head, pos, "content-length:")) {
+                m_hasLength = true;
+                m_remaining = strtoull(m_head.c_str() + pos + strlen("content-length:"), nullptr, 10);
+            } else if (startsWithNoCase(m_head, pos, "transfer-encoding:")) {
+                const std::string value = m_head.substr(pos, end - pos);
+                chunked = strcasestr(value.c_str(), "chunked") != nullptr;
+            } else if (startsWithNoCase(m_head, pos, "content-encoding:")) {
+                const std::string value = m_head.substr(pos, end - pos);
+                m_gzip = strcasestr(value.c_str(), "gzip") != nullptr;
+                if (!m_gzip && !strcasestr(value.c_str(), "identity")) {
+                    printf("Unsupported %s\n", value.c_str());
+                    return false;
+                }
+            } else if (startsWithNoCase(m_head, pos, "connection:")) {
+                const std::string value = m_head.substr(pos, end - pos);
+                if (strcasestr(value.c_str(), "close")) {
+                    keepAlive = false;
+                } else if (strcasestr(value.c_str(), "keep-alive")) {
+                    keepAlive = true;
+                }
+            }
+            pos = end + 2;
+        }
+
+        if (m_gzip) {
+            if (!m_inflater) {
+                m_inflater = std::make_unique<Inflater>();
+            }
+            if (!m_inflater->start()) {
+                puts("Got a gzipped response, but can't decompress it");
+                return false;
+            }
+        }
+
+        if (status == 204 || status == 304) {
+            m_state = Done;
+        } else if (chunked) {
+            m_hasLength = false;
+            m_state = ChunkSize;
+        } else if (m_hasLength && m_remaining == 0) {
+            m_state = Done;
+        } else {
+            // Only the connection closing tells us it's done
+            keepAlive = keepAlive && m_hasLength;
+            m_state = Body;
+        }
+        return true;
+    }
+
+    bool parseLine()
+    {
+        while (!m_line.empty() && (m_line.back() == '\n' || m_line.back() == '\r')) {
+            m_line.pop_back();
+        }
+        switch(m_state) {
+        case ChunkSize: {
+            char *end = nullptr;
+            m_remaining = strtoull(m_line.c_str(), &end, 16);
+            if (end == m_line.c_str() || (*end != '\0' && *end != ';' && *end != ' ')) {
+                puts("Invalid HTTP chunk size");
+                return false;
+            }
+            m_state = m_remaining ? ChunkData : Trailers;
+            break;
+        }
+        case ChunkEnd:
+            if (!m_line.empty()) {
+                puts("Invalid end of HTTP chunk");
+                return false;
+            }
+            m_state = ChunkSize;
+            break;
+        case Trailers:
+            if (m_line.empty() && !complete()) {
+                return false;
+            }
+            break;
+        default:
+            break;
+        }
+        m_line.clear();
+        return true;
+    }
+
+    bool deliver(const char *data, size_t size, const DataCallback &onData)
+    {
+        if (!m_gzip) {
+            return onData(data, size);
+        }
+        return m_inflater->feed(data, size, onData);
+    }
+
+    // The body is over, make sure we got all of it
+    bool complete()
+    {
+        if (m_gzip && !m_inflater->isDone()) {
+            puts("Compressed response is cut off");
+            return false;
+        }
+        m_state = Done;
+        return true;
+    }
+
+    State m_state = Head;
+    std::string m_head;
+    std::string m_line;
+    bool m_hasLength = false;
+    uint64_t m_remaining = 0;
+
+    bool m_gzip = false;
+    std::unique_ptr<Inflater> m_inflater; // kept across responses, it's a big allocation
+};
+
+// HTTP(S) GETs driven by the reactor, so a slow server never blocks the
+// cast connections. Everything is non-blocking, Connection does the connect
+// (racing IPv4 and IPv6), the TLS handshake and queueing up what we send,
+// and every request has a deadline.
+//
+// Connections are kept open and reused, so a request to a host we've
+// talked to recently is just one round trip. A few requests can be sent on
+// the same connection before the first response has arrived (pipelining),
+// and if the server closes it under us the ones it didn't answer are sent
+// again on a new one.
+class Client
+{
+public:
+    using DoneCallback = std::function<void(int status)>;
+
+    Client(reactor::Reactor *reactor, dns::Resolver *resolver) :
+        m_reactor(reactor),
+        m_resolver(resolver)
+    {
+    }
+
+    ~Client()
+    {
+        for (std::pair<const uint64_t, std::unique_ptr<Socket>> &socket : m_sockets) {
+            cleanup(socket.second.get());
+        }
+        for (std::pair<const uint64_t, std::unique_ptr<Request>> &request : m_requests) {
+            m_reactor->unwatch(request.second->deadline.fd);
+        }
+    }
+
+    Client(const Client&) = delete;
+    Client &operator=(const Client&) = delete;
+
+    // onData gets the body as it arrives, onDone the HTTP status or -1 if it
+    // failed or timed out. Returns an ID for cancel(), neither callback is
+    // called after that.
+    uint64_t get(const std::string &host, const int port, const std::string &path, DataCallback onData, DoneCallback onDone,
+            const std::chrono::seconds timeout = std::chrono::seconds(HTTP_TIMEOUT))
+    {
+        const uint64_t id = m_nextId++;
+        std::unique_ptr<Request> request = std::make_unique<Request>();
+        request->host = host;
+        request->port = port;
+        request->description = host + ":" + std::to_string(port) + path;
+        request->request =
+            "GET " + path + " HTTP/1.1\r\n" +
+            "Host: " + host + "\r\n"
+            "User-Agent: fuckifiknow/1.0\r\n"
+            "Accept: */*\r\n" +
+            (zlib::isLoaded() ? "Accept-Encoding: gzip\r\n" : "") +
+            "\r\n";
+        request->onData = std::move(onData);
+        request->onDone = std::move(onDone);
+
+        if (s_verbose) {
+            printf("Downloading: %s\n", request->description.c_str());
+        }
+
+        m_reactor->watchTimer(&request->deadline, [this, id]() {
+            fail(id, "timed out");
+        });
+        request->deadline.start(timeout);
+
+        const std::string key = poolKey(host, port);
+        m_requests[id] = std::move(request);
+        m_waiting[key].push_back(id);
+        dispatch(key);
+        return id;
+    }
+
+    void cancel(const uint64_t id)
+    {
+        std::map<uint64_t, std::unique_ptr<Request>>::iterator it = m_requests.find(id);
+        if (it == m_requests.end()) {
+            return;
+        }
+        if (s_verbose) {
+            printf("Cancelled request to %s\n", it->second->description.c_str());
+        }
+        // If it's already been sent the response is just thrown away when it arrives
+        std::deque<uint64_t> &waiting = m_waiting[poolKey(it->second->host, it->second->port)];
+        waiting.erase(std::remove(waiting.begin(), waiting.end(), id), waiting.end());
+        m_reactor->unwatch(it->second->deadline.fd);
+        m_requests.erase(it);
+    }
+
+    // Connects ahead of time if we don't have a connection already, so the
+    // first request doesn't have to wait for the handshakes
+    void warm(const std::string &host, const int port)
+    {
+        const std::string key = poolKey(host, port);
+        for (const std::pair<const uint64_t, std::unique_ptr<Socket>> &socket : m_sockets) {
+            if (socket.second->key == key && !socket.second->closing) {
+                return;
+            }
+        }
+        if (s_verbose) {
+            printf("Connecting to %s ahead of time\n", key.c_str());
+        }
+        open(host, port);
+    }
+
+private:
+    // Per host, before we open another connection or pipeline
+    static constexpr size_t MaxConnections = 2;
+    static constexpr size_t MaxPipelined = 4;
+
+    struct Request {
+        std::string host;
+        int port = 0;
+        std::string description;
+        std::string request;
+        int attempts = 0;
+
+        DataCallback onData;
+        DoneCallback onDone;
+        reactor::Timer deadline;
+    };
+
+    struct Socket {
+        uint64_t id = 0;
+        std::string host;
+        std::string key;
+        bool closing = false; // no more requests on this one
+
+        bool resolving = false;
+        uint64_t resolveId = 0;
+        Connection connection;
+
+        // Sent, in the order the responses come back. Until we're connected
+        // they're only queued up here.
+        std::deque<uint64_t> pipeline;
+        ResponseDecoder decoder;
+
+        reactor::Timer idleTimer; // also used to close it from outside of event handlers
+    };
+
+    static std::string poolKey(const std::string &host, const int port)
+    {
+        return host + ":" + std::to_string(port);
+    }
+
+    Request *findRequest(const uint64_t id)
+    {
+        std::map<uint64_t, std::unique_ptr<Request>>::iterator it = m_requests.find(id);
+        return it == m_requests.end() ? nullptr : it->second.get();
+    }
+
+    Socket *findSocket(const uint64_t id)
+    {
+        std::map<uint64_t, std::unique_ptr<Socket>>::iterator it = m_sockets.find(id);
+        return it == m_sockets.end() ? nullptr : it->second.get();
+    }
+
+    // Hands out the waiting requests for a host: to an idle connection if
+    // there is one, otherwise a new one if we're allowed, otherwise
+    // pipelined behind the others on the least busy one
+    void dispatch(const std::string &key)
+    {
+        std::deque<uint64_t> &waiting = m_waiting[key];
+        while (!waiting.empty()) {
+            Request *request = findRequest(waiting.front());
+            if (!request) {
+                waiting.pop_front();
+                continue;
+            }
+            Socket *best = nullptr;
+            size_t connections = 0;
+            for (const std::pair<const uint64_t, std::unique_ptr<Socket>> &entry : m_sockets) {
+                Socket *socket = entry.second.get();
+                if (socket->key != key || socket->closing) {
+                    continue;
+                }
+                connections++;
+                if (!best || socket->pipeline.size() < best->pipeline.size()) {
+                    best = socket;
+                }
+            }
+            if ((!best || !best->pipeline.empty()) && connections < MaxConnections) {
+                best = open(request->host, request->port);
+            } else if (best && best->pipeline.size() >= MaxPipelined) {
+                return; // full, wait for a response
+            }
+            if (!best) {
+                return;
+            }
+
+            const uint64_t id = waiting.front();
+            waiting.pop_front();
+            request->attempts++;
+            const bool connected = best->connection.state == Connection::Connected;
+            if (s_verbose && connected) {
+                printf("Reusing connection to %s\n", key.c_str());
+            }
+            best->idleTimer.stop();
+            best->pipeline.push_back(id);
+            if (connected) {
+                send(best, request->request);
+            }
+        }
+    }
+
+    Socket *open(const std::string &host, const int port)
+    {
+        const uint64_t id = m_nextId++;
+        std::unique_ptr<Socket> owned = std::make_unique<Socket>();
+        Socket *socket = owned.get();
+        socket->id = id;
+        socket->host = host;
+        socket->key = poolKey(host, port);
+        m_sockets[id] = std::move(owned);
+
+        m_reactor->watchTimer(&socket->idleTimer, [this, id]() {
+            closeSocket(id, nullptr);
+        });
+
+        // If the resolver already knows the answer onResolved() is called right away
+        socket->resolving = true;
+        const uint64_t resolveId = m_resolver->resolve(host, [this, id, port](const std::vector<sockaddr_storage> &addresses) {
+            onResolved(id, port, addresses);
+        });
+        if (socket->resolving) {
+            socket->resolveId = resolveId;
+        }
+        return socket;
+    }
+
+    void onResolved(const uint64_t id, const int port, const std::vector<sockaddr_storage> &addresses)
+    {
+        Socket *socket = findSocket(id);
+        if (!socket) {
+            return;
+        }
+        socket->resolving = false;
+
+        // One of each family is enough to race, the resolver puts IPv6 first
+        std::vector<Endpoint> endpoints;
+        bool hasIpv4 = false, hasIpv6 = false;
+        for (const sockaddr_storage &address : addresses) {
+            bool &seen = address.ss_family == AF_INET6 ? hasIpv6 : hasIpv4;
+            if (seen) {
+                continue;
+            }
+            seen = true;
+            Endpoint endpoint;
+            endpoint.address = address;
+            if (address.ss_family == AF_INET6) {
+                reinterpret_cast<sockaddr_in6*>(&endpoint.address)->sin6_port = htons(uint16_t(port));
+            } else {
+                reinterpret_cast<sockaddr_in*>(&endpoint.address)->sin_port = htons(uint16_t(port));
+            }
+            endpoints.push_back(endpoint);
+        }
+        const bool connecting = socket->connection.connect(m_reactor, endpoints, [this, id](const bool connected) {
+            onConnected(id, connected);
+        });
+        if (!connecting) {
+            if (addresses.empty()) {
+                fprintf(stderr, "Failed to resolve %s\n", socket->host.c_str());
+            }
+            // We might be in get(), which shouldn't call onDone before returning
+            socket->closing = true;
+            socket->idleTimer.start(std::chrono::seconds(0));
+        }
+    }
+
+    void onConnected(const uint64_t id, const bool connected)
+    {
+        Socket *socket = findSocket(id);
+        if (!socket) {
+            return;
+        }
+        if (!connected) {
+            closeSocket(id, "failed to connect");
+            return;
+        }
+        m_reactor->watch(socket->connection.fd, reactor::Readable, [this, id](const uint32_t events) {
+            onSocketEvent(id, events);
+        });
+
+        // Nothing has been sent yet, so the ones that were cancelled in the
+        // meantime can just be left out
+        std::deque<uint64_t> &pipeline = socket->pipeline;
+        pipeline.erase(std::remove_if(pipeline.begin(), pipeline.end(), [this](const uint64_t requestId) {
+            return !findRequest(requestId);
+        }), pipeline.end());
+        for (const uint64_t requestId : pipeline) {
+            if (!send(socket, findRequest(requestId)->request)) {
+                return;
+            }
+        }
+        if (pipeline.empty()) {
+            socket->idleTimer.start(std::chrono::seconds(HTTP_IDLE_TIMEOUT));
+        }
+    }
+
+    void onSocketEvent(const uint64_t id, const uint32_t events)
+    {
+        Socket *socket = findSocket(id);
+        if (!socket) {
+            return;
+        }
+        if (events & reactor::Writable) {
+            if (!socket->connection.flush()) {
+                closeSocket(id, "failed while sending");
+                return;
+            }
+            // If it was a read that wanted to write it's retried below
+            if (!socket->connection.hasQueued()) {
+                m_reactor->setEvents(socket->connection.fd, reactor::Readable);
+            }
+        }
+        receive(id);
+    }
+
+    // Whatever doesn't go out right away is sent by the connection when the
+    // socket is writable
+    bool send(Socket *socket, const std::string &request)
+    {
+        if (socket->connection.write(request.data(), request.size())) {
+            return true;
+        }
+        // We might be in the middle of a get(), so let the timer deal with it
+        fprintf(stderr, "Failed to send request to %s\n", socket->key.c_str());
+        socket->closing = true;
+        socket->idleTimer.start(std::chrono::seconds(0));
+        return false;
+    }
+
+    // Reads until it would block, and hands the responses to their requests
+    void receive(const uint64_t id)
+    {
+        while (Socket *socket = findSocket(id)) {
+            const int ret = ssl::SSL_read(socket->connection.handle, m_buffer, sizeof m_buffer);
+            if (ret <= 0) {
+                const int error = ssl::SSL_get_error(socket->connection.handle, ret);
+                if (error == ssl::SSL_ERROR_WANT_READ) {
+                    return;
+                }
+                if (error == ssl::SSL_ERROR_WANT_WRITE) {
+                    m_reactor->setEvents(socket->connection.fd, reactor::Readable | reactor::Writable);
+                    return;
+                }
+                // Closed, either because it was idle or because it's done with us
+                closeSocket(id, nullptr);
+                return;
+            }
+
+            size_t offset = 0;
+            while (offset < size_t(ret)) {
+                socket = findSocket(id);
+                if (!socket) {
+                    return;
+                }
+                if (socket->pipeline.empty()) {
+                    closeSocket(id, "sent something we didn't ask for");
+                    return;
+                }
+                const uint64_t requestId = socket->pipeline.front();
+                Request *request = findRequest(requestId);
+                // A copy, onData might cancel the request and take its callback with it
+                const DataCallback onData = request ? request->onData : DataCallback();
+                size_t consumed = 0;
+                const bool valid = socket->decoder.feed(m_buffer + offset, size_t(ret) - offset, [&](const char *data, size_t size) {
+                    return !onData || onData(data, size);
+                }, &consumed);
+                offset += consumed;
+                if (!valid) {
+                    // The rest of the stream is garbage to us now
+                    socket->pipeline.pop_front();
+                    socket->decoder.reset();
+                    closeSocket(id, "sent an invalid response");
+                    fail(requestId, "got an invalid response");
+                    return;
+                }
+                socket = findSocket(id);
+                if (!socket || !socket->decoder.isDone()) {
+                    continue;
+                }
+
+                const int status = socket->decoder.status;
+                const bool keepAlive = socket->decoder.keepAlive;
+                socket->pipeline.pop_front();
+                socket->decoder.reset();
+                if (!keepAlive) {
+                    // Anything still in the pipeline is sent again on a new one
+                    closeSocket(id, nullptr);
+                } else if (socket->pipeline.empty()) {
+                    socket->idleTimer.start(std::chrono::seconds(HTTP_IDLE_TIMEOUT));
+                }
+                finish(requestId, status);
+                if (!keepAlive) {
+                    return;
+                }
+            }
+        }
+    }
+
+    // Closes it, and deals with whatever it had in flight: a response that
+    // ends when the connection does is finished, the rest is retried if it's
+    // likely to work and failed otherwise
+    void closeSocket(const uint64_t id, const char *reason)
+    {
+        std::map<uint64_t, std::unique_ptr<Socket>>::iterator it = m_sockets.find(id);
+        if (it == m_sockets.end()) {
+            return;
+        }
+        std::unique_ptr<Socket> socket = std::move(it->second);
+        m_sockets.erase(it);
+        cleanup(socket.get());
+        if (reason) {
+            fprintf(stderr, "Connection to %s %s\n", socket->key.c_str(), reason);
+        } else if (s_verbose) {
+            printf("Closed connection to %s\n", socket->key.c_str());
+        }
+
+        std::vector<std::pair<uint64_t, int>> finished;
+        std::vector<uint64_t> retries;
+        for (size_t i=0; i<socket->pipeline.size(); i++) {
+            const uint64_t requestId = socket->pipeline[i];
+            const Request *request = findRequest(requestId);
+            if (!request) {
+                continue;
+            }
+            if (i == 0 && socket->decoder.isStarted()) {
+                finished.emplace_back(requestId, socket->decoder.finish() ? socket->decoder.status : -1);
+            } else if (socket->connection.state == Connection::Connected && request->attempts < 2) {
+                retries.push_back(requestId);
+            } else {
+                finished.emplace_back(requestId, -1);
+            }
+        }
+        std::deque<uint64_t> &waiting = m_waiting[socket->key];
+        waiting.insert(waiting.begin(), retries.begin(), retries.end());
+
+        for (const std::pair<uint64_t, int> &result : finished) {
+            finish(result.first, result.second);
+        }
+        dispatch(socket->key);
+    }
+
+    void fail(const uint64_t id, const char *reason)
+    {
+        Request *request = findRequest(id);
+        if (!request) {
+            return;
+        }
+        fprintf(stderr, "Request to %s %s\n", request->description.c_str(), reason);
+        // If it's stuck on a connection, so is everything behind it
+        for (const std::pair<const uint64_t, std::unique_ptr<Socket>> &socket : m_sockets) {
+            const std::deque<uint64_t> &pipeline = socket.second->pipeline;
+            if (std::find(pipeline.begin(), pipeline.end(), id) != pipeline.end()) {
+                socket.second->closing = true;
+                socket.second->idleTimer.start(std::chrono::seconds(0));
+                break;
+            }
+        }
+        finish(id, -1);
+    }
+
+    void finish(const uint64_t id, const int status)
+    {
+        std::map<uint64_t, std::unique_ptr<Request>>::iterator it = m_requests.find(id);
+        if (it == m_requests.end()) {
+            return;
+        }
+        // Take it out first, the callback might start new requests
+        std::unique_ptr<Request> request = std::move(it->second);
+        m_requests.erase(it);
+        m_reactor->unwatch(request->deadline.fd);
+        if (request->onDone) {
+            request->onDone(status);
+        }
+    }
+
+    void cleanup(Socket *socket)
+    {
+        if (socket->resolving) {
+            m_resolver->cancel(socket->resolveId);
+            socket->resolving = false;
+        }
+        if (socket->connection.fd >= 0) {
+            m_reactor->unwatch(socket->connection.fd);
+        }
+        m_reactor->unwatch(socket->idleTimer.fd);
+    }
+
+    reactor::Reactor *m_reactor;
+    dns::Resolver *m_resolver;
+    std::map<uint64_t, std::unique_ptr<Request>> m_requests;
+    std::map<uint64_t, std::unique_ptr<Socket>> m_sockets;
+    std::map<std::string, std::deque<uint64_t>> m_waiting; // per host, not sent anywhere yet
+    uint64_t m_nextId = 1;
+
+    // Everything runs on the reactor thread, so one is enough
+    char m_buffer[16384];
+};
+
+} // namespace http
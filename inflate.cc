@@ -0,0 +1,148 @@
+#include "inflate.h"
+
+#include <dlfcn.h>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+extern "C" {
+// The public part of zlib's z_stream, it hasn't changed since 1.0
+struct z_stream {
+    const unsigned char *next_in;
+    unsigned avail_in;
+    unsigned long total_in;
+
+    unsigned char *next_out;
+    unsigned avail_out;
+    unsigned long total_out;
+
+    const char *msg;
+    void *state;
+
+    void *(*zalloc)(void *, unsigned, unsigned);
+    void (*zfree)(void *, void *);
+    void *opaque;
+
+    int data_type;
+    unsigned long adler;
+    unsigned long reserved;
+};
+
+static const char *(*EXT_zlibVersion)() = nullptr;
+static int (*EXT_inflateInit2_)(z_stream *, int, const char *, int) = nullptr;
+static int (*EXT_inflate)(z_stream *, int) = nullptr;
+static int (*EXT_inflateReset)(z_stream *) = nullptr;
+static int (*EXT_inflateEnd)(z_stream *) = nullptr;
+} // extern "C"
+
+static constexpr int Z_OK = 0;
+static constexpr int Z_STREAM_END = 1;
+static constexpr int Z_BUF_ERROR = -5;
+static constexpr int Z_NO_FLUSH = 0;
+
+// 15 is the biggest window, +32 detects gzip or zlib from the header
+static constexpr int WindowBits = 15 + 32;
+
+#define RESOLVE_SYMBOL(RET, NAME, ARGS...) if (!(EXT_##NAME = (RET(*)(ARGS))dlsym(libHandle, #NAME))) { fprintf(stderr, "Failed to resolve %s: %s\n", #NAME, dlerror()); }
+
+static bool resolveSymbols(void *libHandle)
+{
+    dlerror(); // clear existing errors
+
+    RESOLVE_SYMBOL(int, inflateInit2_, z_stream*, int, const char*, int);
+    RESOLVE_SYMBOL(int, inflate, z_stream*, int);
+    RESOLVE_SYMBOL(int, inflateReset, z_stream*);
+    RESOLVE_SYMBOL(int, inflateEnd, z_stream*);
+
+    EXT_zlibVersion = (const char *(*)()) dlsym(libHandle, "zlibVersion");
+
+    return EXT_zlibVersion &&
+        EXT_inflateInit2_ &&
+        EXT_inflate &&
+        EXT_inflateReset &&
+        EXT_inflateEnd
+        ;
+}
+
+namespace zlib {
+bool initialize()
+{
+    const char *manualPath = getenv("SPONSORYEET_ZLIB");
+    for (const char *file : { manualPath, "libz.so.1", "libz.so" }) {
+        if (!file) {
+            continue;
+        }
+        // It stays loaded, the function pointers are used until we exit
+        void *libHandle = dlopen(file, RTLD_LAZY);
+        if (!libHandle) {
+            continue;
+        }
+        if (resolveSymbols(libHandle)) {
+            return true;
+        }
+        fprintf(stderr, "Failed to load %s\n", file);
+        EXT_zlibVersion = nullptr;
+        EXT_inflateInit2_ = nullptr;
+        EXT_inflate = nullptr;
+        EXT_inflateReset = nullptr;
+        EXT_inflateEnd = nullptr;
+        dlclose(libHandle);
+    }
+    return false;
+}
+
+bool isLoaded()
+{
+    return EXT_inflateInit2_ != nullptr;
+}
+
+Stream *inflateStart()
+{
+    if (!isLoaded()) {
+        return nullptr;
+    }
+    z_stream *stream = new z_stream{};
+    if (EXT_inflateInit2_(stream, WindowBits, EXT_zlibVersion(), int(sizeof(z_stream))) != Z_OK) {
+        fprintf(stderr, "Failed to initialize zlib: %s\n", stream->msg ? stream->msg : "unknown error");
+        delete stream;
+        return nullptr;
+    }
+    return stream;
+}
+
+bool inflateReset(Stream *stream)
+{
+    return EXT_inflateReset(static_cast<z_stream*>(stream)) == Z_OK;
+}
+
+void inflateEnd(Stream *stream)
+{
+    EXT_inflateEnd(static_cast<z_stream*>(stream));
+    delete static_cast<z_stream*>(stream);
+}
+
+Result inflate(Stream *stream, const char *input, size_t inputSize, size_t *consumed, char *output, size_t outputSize, size_t *produced)
+{
+    z_stream *z = static_cast<z_stream*>(stream);
+    z->next_in = reinterpret_cast<const unsigned char*>(input);
+    z->avail_in = unsigned(std::min<size_t>(inputSize, UINT_MAX));
+    z->next_out = reinterpret_cast<unsigned char*>(output);
+    z->avail_out = unsigned(std::min<size_t>(outputSize, UINT_MAX));
+
+    const int ret = EXT_inflate(z, Z_NO_FLUSH);
+    *consumed = size_t(reinterpret_cast<const char*>(z->next_in) - input);
+    *produced = size_t(reinterpret_cast<char*>(z->next_out) - output);
+
+    switch(ret) {
+    case Z_OK:
+    case Z_BUF_ERROR: // just means there was nothing to do
+        return Ok;
+    case Z_STREAM_END:
+        return StreamEnd;
+    default:
+        fprintf(stderr, "Failed to decompress: %s\n", z->msg ? z->msg : "unknown error");
+        return Error;
+    }
+}
+} // namespace zlib
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+
+// zlib's inflate, loaded at runtime like libssl so we don't need the
+// headers or to link against it. If it isn't there we just don't ask
+// servers to compress anything.
+namespace zlib
+{
+    using Stream = void;
+
+    enum Result {
+        Error = -1,
+        Ok = 0,
+        StreamEnd = 1
+    };
+
+    bool initialize();
+    bool isLoaded();
+
+    // Takes both gzip and zlib headers, returns nullptr on failure
+    Stream *inflateStart();
+    bool inflateReset(Stream *stream);
+    void inflateEnd(Stream *stream);
+
+    // Decompresses as much as fits in the output, consumed and produced are
+    // set to how much of the input and output was used
+    Result inflate(Stream *stream, const char *input, size_t inputSize, size_t *consumed, char *output, size_t outputSize, size_t *produced);
+}
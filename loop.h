@@ -4,99 +4,96 @@
 #include "globals.h"
 #include "chromecast.h"
 #include "castchannel.h"
-
-static double currentPosition()
+#include "session.h"
+#include "mdns.h"
+#include "reactor.h"
+#include "castjson.h"
+#include "simd.h"
+#include "segmentcache.h"
+
+#include <map>
+#include <memory>
+#include <cctype>
+
+static double currentPosition(const Session &session)
 {
-    if (!currentlyPlaying) {
-        return s_currentPosition;
-    }
+    return session.clock.position();
+}
 
-    if (s_currentPosition < 0) {
+static double currentSegmentEnd(const Session &session)
+{
+    const Segment *segment = session.segments.containing(currentPosition(session));
+    if (!segment) {
         return -1;
     }
-    double timeDelta = time(nullptr) - s_lastPositionFetched;
-    return std::round(timeDelta + s_currentPosition);
+    return segment->end;
 }
 
-static double secondsUntilNextSegment()
+static void maybeSeek(Session *session)
 {
-    const double current = currentPosition();
-    if (current < 0) {
-        puts("no current position");
-        return -1;
+    if (session->currentVideo.empty()) {
+        return;
     }
-    if (currentSegments.empty()) {
-        return -1;
+    if (session->segments.empty()) {
+        return;
     }
 
-    double lowestBegin = std::numeric_limits<double>::max();
-    bool found = false;
-    for (const Segment &segment : currentSegments) {
-        if (segment.end < current) {
-            continue;
-        }
-        if (!found || segment.begin < lowestBegin) {
-            lowestBegin = segment.begin;
-            found = true;
-        }
+    const double segmentEnd = currentSegmentEnd(*session);
+    if (segmentEnd < 0) {
+        return;
     }
-    if (!found) {
-        return -1;
+    if (s_verbose) {
+        printf("Current segment ends at: %f, position at %f\n", segmentEnd, currentPosition(*session));
     }
-    return lowestBegin - current;
-}
 
-static double currentSegmentEnd()
-{
-    const int current = std::ceil(currentPosition());
-    if (current < 0) {
-        return -1;
+    if (!session->playing) {
+        return;
     }
-    if (currentSegments.empty()) {
-        return -1;
+    const PlaybackClock::Clock::time_point now = PlaybackClock::Clock::now();
+    if (now - session->lastSeek < std::chrono::seconds(1)) {
+        return;
     }
+    session->lastSeek = now;
 
-    for (const Segment &segment : currentSegments) {
-        if (int(segment.end) <= current) {
-            continue;
-        }
-        if (segment.begin < current) {
-            return segment.end;
-        }
-    }
-    return -1;
+    printf("Skipping sponsor on %s...\n", session->name.c_str());
+    session->clock.reset();
+    session->segmentTimer.stop();
+    cc::seek(*session, segmentEnd);
 }
 
-static void maybeSeek(Connection *connection)
+// Arms the segment timer for exactly when the next segment starts. If
+// that's a while away we first wake up a bit before to ask for the status,
+// so any drift is corrected before we actually skip.
+static void scheduleSkip(Session *session)
 {
-    if (currentVideo.empty()) {
+    const double position = currentPosition(*session);
+    const Segment *segment = session->segments.next(position);
+    if (!segment || !session->playing || segment->begin <= position) {
+        session->segmentTimer.stop();
         return;
     }
-    if (currentSegments.empty()) {
-        return;
-    }
-
-    const double segmentEnd = currentSegmentEnd();
-    if (segmentEnd < 0) {
+    PlaybackClock::Clock::time_point deadline = session->clock.when(segment->begin);
+    if (deadline == PlaybackClock::Clock::time_point::max()) {
+        session->segmentTimer.stop();
         return;
     }
     if (s_verbose) {
-        printf("Current segment ends at: %f, position at %f\n", segmentEnd, currentPosition());
+        std::cout << "time to next segment: " << segment->begin - position << std::endl;
     }
-
-    if (!currentlyPlaying) {
-        return;
-    }
-    if (time(nullptr) - s_lastSeek < 1) {
-        return;
+    if (deadline - PlaybackClock::Clock::now() > std::chrono::seconds(2 * SKIP_SYNC_AHEAD)) {
+        deadline -= std::chrono::seconds(SKIP_SYNC_AHEAD);
     }
-    s_lastSeek = time(nullptr);
+    session->segmentTimer.startAt(deadline);
+}
 
-    puts("Skipping sponsor...");
-    s_currentPosition = -1.;
-    nextSegmentStart = -1.;
-    s_lastPositionFetched = -1;
-    cc::seek(*connection, segmentEnd);
+static void onSegmentTimer(Session *session)
+{
+    // Either it's time, or it's time to make sure we're in sync
+    if (session->segments.containing(currentPosition(*session))) {
+        maybeSeek(session);
+    } else {
+        cc::sendSimple(*session, cc::msg::GetStatus, cc::ns::Media);
+    }
 }
 
 static void printTimestamp(int timestamp)
@@ -109,12 +106,16 @@ static void printTimestamp(int timestamp)
     printf("%.2d:%.2d:%.2d", hours, minutes, seconds);
 }
 
-static void printProgress(double position, double length)
+static void printProgress(const Session &session)
 {
-    if (position < 0 || length < 0 || s_lastPositionFetched < 0) {
-        printf("%s", s_currentStatus.c_str());
-        fflush(stdout);
-        printf("\033[2K\r");
+    if (session.connection.state != Connection::Connected) {
+        printf("%s: %s", session.name.c_str(), session.connection.state == Connection::Handshaking ? "Handshaking..." : "Connecting...");
+        return;
+    }
+    const double position = currentPosition(session);
+    const double length = session.duration;
+    if (position < 0 || length < 0) {
+        printf("%s: %s", session.name.c_str(), session.status.c_str());
         return;
     }
     printf("\r[");
@@ -125,7 +126,7 @@ static void printProgress(double position, double length)
     for (int i=0; i<playedLength; i++) {
         printf("=");
     }
-    if (currentlyPlaying) {
+    if (session.playing) {
         printf(">");
     } else {
         printf("|");
@@ -138,8 +139,9 @@ static void printProgress(double position, double length)
     printTimestamp(position);
     printf("/");
     printTimestamp(length);
+    printf(" %s", session.name.c_str());
 
-    for (const Segment &segment : currentSegments) {
+    for (const Segment &segment : session.segments) {
         int start = PROGRESS_WIDTH * segment.begin / length;
         if (start >= PROGRESS_WIDTH) {
             start = PROGRESS_WIDTH - 1;
@@ -155,135 +157,237 @@ static void printProgress(double position, double length)
             printf("#");
         }
     }
+}
+
+using Sessions = std::map<std::string, std::unique_ptr<Session>>;
 
+// One line per session, erased again before anything else gets printed
+static void printStatus(const Sessions &sessions, int queryTries)
+{
+    if (sessions.empty()) {
+        static const char spinner[] = { '-', '\\', '|', '/', '-', '\\', '|', '/', };
+        static uint8_t spinnerPos = 0;
+        spinnerPos = (spinnerPos + 1) % sizeof(spinner);
+        printf("%c Waiting for chromecasts", spinner[spinnerPos]);
+        for (int i=0; i<queryTries % 10; i++) printf(".");
+        fflush(stdout);
+        printf("\033[2K\r"); // Erase the line, which won't be visible until the next flush
+        return;
+    }
+
+    bool first = true;
+    for (const std::pair<const std::string, std::unique_ptr<Session>> &session : sessions) {
+        if (!first) {
+            printf("\n");
+        }
+        first = false;
+        printProgress(*session.second);
+    }
     fflush(stdout);
-    printf("\033[2K\r");
+
+    printf("\033[2K");
+    for (size_t i=1; i<sessions.size(); i++) {
+        printf("\033[A\033[2K");
+    }
+    printf("\r");
+}
+
+// Straight from the cache if we can, if it's old we use it anyways and
+// check for changes in the background. Otherwise it's empty until the
+// download is done, and the session is updated through onUpdated.
+static std::vector<Segment> fetchSegments(SegmentCache *cache, const std::string &videoId)
+{
+    std::vector<Segment> segments;
+    switch(cache->lookup(videoId, &segments)) {
+    case SegmentCache::Fresh:
+        std::cout << " - Got " << segments.size() << " cached skip segments for " << videoId << std::endl;
+        return segments;
+    case SegmentCache::Stale:
+        std::cout << " - Got " << segments.size() << " cached skip segments for " << videoId << ", checking for updates" << std::endl;
+        cache->fetch(videoId);
+        return segments;
+    case SegmentCache::Miss:
+        break;
+    }
+
+    cache->fetch(videoId);
+    return {};
+}
+
+// Stops downloading the segments for a video if nobody is watching it anymore
+static void dropVideo(const Sessions &sessions, SegmentCache *cache, const std::string &videoId)
+{
+    if (videoId.empty()) {
+        return;
+    }
+    for (const std::pair<const std::string, std::unique_ptr<Session>> &session : sessions) {
+        if (session.second->currentVideo == videoId) {
+            return;
+        }
+    }
+    cache->cancel(videoId);
 }
 
-static bool handleMessage(Connection *connection, const std::string &inputBuffer)
+// the ID is base64, but replaced / with - and + with _, and without padding
+static bool isVideoId(const std::string_view id)
 {
-    CastMessage message;
+    if (id.empty()) {
+        return false;
+    }
+    for (const char c : id) {
+        if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_' && c != '-') {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whatever is queued up after this, the preloaded one first since that's next
+static void prefetchQueue(const cc::PayloadFields &fields, const std::string &currentVideo, SegmentCache *cache)
+{
+    for (int i=0; i<fields.queueItemCount; i++) {
+        const cc::PayloadFields::QueueItem &item = fields.queueItems[i];
+        if (!isVideoId(item.contentId) || item.contentId == currentVideo || (item.itemId >= 0 && item.itemId == fields.currentItemId)) {
+            continue;
+        }
+        const bool preloaded = item.itemId >= 0 && item.itemId == fields.preloadedItemId;
+        if (cache->prefetch(std::string(item.contentId), preloaded) && s_verbose) {
+            std::cout << "Prefetching segments for queued " << (preloaded ? "and preloaded " : "") << "video " << item.contentId << std::endl;
+        }
+    }
+}
+
+static bool handleMessage(const Sessions &sessions, Session *session, SegmentCache *cache, std::string_view inputBuffer)
+{
+    CastMessageView message;
     if (!message.parse(inputBuffer.data(), inputBuffer.size())) {
         puts("Parsing message from chromecast failed");
         return false;
     }
 
-    const std::string payload = message._payload_utf8;
+    const std::string_view payload = message._payload_utf8;
     if (payload.empty()) {
         puts("No string payload");
         return true;
     }
-    std::string type = regexExtract(R"--("type"\s*:\s*"([^"]+)")--", payload);
+    // The JSON scanning trusts that it's text
+    if (!simd::isValidUtf8(payload.data(), payload.size())) {
+        puts("Payload is not valid UTF-8");
+        return true;
+    }
+    cc::PayloadFields fields;
+    if (!cc::scanPayload(payload, &fields) && s_verbose) {
+        puts("Invalid JSON payload");
+    }
+    const std::string_view type = fields.type;
     if (type != "PING" && s_verbose) {
-        std::cout << message._source_id << " > " << message._destination_id << " (" << message._namespace << "): \n" << payload << std::endl;
+        std::cout << session->name << ": " << message._source_id << " > " << message._destination_id << " (" << message._namespace << "): \n" << payload << std::endl;
     }
 
     if (type == "CLOSE") {
-        s_currentStatus = "Disconnected";
-        cc::sendSimple(*connection, cc::msg::Connect, cc::ns::Connection);
+        session->status = "Disconnected";
+        cc::sendSimple(*session, cc::msg::Connect, cc::ns::Connection);
         return true;
     }
     if (type == "INVALID_REQUEST") {
-        s_currentStatus = "Error";
-        std::cout << message._source_id << " > " << message._destination_id << " (" << message._namespace << "): \n" << payload << std::endl;
+        session->status = "Error";
+        std::cout << session->name << ": " << message._source_id << " > " << message._destination_id << " (" << message._namespace << "): \n" << payload << std::endl;
         return false;
     }
 
     if (type == "MEDIA_STATUS") {
-        extractNumber(R"--("duration"\s*:\s*([0-9.]+))--", payload, &currentDuration);
-        if (extractNumber(R"--("currentTime"\s*:\s*([0-9.]+))--", payload, &s_currentPosition)) {
-            s_lastPositionFetched = time(nullptr);
+        if (fields.hasDuration) {
+            session->duration = fields.duration;
         }
-        const std::string state = regexExtract(R"--("playerState"\s*:\s*"([A-Z]+)")--", payload);
+        const std::string_view state = fields.playerState;
         if (!state.empty()) {
-            currentlyPlaying = state == "PLAYING";
-            s_currentStatus = state;
+            session->playing = state == "PLAYING";
+            session->status = state;
+        }
+        if (fields.hasCurrentTime && fields.currentTime >= 0) {
+            session->clock.update(fields.currentTime, fields.hasPlaybackRate ? fields.playbackRate : 1., session->playing);
         }
-        const std::string mediaSession = regexExtract(R"--("mediaSessionId"\s*:\s*([0-9]+))--", payload);
+        const std::string_view mediaSession = fields.mediaSessionId;
         if (!mediaSession.empty()) {
             if (s_verbose) {
                 std::cout << "Got media session " << mediaSession << std::endl;
             }
-            cc::mediaSession = mediaSession;
+            session->mediaSession = mediaSession;
         }
 
-        if (!s_youtube) {
+        if (!session->youtube) {
             return true;
         }
-        // the ID is base64, but replaced / with - and + with _, and without padding
-        const std::string videoID = regexExtract(R"--("contentId"\s*:\s*"([A-Za-z0-9_-]+)")--", payload);
+        const std::string_view videoID = isVideoId(fields.contentId) ? fields.contentId : std::string_view();
         if (s_verbose) {
             std::cout << "Video id: '" << videoID << "'" << std::endl;
         }
-        if (!videoID.empty() && videoID != currentVideo) {
-            currentSegments = downloadSegments(videoID);
-            currentVideo = videoID;
-            nextSegmentStart = -1;
+        if (!videoID.empty() && videoID != session->currentVideo) {
+            const std::string previousVideo = session->currentVideo;
+            session->currentVideo = videoID;
+            dropVideo(sessions, cache, previousVideo);
+            session->segments.compile(fetchSegments(cache, session->currentVideo));
+            session->segmentTimer.stop();
         }
 
-        if (!currentSegments.empty()) {
-            double delta = secondsUntilNextSegment();
-            if (s_verbose) {
-                std::cout << "time to next segment: " << delta << std::endl;
-            }
-            if (delta >= 0) {
-                nextSegmentStart = time(nullptr) + delta;
-            }
-            maybeSeek(connection);
+        prefetchQueue(fields, session->currentVideo, cache);
+
+        if (!session->segments.empty()) {
+            maybeSeek(session);
+            scheduleSkip(session);
         }
 
         // If we detect that an ad is being played, try to re-open the video
         // one second into the future.
-        const std::string customState = regexExtract(R"--("playerState"\s*:\s*(-?[0-9]+))--", payload);
-        if (s_verbose) {
-            std::cout << "Custom player state: " << customState << std::endl;
+        if (s_verbose && fields.hasCustomPlayerState) {
+            std::cout << "Custom player state: " << fields.customPlayerState << std::endl;
         }
-        if (s_adblock && customState == "1081") {
+        if (s_adblock && fields.hasCustomPlayerState && fields.customPlayerState == 1081) {
             std::cout << " Playing an ad, attempting to skip" << std::endl;
-            double position = currentPosition();
+            double position = currentPosition(*session);
             if (position < 0) {
                 position = 0;
             }
             position += 1; // attempt one second forward
-            cc::sendSimpleMedia(*connection, "STOP");
-            cc::loadMedia(*connection, currentVideo, position);
+            cc::sendSimpleMedia(*session, "STOP");
+            cc::loadMedia(*session, session->currentVideo, position);
         }
         return true;
     }
 
-    if (message._namespace == cc::ns::strings[cc::ns::Heartbeat]) {
+    if (message._namespace_id == cc::ns::Heartbeat) {
         if (type == "PING") {
-            cc::sendSimple(*connection, cc::msg::Pong, cc::ns::Heartbeat);
+            cc::sendSimple(*session, cc::msg::Pong, cc::ns::Heartbeat);
         }
         return true;
     }
-    if (message._namespace == cc::ns::strings[cc::ns::Receiver]) {
+    if (message._namespace_id == cc::ns::Receiver) {
         if (type == "RECEIVER_STATUS") {
-            const std::string displayName = regexExtract(R"--("displayName"\s*:\s*"([^"]+)")--", payload);
-            const std::string sessionId = regexExtract(R"--("sessionId"\s*:\s*"([^"]+)")--", payload);
+            const std::string_view displayName = fields.displayName;
+            const std::string_view sessionId = fields.sessionId;
             if (s_verbose) {
                 std::cout << "app display name: " << displayName << std::endl;
                 std::cout << "session: " << sessionId << std::endl;
             }
             if (!sessionId.empty()) {
-                cc::dest = sessionId;
+                session->dest = sessionId;
             }
             if (displayName == "YouTube") {
-                s_youtube = true;
+                session->youtube = true;
                 if (s_verbose) {
                     puts("Youtube playing");
                 }
             } else if (!displayName.empty()) {
-                s_youtube = false;
-                s_currentStatus = "Not youtube: '" + displayName + "'";
+                session->youtube = false;
+                session->status = "Not youtube: '" + std::string(displayName) + "'";
             }
 
-            if (payload.find("urn:x-cast:com.google.cast.media") != std::string::npos) {
+            if (payload.find(cc::ns::strings[cc::ns::Media]) != std::string_view::npos) {
                 if (s_verbose) puts("Sending get status for media");
                 // First reconnect with session id
-                cc::sendSimple(*connection, cc::msg::Connect, cc::ns::Connection);
+                cc::sendSimple(*session, cc::msg::Connect, cc::ns::Connection);
                 // Then get proper media status
-                cc::sendSimple(*connection, cc::msg::GetStatus, cc::ns::Media);
+                cc::sendSimple(*session, cc::msg::GetStatus, cc::ns::Media);
             }
         }
         return true;
@@ -296,132 +400,318 @@ static bool handleMessage(Connection *connection, const std::string &inputBuffer
     return true;
 }
 
-// TODO: automatically reconnect
-int loop(const sockaddr_in &address)
+// All the ways we can reach a device, raced against each other when connecting
+static std::vector<Endpoint> endpoints(const mdns::Device &device)
 {
-    cc::dest = "";
+    std::vector<Endpoint> ret;
+    if (device.hasIpv6) {
+        Endpoint endpoint;
+        memcpy(&endpoint.address, &device.address6, sizeof device.address6);
+        endpoint.interfaceName = device.interfaceName;
+        sockaddr_in6 local{};
+        local.sin6_family = AF_INET6;
+        local.sin6_addr = device.localAddress6;
+        local.sin6_scope_id = device.interfaceIndex;
+        memcpy(&endpoint.localAddress, &local, sizeof local);
+        ret.push_back(endpoint);
+    }
+    if (device.hasIpv4) {
+        Endpoint endpoint;
+        memcpy(&endpoint.address, &device.address, sizeof device.address);
+        endpoint.interfaceName = device.interfaceName;
+        sockaddr_in local{};
+        local.sin_family = AF_INET;
+        local.sin_addr = device.localAddress;
+        memcpy(&endpoint.localAddress, &local, sizeof local);
+        ret.push_back(endpoint);
+    }
+    return ret;
+}
 
-    if (s_verbose) {
-        puts("Opening connection");
+// Handles every complete message the chromecast has sent us, returns false if the session should be dropped
+static bool readMessages(const Sessions &sessions, Session *session, SegmentCache *cache)
+{
+    Connection &connection = session->connection;
+
+    do {
+        if (!connection.receive()) {
+            return false;
+        }
+        std::string_view frame;
+        Connection::FrameResult result;
+        while ((result = connection.nextFrame(&frame)) == Connection::Frame) {
+            if (!handleMessage(sessions, session, cache, frame)) {
+                puts("Failed to parse message");
+                return false;
+            }
+
+            // We got a valid message
+            session->lastPing = time(nullptr);
+        }
+        if (result == Connection::InvalidFrame) {
+            return false;
+        }
+        if (connection.eof) {
+            puts("Connection closed");
+            return false;
+        }
+    } while (connection.hasPending());
+
+    return true;
+}
+
+// Sends a ping if we haven't heard anything in a while, returns false if the session should be dropped
+static bool checkPing(Session *session)
+{
+    const time_t currentTime = time(nullptr);
+    if (currentTime - session->lastPing > PING_INTERVAL) {
+        if (s_verbose) {
+            std::cout << "Sending ping to " << session->name << ", last ping: " << session->lastPing << " current time: " << currentTime << " delta: " << (currentTime - session->lastPing) << std::endl;
+        }
+        if (!cc::sendSimple(*session, cc::msg::Ping, cc::ns::Heartbeat)) {
+            puts("Failed to send ping, assuming disconnected");
+            return false;
+        }
+        session->lastPing = time(nullptr);
     }
-    Connection connection;
-    if (!connection.connect(address)) {
-        std::cerr << "Failed to connect to " << inet_ntoa(address.sin_addr) << std::endl;
-        return errno;
+
+    // Check again right after the next one is due
+    session->pingTimer.start(std::chrono::seconds(session->lastPing + PING_INTERVAL + 1 - time(nullptr)));
+    return true;
+}
+
+static void togglePlayback(Session *session)
+{
+    if (session->status == "PLAYING") {
+        printf("Pausing %s\n", session->name.c_str());
+        cc::sendSimpleMedia(*session, "PAUSE");
+    } else if (session->status == "PAUSED") {
+        printf("Resuming playback on %s\n", session->name.c_str());
+        cc::sendSimpleMedia(*session, "PLAY");
+    }
+}
+
+// Returns false when there's nothing more to read
+static bool handleInput(const Sessions &sessions)
+{
+    char keys[16];
+    const ssize_t count = read(STDIN_FILENO, keys, sizeof keys);
+    if (count == 0 || (count < 0 && errno != EINTR && errno != EAGAIN)) {
+        return false;
     }
+    for (ssize_t i=0; i<count; i++) {
+        switch(keys[i]) {
+        case 'q':
+        case '\x1b':
+            s_running = false;
+            return true;
+        case ' ':
+            for (const std::pair<const std::string, std::unique_ptr<Session>> &session : sessions) {
+                togglePlayback(session.second.get());
+            }
+            break;
+        default:
+            if (s_verbose) printf("Unhandled key 0x%x\n", keys[i]);
+            break;
+        }
+    }
+    return true;
+}
+
+static void watchSession(reactor::Reactor *reactor, const Sessions *sessions, Session *session, SegmentCache *cache)
+{
+    reactor->watch(session->connection.fd, reactor::Readable, [sessions, session, cache](uint32_t events) {
+        if (session->failed) {
+            return;
+        }
+        // Whatever didn't fit in the socket earlier
+        if (session->connection.hasQueued() && !session->connection.flush()) {
+            session->failed = true;
+            return;
+        }
+        if ((events & reactor::Readable) && !readMessages(*sessions, session, cache)) {
+            session->failed = true;
+        }
+    });
+    reactor->watchTimer(&session->segmentTimer, [session]() {
+        onSegmentTimer(session);
+    });
+    reactor->watchTimer(&session->pingTimer, [session]() {
+        if (!checkPing(session)) {
+            session->failed = true;
+        }
+    });
+    session->pingTimer.start(std::chrono::seconds(PING_INTERVAL + 1));
+}
+
+static void unwatchSession(reactor::Reactor *reactor, Session *session)
+{
+    reactor->unwatch(session->connection.fd);
+    reactor->unwatch(session->segmentTimer.fd);
+    reactor->unwatch(session->pingTimer.fd);
+}
+
+// Says hello once the connection to a chromecast is up, returns false if the session should be dropped
+static bool onConnected(reactor::Reactor *reactor, const Sessions *sessions, Session *session, SegmentCache *cache)
+{
+    // First, so whatever doesn't go out right away is sent when the socket is writable
+    watchSession(reactor, sessions, session, cache);
     if (s_verbose) {
         puts("Sending connection message");
     }
-    if (!cc::sendSimple(connection, cc::msg::Connect, cc::ns::Connection)) {
+    if (!cc::sendSimple(*session, cc::msg::Connect, cc::ns::Connection)) {
         puts("Failed to send connect message");
-        return errno;
+        return false;
     }
-    puts("Connected");
-    if (!cc::sendSimple(connection, cc::msg::GetStatus, cc::ns::Receiver)) {
+    printf("Connected to %s\n", session->name.c_str());
+    if (!cc::sendSimple(*session, cc::msg::GetStatus, cc::ns::Receiver)) {
         puts("Failed to send getstatus message");
-        return errno;
+        return false;
     }
-    s_lastPing = time(nullptr);
-
-    while (s_running && !connection.eof) {
-        fd_set fdset;
-        FD_ZERO(&fdset);
-        FD_SET(connection.fd, &fdset);
-        FD_SET(STDIN_FILENO, &fdset);
+    session->lastPing = time(nullptr);
+    return true;
+}
 
-        timeval timeout;
-        timeout.tv_sec = 1; // max 1 second so we can update the progress bar
-        timeout.tv_usec = 0;
-        const int events = select(connection.fd + 1, &fdset, 0, 0, &timeout);
-        printProgress(currentPosition(), currentDuration);
+// Starts connecting to a newly discovered chromecast. The session goes from
+// connecting to handshaking to connected on reactor events, so a device that
+// is slow to answer doesn't hold up the others, and it's only watched and
+// talked to once it's connected. Returns nullptr if there's no way to reach it.
+static std::unique_ptr<Session> attach(reactor::Reactor *reactor, const Sessions *sessions, SegmentCache *cache, const mdns::Device &device)
+{
+    std::unique_ptr<Session> session = std::make_unique<Session>(device.name);
 
-        if (events < 0) {
-            perror("select()");
-            return errno;
-        }
-        if (errno == EINTR) {
-            continue;
+    if (s_verbose) {
+        printf("Opening connection to %s\n", session->name.c_str());
+    }
+    if (s_verbose && !device.interfaceName.empty()) {
+        printf("Connecting through %s\n", device.interfaceName.c_str());
+    }
+    Session *started = session.get();
+    const bool connecting = session->connection.connect(reactor, endpoints(device), [=](bool connected) {
+        if (!connected || !onConnected(reactor, sessions, started, cache)) {
+            started->failed = true;
         }
+    });
+    if (!connecting) {
+        std::cerr << "Failed to connect to " << session->name << std::endl;
+        return nullptr;
+    }
+    return session;
+}
 
-        if (FD_ISSET(STDIN_FILENO, &fdset)) {
-            const int key = getchar();
-            switch(key) {
-            case 'q':
-            case '\x1b':
-                s_running = false;
-                return 0;
-            case ' ':
-                if (s_currentStatus == "PLAYING") {
-                    puts("Pausing");
-                    cc::sendSimpleMedia(connection, "PAUSE");
-                } else if (s_currentStatus == "PAUSED") {
-                    puts("Resuming playback");
-                    cc::sendSimpleMedia(connection, "PLAY");
-                }
-                break;
-            default:
-                if (s_verbose) printf("Unhandled key 0x%x\n", key);
-                break;
-            }
-        }
+// Drives all the chromecasts the browser knows about, attaching to new ones
+// as they show up and dropping them when they or their connection go away.
+int loop(reactor::Reactor *reactor, mdns::Browser *browser, SegmentCache *cache)
+{
+    Sessions sessions;
 
-        if (events == 0) { // timeout
-            if (nextSegmentStart > 0 && nextSegmentStart <= time(nullptr)) {
-                nextSegmentStart = -1;
-                // Update to make sure we are in sync before we skip the sponsor
-                cc::sendSimple(connection, cc::msg::GetStatus, cc::ns::Media);
-            }
+    // Devices we recently lost, so we don't hammer them with reconnects
+    std::map<std::string, time_t> retryAfter;
 
-            const time_t currentTime = time(nullptr);
-            if (currentTime - s_lastPing > PING_INTERVAL) {
-                if (s_verbose) {
-                    std::cout << "Sending ping, last ping: " << s_lastPing << " current time: " << currentTime << " delta: " << (currentTime - s_lastPing) << std::endl;
-                }
-                if (!cc::sendSimple(connection, cc::msg::Ping, cc::ns::Heartbeat)) {
-                    puts("Failed to send ping, assuming disconnected");
-                    return ETIMEDOUT;
-                }
-                s_lastPing = time(nullptr);
-            }
+    const std::function<void(const mdns::Device&)> connectDevice = [&](const mdns::Device &device) {
+        if (!s_devices.empty() && !s_devices.count(device.name) && !s_devices.count(device.id)) {
+            return;
         }
-
-        if (!FD_ISSET(connection.fd, &fdset)) {
-            continue;
+        const bool retryPending = retryAfter.count(device.key) && retryAfter[device.key] > time(nullptr);
+        if (sessions.count(device.key) || retryPending) {
+            return;
         }
-
-        std::string msgLengthBuffer = connection.read(sizeof(uint32_t));
-        if (msgLengthBuffer.size() != 4) {
-            std::cerr << "Failed to read message size: '" << msgLengthBuffer << "'" << std::endl;
-            return EBADMSG;
+        std::unique_ptr<Session> session = attach(reactor, &sessions, cache, device);
+        if (!session) {
+            retryAfter[device.key] = time(nullptr) + RECONNECT_DELAY;
+            return;
         }
-        if (connection.eof) {
-            puts("Connection closed");
-            return ECONNRESET;
+        retryAfter.erase(device.key);
+        cache->warm();
+        sessions[device.key] = std::move(session);
+    };
+    browser->onAdded = connectDevice;
+    browser->onRemoved = [&](const mdns::Device &device) {
+        Sessions::iterator it = sessions.find(device.key);
+        if (it != sessions.end()) {
+            it->second->failed = true;
         }
-        uint32_t msgLength = 0;
-        memcpy(&msgLength, msgLengthBuffer.data(), sizeof msgLength);
-        msgLength = ntohl(msgLength);
-        if (msgLength > 64 * 1024) { // 64kb max according to the spec
-            printf("Message length out of range: %d\n", msgLength);
-            return EBADMSG;
+    };
+
+    cache->onUpdated = [&](const std::string &videoId, const std::vector<Segment> &segments) {
+        for (const std::pair<const std::string, std::unique_ptr<Session>> &entry : sessions) {
+            Session *session = entry.second.get();
+            if (session->currentVideo != videoId) {
+                continue;
+            }
+            session->segments.compile(segments);
+            maybeSeek(session);
+            scheduleSkip(session);
         }
+    };
 
-        std::string response = connection.read(msgLength);
-        if (response.size() < msgLength) {
-            std::cerr << "Short read, expected " << msgLength << " got " << response.size() << std::endl;
-            return EBADMSG;
+    // Reconnect straight from the device table instead of waiting for it to be announced again
+    reactor::Timer reconnectTimer;
+    reactor->watchTimer(&reconnectTimer, [&]() {
+        for (const std::pair<const std::string, mdns::Device> &device : browser->devices) {
+            connectDevice(device.second);
         }
-        if (!handleMessage(&connection, response)) {
-            puts("Failed to parse message");
-            return ECONNRESET;
+    });
+
+    // max 1 second between updates of the progress bar
+    reactor::Timer progressTimer;
+    reactor->watchTimer(&progressTimer, [&]() {
+        printStatus(sessions, browser->queryCount);
+    });
+    progressTimer.start(std::chrono::seconds(1), std::chrono::seconds(1));
+
+    reactor->watch(STDIN_FILENO, reactor::Readable, [&](uint32_t) {
+        if (!handleInput(sessions)) {
+            reactor->unwatch(STDIN_FILENO);
         }
-        if (connection.eof) {
-            puts("Disconnected");
-            return ECONNRESET;
+    });
+
+    int ret = 0;
+    if (!browser->start(reactor)) {
+        s_running = false;
+        ret = errno;
+    }
+
+    while (s_running) {
+        if (!reactor->runOnce()) {
+            ret = errno;
+            break;
+        }
+
+        for (Sessions::iterator it = sessions.begin(); it != sessions.end();) {
+            Session *session = it->second.get();
+            if (!session->failed && !session->connection.eof) {
+                ++it;
+                continue;
+            }
+            if (browser->find(it->first)) {
+                if (session->connection.state == Connection::Connected) {
+                    printf("Lost %s, reconnecting in %d seconds\n", session->name.c_str(), RECONNECT_DELAY);
+                } else {
+                    printf("Failed to connect to %s, retrying in %d seconds\n", session->name.c_str(), RECONNECT_DELAY);
+                }
+                reconnectTimer.start(std::chrono::seconds(RECONNECT_DELAY));
+            } else {
+                printf("Lost %s, will re-attach when it shows up again\n", session->name.c_str());
+                browser->requery();
+            }
+            unwatchSession(reactor, session);
+            retryAfter[it->first] = time(nullptr) + RECONNECT_DELAY;
+            const std::string video = session->currentVideo;
+            it = sessions.erase(it);
+            dropVideo(sessions, cache, video);
         }
+    }
 
-        // We got a valid message
-        s_lastPing = time(nullptr);
+    for (const std::pair<const std::string, std::unique_ptr<Session>> &session : sessions) {
+        unwatchSession(reactor, session.second.get());
     }
-    return 0;
+    browser->onAdded = nullptr;
+    browser->onRemoved = nullptr;
+    cache->onUpdated = nullptr;
+    reactor->unwatch(STDIN_FILENO);
+    reactor->unwatch(progressTimer.fd);
+    reactor->unwatch(reconnectTimer.fd);
+
+    return ret;
 }
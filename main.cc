@@ -15,30 +15,29 @@ extern "C" {
 #include <iostream>
 #include <chrono>
 #include <sstream>
+#include <unordered_map>
 
 #include "globals.h"
 
 #include "connection.h"
+#include "http.h"
 #include "sponsor.h"
 #include "util.h"
 #include "mdns.h"
 #include "chromecast.h"
 #include "loop.h"
 #include "ssl.h"
+#include "inflate.h"
+#include "reactor.h"
 
 
-void signalHandler(int sig)
-{
-    signal(sig, SIG_DFL);
-    s_running = false;
-    puts("Bye");
-}
-
 int main(int argc, char *argv[])
 {
     if (!ssl::initialize()) {
         return 1;
     }
+    // Optional, we just ask for uncompressed responses without it
+    zlib::initialize();
     static std::unordered_map<std::string, std::string> categories = {
         { "--sponsor", "Paid promotion, paid referrals and direct advertisements." },
         { "--selfpromo", "Unpaid or self promotion. Includes sections about merchandise, donations, or information about who they collaborated with." },
@@ -58,14 +57,17 @@ int main(int argc, char *argv[])
             }
         } else if (arg == "-a" || arg == "--adblock") {
             s_adblock = true;
+        } else if ((arg == "-d" || arg == "--device") && i + 1 < argc) {
+            s_devices.insert(argv[++i]);
         } else if (categories.count(arg)) {
             s_categories.insert(arg.substr(2));
         } else {
-            printf("Usage: %s [-a|--adblock] [-v|--verbose] [--all-categories]\n", argv[0]);
+            printf("Usage: %s [-a|--adblock] [-v|--verbose] [-d|--device name] [--all-categories]\n", argv[0]);
             puts("You may also specify which categories you want to skip, defaults to just sponsors:");
             for (const std::pair<const std::string, std::string> &category : categories) {
                 printf("  %s: %s\n", category.first.c_str(), category.second.c_str());
             }
+            puts("\n--device can be given multiple times, and takes either the name or the id of the chromecast");
             puts("\n--adblock is basically untested and might not work, hence not on by default");
             exit(EINVAL);
         }
@@ -77,9 +79,13 @@ int main(int argc, char *argv[])
         }
         puts("");
     }
-    signal(SIGINT, &signalHandler);
-    signal(SIGTERM, &signalHandler);
-    signal(SIGQUIT, &signalHandler);
+    reactor::Reactor reactor;
+    reactor.watchSignals({SIGINT, SIGTERM, SIGQUIT}, [](int) {
+        s_running = false;
+    });
+    // Servers close kept-alive connections whenever they feel like it, that's
+    // an error from SSL_write() and not a reason to die
+    signal(SIGPIPE, SIG_IGN);
 
     termios origTermios;
     tcgetattr(STDIN_FILENO, &origTermios);
@@ -88,32 +94,22 @@ int main(int argc, char *argv[])
     newTermios.c_lflag &= ~(ECHO | ICANON);
     tcsetattr(STDIN_FILENO, TCSANOW, &newTermios);
 
-    int ret = 0;
-    while (s_running) {
-        s_currentPosition = -1.;
-        nextSegmentStart = -1.;
-        s_lastPositionFetched = -1;
-        currentVideo = "";
-        cc::mediaSession = "";
-        cc::dest = "";
-
-        if (ret != 0) {
-            puts("Disconnected, sleeping and re-connecting");
-            sleep(10);
-        }
-        sockaddr_in address{};
-
+    mdns::Browser browser;
+    if (!browser.open()) {
+        tcsetattr(STDIN_FILENO, TCSANOW, &origTermios);
+        return ENOENT;
+    }
 
-        if (!mdns::findChromecast(&address)) {
-            ret = ENOENT;
-            break;
-        }
+    // Before the cache, which cancels its downloads when it goes away
+    dns::Resolver resolver(&reactor);
+    http::Client httpClient(&reactor, &resolver);
+    SegmentCache segmentCache(&httpClient);
+    segmentCache.open();
 
-        // hide cursor
-        printf("\033[?25l");
-        s_currentStatus = "Connecting...";
-        ret = loop(address);
-    }
+    // hide cursor
+    printf("\033[?25l");
+    const int ret = loop(&reactor, &browser, &segmentCache);
+    puts("Bye");
 
     printf("\033[?25h"); // re-enable cursor
     tcsetattr(STDIN_FILENO, TCSANOW, &origTermios);
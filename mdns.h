@@ -3,6 +3,9 @@
 #define WAIT_TIMEOUT
 
 #include "globals.h"
+#include "reactor.h"
+#include "dns.h"
+#include "util.h"
 
 #include <cstdint>
 #include <cstring>
@@ -10,35 +13,141 @@
 #include <string>
 #include <vector>
 #include <iostream>
+#include <map>
+#include <functional>
+#include <limits>
+#include <string_view>
+#include <random>
 
 extern "C" {
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <ifaddrs.h>
+#include <net/if.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 }
 
 namespace mdns {
-static constexpr std::array<uint8_t, 12> queryHeader = {
-    0x00, 0x00, // ID
-    0x00, 0x00, // Flags
-    0x00, 0x01, // Query RRs
-    0x00, 0x00, // Answer RRs
-    0x00, 0x00, // Authority RRs
-    0x00, 0x00  // Additional RRs
+static constexpr std::string_view queryName = "_googlecast._tcp.local";
+
+// Dotted name plus the header, the length of the first label, the terminating
+// 0 and QTYPE + QCLASS
+static constexpr size_t querySize = dns::HeaderSize + queryName.size() + 2 + 4;
+
+static constexpr std::array<uint8_t, querySize> buildQuery(const uint16_t qclass)
+{
+    std::array<uint8_t, querySize> packet{};
+    packet[5] = 1; // one question, everything else in the header is 0
+
+    size_t lengthPos = dns::HeaderSize;
+    size_t pos = lengthPos + 1;
+    for (const char c : queryName) {
+        if (c == '.') {
+            packet[lengthPos] = uint8_t(pos - lengthPos - 1);
+            lengthPos = pos++;
+            continue;
+        }
+        packet[pos++] = uint8_t(c);
+    }
+    packet[lengthPos] = uint8_t(pos - lengthPos - 1);
+    packet[pos++] = 0;
+
+    packet[pos++] = 0;
+    packet[pos++] = dns::PTR;
+    packet[pos++] = uint8_t(qclass >> 8);
+    packet[pos++] = uint8_t(qclass & 0xff);
+    return packet;
+}
+
+static constexpr std::array<uint8_t, querySize> multicastQuery = buildQuery(dns::ClassIN);
+static constexpr std::array<uint8_t, querySize> unicastQuery = buildQuery(dns::ClassIN | dns::UnicastResponse);
+
+// Where the question name starts, for compression pointers
+static constexpr uint8_t queryNamePointer[] = { 0xc0, dns::HeaderSize };
+
+// Where queries go and answers come from. Only ever something else than the
+// real mdns group in tests.
+struct Group
+{
+    const char *address = "224.0.0.251";
+    const char *address6 = "ff02::fb";
+    uint16_t port = 5353;
 };
-static constexpr std::array<uint8_t, 4> queryFooter = {
-    0x00, 0x0c, // QTYPE
-    0x00, 0x01  // QCLASS
+
+struct Interface
+{
+    unsigned index = 0;
+    std::string name;
+
+    bool hasIpv4 = false;
+    in_addr address{};
+
+    bool hasIpv6 = false;
+    in6_addr address6{};
 };
 
-static const std::string queryName = "_googlecast._tcp.local.";
+// All the interfaces that are up and can do multicast
+std::vector<Interface> listInterfaces()
+{
+    std::vector<Interface> interfaces;
+
+    ifaddrs *addresses = nullptr;
+    if (getifaddrs(&addresses) != 0) {
+        perror("Failed to list network interfaces");
+        return interfaces;
+    }
+    for (const ifaddrs *entry = addresses; entry; entry = entry->ifa_next) {
+        if (!entry->ifa_addr || (entry->ifa_addr->sa_family != AF_INET && entry->ifa_addr->sa_family != AF_INET6)) {
+            continue;
+        }
+        if (!(entry->ifa_flags & IFF_UP) || !(entry->ifa_flags & IFF_MULTICAST) || (entry->ifa_flags & IFF_LOOPBACK)) {
+            continue;
+        }
+        const unsigned index = if_nametoindex(entry->ifa_name);
+        if (index == 0) {
+            continue;
+        }
 
-int openSocket()
+        Interface *interface = nullptr;
+        for (Interface &existing : interfaces) {
+            if (existing.index == index) {
+                interface = &existing;
+                break;
+            }
+        }
+        if (!interface) {
+            interfaces.emplace_back();
+            interface = &interfaces.back();
+            interface->index = index;
+            interface->name = entry->ifa_name;
+        }
+
+        if (entry->ifa_addr->sa_family == AF_INET) {
+            if (!interface->hasIpv4) {
+                interface->address = reinterpret_cast<const sockaddr_in*>(entry->ifa_addr)->sin_addr;
+                interface->hasIpv4 = true;
+            }
+            continue;
+        }
+
+        // mdns over IPv6 is link local, so prefer that address for the interface
+        const in6_addr &address6 = reinterpret_cast<const sockaddr_in6*>(entry->ifa_addr)->sin6_addr;
+        if (!interface->hasIpv6 || IN6_IS_ADDR_LINKLOCAL(&address6)) {
+            interface->address6 = address6;
+            interface->hasIpv6 = true;
+        }
+    }
+    freeifaddrs(addresses);
+
+    return interfaces;
+}
+
+int openSocket(const std::vector<Interface> &interfaces, const Group &group = Group())
 {
     static const uint32_t MdnsTTL = 255;
 
-    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (fd < 0) {
         perror("Creating socket failed");
         return -1;
@@ -66,10 +175,18 @@ int openSocket()
         return -1;
     }
 
+    // So we know which interface responses arrive on
+    st = setsockopt(fd, IPPROTO_IP, IP_PKTINFO, &val, sizeof(val));
+    if (st < 0) {
+        perror("Setting IP_PKTINFO failed");
+        close(fd);
+        return -1;
+    }
+
     struct sockaddr_in sin;
     memset(&sin, 0, sizeof(sin));
     sin.sin_family = AF_INET;
-    sin.sin_port = htons(5353);
+    sin.sin_port = htons(group.port);
     sin.sin_addr.s_addr = INADDR_ANY;
     st = bind(fd, (const struct sockaddr *) &sin, sizeof(sin));
     if (st < 0) {
@@ -80,11 +197,32 @@ int openSocket()
 
     struct group_req mgroup;
     bzero(&mgroup, sizeof mgroup);
-    inet_aton("224.0.0.251", &sin.sin_addr);
+    inet_aton(group.address, &sin.sin_addr);
     memcpy(&mgroup.gr_group, &sin, sizeof sin);
 
-    st = setsockopt(fd, IPPROTO_IP, MCAST_JOIN_GROUP, reinterpret_cast<const char*>(&mgroup), sizeof(mgroup));
-    if (st < 0) {
+    // Join on every interface, if we don't have any let the kernel pick one
+    int joined = 0;
+    for (const Interface &interface : interfaces) {
+        if (!interface.hasIpv4) {
+            continue;
+        }
+        mgroup.gr_interface = interface.index;
+        st = setsockopt(fd, IPPROTO_IP, MCAST_JOIN_GROUP, reinterpret_cast<const char*>(&mgroup), sizeof(mgroup));
+        if (st < 0) {
+            perror((" ! Failed to join multicast group on " + interface.name).c_str());
+            continue;
+        }
+        if (s_verbose) printf(" - Listening on %s (%s)\n", interface.name.c_str(), inet_ntoa(interface.address));
+        joined++;
+    }
+    if (joined == 0) {
+        mgroup.gr_interface = 0;
+        st = setsockopt(fd, IPPROTO_IP, MCAST_JOIN_GROUP, reinterpret_cast<const char*>(&mgroup), sizeof(mgroup));
+        if (st == 0) {
+            joined++;
+        }
+    }
+    if (joined == 0) {
         perror(" ! Failed to join multicast group");
         close(fd);
         return -1;
@@ -92,225 +230,624 @@ int openSocket()
 
     return fd;
 }
-bool sendData(const int fd, const std::vector<uint8_t> &data)
+
+// Same as above, but IPv6 (ff02::fb)
+int openSocket6(const std::vector<Interface> &interfaces, const Group &group = Group())
+{
+    static const int MdnsHops = 255;
+
+    int fd = socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("Creating IPv6 socket failed");
+        return -1;
+    }
+
+    int val = 1;
+    if (setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &val, sizeof(val)) < 0 ||
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val)) < 0 ||
+            setsockopt(fd, IPPROTO_IPV6, IPV6_RECVPKTINFO, &val, sizeof(val)) < 0 ||
+            setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &MdnsHops, sizeof(MdnsHops)) < 0) {
+        perror("Setting IPv6 socket options failed");
+        close(fd);
+        return -1;
+    }
+
+    sockaddr_in6 sin6{};
+    sin6.sin6_family = AF_INET6;
+    sin6.sin6_port = htons(group.port);
+    sin6.sin6_addr = in6addr_any;
+    if (bind(fd, reinterpret_cast<const sockaddr*>(&sin6), sizeof(sin6)) < 0) {
+        perror("Failed to bind IPv6 socket");
+        close(fd);
+        return -1;
+    }
+
+    group_req mgroup{};
+    inet_pton(AF_INET6, group.address6, &sin6.sin6_addr);
+    memcpy(&mgroup.gr_group, &sin6, sizeof sin6);
+
+    int joined = 0;
+    for (const Interface &interface : interfaces) {
+        if (!interface.hasIpv6) {
+            continue;
+        }
+        mgroup.gr_interface = interface.index;
+        if (setsockopt(fd, IPPROTO_IPV6, MCAST_JOIN_GROUP, &mgroup, sizeof(mgroup)) < 0) {
+            perror((" ! Failed to join IPv6 multicast group on " + interface.name).c_str());
+            continue;
+        }
+        if (s_verbose) {
+            char address[INET6_ADDRSTRLEN];
+            inet_ntop(AF_INET6, &interface.address6, address, sizeof address);
+            printf(" - Listening on %s (%s)\n", interface.name.c_str(), address);
+        }
+        joined++;
+    }
+    if (joined == 0) {
+        if (s_verbose) puts(" - No IPv6 multicast interfaces");
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// Sends on the given interface, or wherever the kernel wants if it is 0
+bool sendData(const int fd, const uint8_t *data, const size_t size, const unsigned interfaceIndex, const Group &group = Group())
 {
     sockaddr_in broadcastAddr{};
     broadcastAddr.sin_family = AF_INET;
-    broadcastAddr.sin_port = htons(5353);
-    inet_aton("224.0.0.251", &broadcastAddr.sin_addr);
-
-    long st = sendto(
-            fd,
-            data.data(),
-            data.size(),
-            0,
-            reinterpret_cast<const sockaddr*>(&broadcastAddr),
-            sizeof(broadcastAddr));
-
-    // todo check length
+    broadcastAddr.sin_port = htons(group.port);
+    inet_aton(group.address, &broadcastAddr.sin_addr);
+
+    iovec iov;
+    iov.iov_base = const_cast<uint8_t*>(data);
+    iov.iov_len = size;
+
+    msghdr message{};
+    message.msg_name = &broadcastAddr;
+    message.msg_namelen = sizeof broadcastAddr;
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+
+    alignas(cmsghdr) uint8_t control[CMSG_SPACE(sizeof(in_pktinfo))] = {};
+    if (interfaceIndex) {
+        message.msg_control = control;
+        message.msg_controllen = sizeof control;
+        cmsghdr *header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = IPPROTO_IP;
+        header->cmsg_type = IP_PKTINFO;
+        header->cmsg_len = CMSG_LEN(sizeof(in_pktinfo));
+        in_pktinfo info{};
+        info.ipi_ifindex = int(interfaceIndex);
+        memcpy(CMSG_DATA(header), &info, sizeof info);
+    }
+
+    long st = sendmsg(fd, &message, 0);
     if (st < 0) {
         perror(" ! Failed to send request");
         return false;
     }
+    if (size_t(st) != size) {
+        fprintf(stderr, " ! Short write when sending request (%ld/%zu)\n", st, size);
+        return false;
+    }
 
     return true;
 }
 
-bool sendRequest(const int fd)
+bool sendData6(const int fd, const uint8_t *data, const size_t size, const unsigned interfaceIndex, const Group &group = Group())
 {
-    // Construct packet
-    std::vector<uint8_t> data;
-    data.insert(data.end(), queryHeader.begin(), queryHeader.end());
+    sockaddr_in6 multicastAddr{};
+    multicastAddr.sin6_family = AF_INET6;
+    multicastAddr.sin6_port = htons(group.port);
+    multicastAddr.sin6_scope_id = interfaceIndex;
+    inet_pton(AF_INET6, group.address6, &multicastAddr.sin6_addr);
 
-    for (const std::string &component : stringSplit(queryName, '.')) {
-        data.push_back(uint8_t(component.size()));
-        data.insert(data.end(), component.begin(), component.end());
-    }
+    // The scope id is enough to pick the interface for link local multicast
+    const unsigned outgoingInterface = interfaceIndex;
+    setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, &outgoingInterface, sizeof outgoingInterface);
 
-    data.insert(data.end(), queryFooter.begin(), queryFooter.end());
-    if (s_verbose) puts(" > Sending request....");
+    long st = sendto(fd, data, size, 0, reinterpret_cast<const sockaddr*>(&multicastAddr), sizeof(multicastAddr));
+    if (st < 0) {
+        perror(" ! Failed to send IPv6 request");
+        return false;
+    }
+    if (size_t(st) != size) {
+        fprintf(stderr, " ! Short write when sending IPv6 request (%ld/%zu)\n", st, size);
+        return false;
+    }
 
-    return sendData(fd, data);
+    return true;
 }
 
-std::string parsePacket(const std::string &data)
+// What a packet told us about one chromecast, points into the packet
+struct Announcement
 {
-    constexpr size_t minSize = queryHeader.size() + 4; // idk
-    if (data.size() < minSize) {
-        if (s_verbose) std::cerr << "Packet too small (" << data.size() << " bytes)" << std::endl;
-        return "";
-    }
+    dns::Name instance;
+    uint32_t ttl = 0;
 
-    const bool hasResponse = !(data[6] == 0 && data[7] == 0);
-    if (!s_verbose && !hasResponse) { // if verbose mode is on, parse the name anyways
-        return "";
-    }
+    bool hasService = false;
+    uint16_t port = 8009;
+    dns::Name target;
 
-    std::string hostname;
-    size_t pos = queryHeader.size();
-    while (pos + 2 < data.size()) {
-        const uint8_t length = data[pos];
-        pos++;
+    bool hasTxt = false;
+    dns::Record txt;
 
-        // Ends with a '.'
-        if (length == 0) {
-            break;
-        }
+    bool hasAddress = false;
+    in_addr address{};
 
-        const uint8_t nextPos = pos + length;
-        if (nextPos >= data.size()) {
-            if (s_verbose) std::cerr << " ! Invalid packet, next pos out of range (" << size_t(nextPos) << " max: " << data.size() << ")" << std::endl;
-            return "";
+    bool hasAddress6 = false;
+    in6_addr address6{};
+};
+
+// Returns how many chromecasts the packet describes
+int parsePacket(const uint8_t *data, const size_t size, Announcement *announcements, const int maxAnnouncements)
+{
+    dns::Parser parser(data, size);
+    if (!parser.isValid()) {
+        if (s_verbose) std::cerr << "Packet too small (" << size << " bytes)" << std::endl;
+        return 0;
+    }
+    if (!parser.header.isResponse()) {
+        if (s_verbose) puts(" - Packet with no query response (probably another request)");
+        return 0;
+    }
+
+    // First find the instances of the service, they are the PTR answers
+    int count = 0;
+    dns::Record record;
+    while (count < maxAnnouncements && parser.nextRecord(&record)) {
+        if (record.type != dns::PTR || !record.name.equals(queryName)) {
+            continue;
         }
-        hostname += data.substr(pos, length) + ".";
+        Announcement &announcement = announcements[count];
+        announcement = Announcement();
+        if (!record.ptr(&announcement.instance)) {
+            continue;
+        }
+        announcement.ttl = record.ttl;
+        count++;
+    }
+    if (!parser.isValid()) {
+        if (s_verbose) std::cerr << " ! Invalid packet" << std::endl;
+        return 0;
+    }
+    if (count == 0) {
+        return 0;
+    }
 
-        pos = nextPos;
+    // Then the records describing each instance
+    dns::Parser serviceParser(data, size);
+    while (serviceParser.nextRecord(&record)) {
+        for (int i=0; i<count; i++) {
+            Announcement &announcement = announcements[i];
+            if (!record.name.equals(announcement.instance)) {
+                continue;
+            }
+            uint16_t priority, weight;
+            if (record.srv(&priority, &weight, &announcement.port, &announcement.target)) {
+                announcement.hasService = true;
+            } else if (record.type == dns::TXT) {
+                announcement.txt = record;
+                announcement.hasTxt = true;
+            }
+        }
     }
 
-    if (s_verbose && pos + queryFooter.size() != data.size()) {
-        printf("Failed to parse entire packet (%lu/%lu), hostname: %s\n", pos, data.size(), hostname.c_str());
+    // And finally the addresses of the host the service points to
+    dns::Parser addressParser(data, size);
+    while (addressParser.nextRecord(&record)) {
+        if (record.type != dns::A && record.type != dns::AAAA) {
+            continue;
+        }
+        for (int i=0; i<count; i++) {
+            Announcement &announcement = announcements[i];
+            if (!announcement.hasService || !record.name.equals(announcement.target)) {
+                continue;
+            }
+            if (record.type == dns::A && !announcement.hasAddress) {
+                announcement.hasAddress = record.a(&announcement.address);
+            } else if (record.type == dns::AAAA && !announcement.hasAddress6) {
+                in6_addr address6;
+                if (!record.aaaa(&address6)) {
+                    continue;
+                }
+                // Prefer link local, it doesn't depend on any routing
+                announcement.address6 = address6;
+                announcement.hasAddress6 = IN6_IS_ADDR_LINKLOCAL(&address6);
+            }
+        }
     }
-    // No answers in packet
-    if (!hasResponse) {
-        if (s_verbose) puts((" - Packet with no query response (probably another request) for " + hostname).c_str());
-        return "";
+    // If there were only global addresses take one of those
+    if (count > 0) {
+        dns::Parser globalParser(data, size);
+        while (globalParser.nextRecord(&record)) {
+            for (int i=0; i<count; i++) {
+                Announcement &announcement = announcements[i];
+                if (record.type == dns::AAAA && announcement.hasService && !announcement.hasAddress6 && record.name.equals(announcement.target)) {
+                    announcement.hasAddress6 = record.aaaa(&announcement.address6);
+                }
+            }
+        }
     }
 
-    return hostname;
+    return count;
 }
 
-bool query(const int fd, sockaddr_in *address)
+struct Device
 {
-    // TODO: continously loop and update when new devices appear
+    std::string key; // the id from the TXT record if it has one
+    std::string name; // friendly name if we know it
+    std::string instance; // first label of the PTR target, for known answers
+    std::string id;
+    std::string model;
+
+    bool hasIpv4 = false;
+    sockaddr_in address{};
+
+    bool hasIpv6 = false;
+    sockaddr_in6 address6{};
+
+    // Where we saw it, so we can connect through the same interface
+    unsigned interfaceIndex = 0;
+    std::string interfaceName;
+    in_addr localAddress{};
+    in6_addr localAddress6{};
+
+    uint32_t ttl = 0;
+    time_t lastSeen = 0;
+    time_t expires = 0;
+    int refreshes = 0; // how many times we've asked for it since it was last seen
+
+    // RFC 6762 section 5.2, query at 80%, 85%, 90% and 95% of the TTL
+    time_t nextRefresh() const
+    {
+        if (refreshes >= 4) {
+            return expires;
+        }
+        return lastSeen + time_t(ttl) * (80 + 5 * refreshes) / 100;
+    }
+};
 
-    std::string packet(512, '\0');
+// Keeps the multicast socket open and keeps track of the chromecasts that
+// are around, both from answers to our own queries and from unsolicited
+// announcements and goodbyes.
+class Browser
+{
+public:
+    ~Browser()
+    {
+        if (m_reactor) {
+            m_reactor->unwatch(fd);
+            m_reactor->unwatch(fd6);
+            m_reactor->unwatch(m_queryTimer.fd);
+            m_reactor->unwatch(m_expiryTimer.fd);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (fd6 >= 0) {
+            close(fd6);
+        }
+    }
 
-    sockaddr_storage addressStorage;
-    socklen_t addressSize = sizeof(addressStorage);
+    // Succeeds if we got at least one of IPv4 and IPv6
+    bool open()
+    {
+        interfaces = listInterfaces();
+        fd = openSocket(interfaces, group);
+        fd6 = openSocket6(interfaces, group);
+        return fd >= 0 || fd6 >= 0;
+    }
 
-    time_t endTime = time(nullptr) + 10;
-    int pingTries = 0;
+    bool start(reactor::Reactor *reactor)
+    {
+        m_reactor = reactor;
+        if (fd >= 0 && !reactor->watch(fd, reactor::Readable, [this](uint32_t) { readPacket(fd); })) {
+            return false;
+        }
+        if (fd6 >= 0 && !reactor->watch(fd6, reactor::Readable, [this](uint32_t) { readPacket(fd6); })) {
+            return false;
+        }
+        reactor->watchTimer(&m_queryTimer, [this]() {
+            sendQuery(queryCount == 0);
+            // Back off exponentially, known devices are kept fresh by the refresh queries
+            m_queryTimer.start(m_queryInterval);
+            m_queryInterval = std::min<reactor::Timer::Clock::duration>(m_queryInterval * 2, std::chrono::seconds(MDNS_MAX_QUERY_INTERVAL));
+        });
+        reactor->watchTimer(&m_expiryTimer, [this]() { expire(); });
+        return requery();
+    }
 
-    do {
-        if (time(nullptr) > endTime) {
-            if (s_verbose) printf("\033[2K\r - Timeout waiting for mdns response, sending a new\n");
-            sendRequest(fd);
-            endTime = time(nullptr) + 10;
-            pingTries++;
-            continue;
+    // Starts querying from scratch, e. g. if we lost a device
+    bool requery()
+    {
+        // RFC 6762 section 5.2, wait 20-120ms before the first query
+        m_queryInterval = std::chrono::seconds(1);
+        queryCount = 0;
+        return m_queryTimer.start(std::chrono::milliseconds(20 + std::random_device()() % 100));
+    }
+
+    const Device *find(const std::string &key) const
+    {
+        std::map<std::string, Device>::const_iterator it = devices.find(key);
+        if (it == devices.end()) {
+            return nullptr;
         }
+        return &it->second;
+    }
 
-        fd_set fds;
-        FD_ZERO(&fds);
-        FD_SET(fd, &fds);
-        FD_SET(STDIN_FILENO, &fds);
+    std::map<std::string, Device> devices;
+    std::function<void(const Device&)> onAdded;
+    std::function<void(const Device&)> onRemoved;
+    std::vector<Interface> interfaces;
+    Group group; // set before open()
+    int queryCount = 0;
+    int fd = -1;
+    int fd6 = -1;
+
+private:
+    // The first query asks for unicast responses so we don't wake everyone
+    // up, the rest list what we already know so those devices stay quiet
+    bool sendQuery(const bool unicastResponse)
+    {
+        if (s_verbose) printf("\033[2K\r > Sending %s mdns query\n", unicastResponse ? "QU" : "QM");
+        queryCount++;
+
+        // Keep it within a normal ethernet MTU
+        uint8_t packet[1472];
+        const std::array<uint8_t, querySize> &query = unicastResponse ? unicastQuery : multicastQuery;
+        memcpy(packet, query.data(), query.size());
+        size_t size = query.size();
+
+        const time_t now = time(nullptr);
+        uint16_t answers = 0;
+        for (const std::pair<const std::string, Device> &entry : devices) {
+            const Device &device = entry.second;
+            // RFC 6762 section 7.1, only include answers with more than half the TTL left
+            if (device.instance.empty() || device.instance.size() > 63 || device.expires - now <= time_t(device.ttl / 2)) {
+                continue;
+            }
+            const size_t rdataLength = 1 + device.instance.size() + sizeof queryNamePointer;
+            const size_t recordSize = sizeof queryNamePointer + 10 + rdataLength;
+            if (size + recordSize > sizeof packet) {
+                break;
+            }
+            uint8_t *record = packet + size;
+            memcpy(record, queryNamePointer, sizeof queryNamePointer);
+            record += sizeof queryNamePointer;
+
+            const uint32_t ttl = uint32_t(device.expires - now);
+            const uint8_t fields[10] = {
+                0, dns::PTR,
+                0, dns::ClassIN,
+                uint8_t(ttl >> 24), uint8_t(ttl >> 16), uint8_t(ttl >> 8), uint8_t(ttl),
+                uint8_t(rdataLength >> 8), uint8_t(rdataLength)
+            };
+            memcpy(record, fields, sizeof fields);
+            record += sizeof fields;
+
+            *record++ = uint8_t(device.instance.size());
+            memcpy(record, device.instance.data(), device.instance.size());
+            record += device.instance.size();
+            memcpy(record, queryNamePointer, sizeof queryNamePointer);
+
+            size += recordSize;
+            answers++;
+        }
+        packet[6] = uint8_t(answers >> 8);
+        packet[7] = uint8_t(answers);
+        if (s_verbose && answers) printf(" - Including %d known answers\n", answers);
 
-        timeval tv = {0, 0};
-        //tv.tv_usec = 100000; // 100ms, need dat nice spinner
-        tv.tv_sec = 1;
+        bool sent = false;
+        if (fd >= 0 && interfaces.empty()) {
+            sent = sendData(fd, packet, size, 0, group);
+        }
+        for (const Interface &interface : interfaces) {
+            if (fd >= 0 && interface.hasIpv4) {
+                sent = sendData(fd, packet, size, interface.index, group) || sent;
+            }
+            if (fd6 >= 0 && interface.hasIpv6) {
+                sent = sendData6(fd6, packet, size, interface.index, group) || sent;
+            }
+        }
+        return sent;
+    }
 
-        int st = select(fd+1, &fds, nullptr, nullptr, &tv);
-        if (errno == EINTR) {
-            continue;
+    void readPacket(const int socketFd)
+    {
+        // Max mdns packet size according to RFC 6762
+        uint8_t packet[9000];
+        sockaddr_storage source;
+
+        iovec iov;
+        iov.iov_base = packet;
+        iov.iov_len = sizeof packet;
+
+        alignas(cmsghdr) uint8_t control[CMSG_SPACE(sizeof(in6_pktinfo))];
+        msghdr message{};
+        message.msg_name = &source;
+        message.msg_namelen = sizeof source;
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof control;
+
+        const long size = recvmsg(socketFd, &message, 0);
+        if (size < 0) {
+            perror(" ! Failed to read packet");
+            return;
         }
-        if (st == 0) {
-            static const char spinner[] = { '-', '\\', '|', '/', '-', '\\', '|', '/', };
-            static uint8_t spinnerPos = 0;
-            spinnerPos = (spinnerPos + 1) % sizeof(spinner);
-            printf("%c Waiting for response", spinner[spinnerPos]);
-            for (int i=0; i<pingTries % 10; i++) printf(".");
-            fflush(stdout);
-            printf("\033[2K\r"); // Erase the line, which won't be visible until the next flush
-            continue;
+
+        if (source.ss_family != AF_INET && source.ss_family != AF_INET6) {
+            std::cerr << " ! Got unknown address family " << source.ss_family << std::endl;
+            return;
         }
-        if (st < 0) {
-            if (errno != EINTR) {
-                perror(" ! Error while waiting to read");
+
+        unsigned interfaceIndex = 0;
+        for (cmsghdr *header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+            if (header->cmsg_level == IPPROTO_IP && header->cmsg_type == IP_PKTINFO) {
+                in_pktinfo info;
+                memcpy(&info, CMSG_DATA(header), sizeof info);
+                interfaceIndex = unsigned(info.ipi_ifindex);
+            } else if (header->cmsg_level == IPPROTO_IPV6 && header->cmsg_type == IPV6_PKTINFO) {
+                in6_pktinfo info;
+                memcpy(&info, CMSG_DATA(header), sizeof info);
+                interfaceIndex = info.ipi6_ifindex;
             }
-            continue;
         }
 
-        if (FD_ISSET(STDIN_FILENO, &fds)) {
-            const int key = getchar();
-            switch(key) {
-            case 'q':
-            case '\x1b':
-                puts("Aborted");
-                return false;
-            default:
-                if (s_verbose) printf("Unhandled key 0x%x\n", key);
+        Announcement announcements[16];
+        const int count = parsePacket(packet, size_t(size), announcements, 16);
+        for (int i=0; i<count; i++) {
+            handleAnnouncement(announcements[i], source, interfaceIndex);
+        }
+    }
+
+    void handleAnnouncement(const Announcement &announcement, const sockaddr_storage &source, const unsigned interfaceIndex)
+    {
+        Device device;
+        device.interfaceIndex = interfaceIndex;
+        for (const Interface &interface : interfaces) {
+            if (interface.index == interfaceIndex) {
+                device.interfaceName = interface.name;
+                device.localAddress = interface.address;
+                device.localAddress6 = interface.address6;
                 break;
             }
         }
-        if (!FD_ISSET(fd, &fds)) {
-            continue;
+        std::string_view value;
+        if (announcement.hasTxt && announcement.txt.txt("id", &value)) {
+            device.id = value;
+        }
+        if (announcement.hasTxt && announcement.txt.txt("fn", &value)) {
+            device.name = value;
+        }
+        if (announcement.hasTxt && announcement.txt.txt("md", &value)) {
+            device.model = value;
+        }
+        device.instance = announcement.instance.firstLabel();
+        device.key = device.id.empty() ? device.instance : device.id;
+
+        // Use the addresses it told us about, or where the packet came from if it didn't
+        if (announcement.hasAddress || (!announcement.hasAddress6 && source.ss_family == AF_INET)) {
+            device.hasIpv4 = true;
+            device.address.sin_family = AF_INET;
+            device.address.sin_addr = announcement.hasAddress ? announcement.address : reinterpret_cast<const sockaddr_in&>(source).sin_addr;
+            device.address.sin_port = htons(announcement.port);
+        }
+        if (announcement.hasAddress6 || (!announcement.hasAddress && source.ss_family == AF_INET6)) {
+            device.hasIpv6 = true;
+            device.address6.sin6_family = AF_INET6;
+            device.address6.sin6_addr = announcement.hasAddress6 ? announcement.address6 : reinterpret_cast<const sockaddr_in6&>(source).sin6_addr;
+            device.address6.sin6_port = htons(announcement.port);
+            if (IN6_IS_ADDR_LINKLOCAL(&device.address6.sin6_addr)) {
+                device.address6.sin6_scope_id = interfaceIndex;
+            }
         }
 
-        long size = recvfrom(
-                fd,
-                packet.data(),
-                packet.size(),
-                0,
-                reinterpret_cast<sockaddr*>(&addressStorage),
-                &addressSize
-            );
-
-        if (size < 0) {
-            perror(" ! Failed to read packet");
-            return false;
+        // Keep what we know about the other family if this packet didn't mention it
+        std::map<std::string, Device>::const_iterator existing = devices.find(device.key);
+        if (existing != devices.end()) {
+            if (!device.hasIpv4 && existing->second.hasIpv4) {
+                device.hasIpv4 = true;
+                device.address = existing->second.address;
+            }
+            if (!device.hasIpv6 && existing->second.hasIpv6) {
+                device.hasIpv6 = true;
+                device.address6 = existing->second.address6;
+            }
         }
 
-        if (addressStorage.ss_family != AF_INET) {
-            std::cerr << " ! Got wrong family, not IPv4 " << addressStorage.ss_family << std::endl;
-            continue;
+        const std::string addresses =
+            (device.hasIpv4 ? addressToString(reinterpret_cast<const sockaddr*>(&device.address)) : std::string()) +
+            (device.hasIpv4 && device.hasIpv6 ? ", " : "") +
+            (device.hasIpv6 ? addressToString(reinterpret_cast<const sockaddr*>(&device.address6)) : std::string());
+        if (device.name.empty()) {
+            device.name = addresses;
         }
 
-        memcpy(address, &addressStorage, addressSize);
+        device.ttl = announcement.ttl;
+        device.lastSeen = time(nullptr);
+        device.expires = device.lastSeen + announcement.ttl;
+
         if (s_verbose) {
-            puts(" < Got response");
+            std::cout << " < " << device.name << " (" << device.model << ", " << device.id << ") at "
+                << addresses << " on '" << device.interfaceName << "', ttl " << announcement.ttl << std::endl;
         }
 
-        packet.resize(size);
+        std::map<std::string, Device>::iterator it = devices.find(device.key);
 
-        std::string name = parsePacket(packet);
-        if (name.empty()) {
-            continue;
-        }
-        if (name != queryName) {
-            if (s_verbose) {
-                std::cerr << " - Got wrong name '" << name << "' from " << inet_ntoa(address->sin_addr) << std::endl;
+        // A TTL of 0 is a goodbye, the device is going away
+        if (announcement.ttl == 0) {
+            if (it == devices.end()) {
+                return;
             }
-            continue;
+            std::cout << "Chromecast said goodbye: " << device.name << std::endl;
+            const Device removed = it->second;
+            devices.erase(it);
+            if (onRemoved) {
+                onRemoved(removed);
+            }
+            return;
         }
 
-        return true;
-    } while (s_running);
-
-    return false;
-}
-
-static bool findChromecast(sockaddr_in *address)
-{
-    const int fd = mdns::openSocket();
-    if (fd < 0) {
-        return 1;
-    }
-    if (!mdns::sendRequest(fd)) {
-        return 2;
+        const bool isNew = it == devices.end();
+        devices[device.key] = device;
+        scheduleExpiry();
+        if (isNew) {
+            std::cout << "Found chromecast: " << device.name << " (" << addresses << ")" << std::endl;
+        }
+        if (onAdded) {
+            onAdded(device);
+        }
     }
 
-    const bool found = mdns::query(fd, address);
-    close(fd);
+    void expire()
+    {
+        const time_t now = time(nullptr);
+        bool needsRefresh = false;
+        for (std::map<std::string, Device>::iterator it = devices.begin(); it != devices.end();) {
+            Device &device = it->second;
+            if (device.expires > now) {
+                if (device.nextRefresh() <= now) {
+                    needsRefresh = true;
+                    device.refreshes++;
+                }
+                ++it;
+                continue;
+            }
+            std::cout << "Chromecast timed out: " << device.name << std::endl;
+            const Device removed = device;
+            it = devices.erase(it);
+            if (onRemoved) {
+                onRemoved(removed);
+            }
+        }
+        if (needsRefresh) {
+            sendQuery(false);
+        }
+        scheduleExpiry();
+    }
 
-    if (!found) {
-        if (errno) {
-            perror("Failed to find chromecast");
+    void scheduleExpiry()
+    {
+        if (devices.empty()) {
+            m_expiryTimer.stop();
+            return;
         }
-        return false;
+        time_t next = std::numeric_limits<time_t>::max();
+        for (const std::pair<const std::string, Device> &device : devices) {
+            next = std::min(next, device.second.nextRefresh());
+        }
+        m_expiryTimer.start(std::chrono::seconds(std::max<time_t>(next - time(nullptr), 0) + 1));
     }
-    address->sin_port = htons(8009);
-    std::cout << "Found chromecast: " << inet_ntoa(address->sin_addr) << std::endl;
-    return true;
-}
+
+    reactor::Reactor *m_reactor = nullptr;
+    reactor::Timer m_queryTimer;
+    reactor::Timer m_expiryTimer;
+    reactor::Timer::Clock::duration m_queryInterval = std::chrono::seconds(1);
+};
 
 } // namespace mdns
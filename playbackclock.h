@@ -0,0 +1,89 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+// Where the chromecast is in the video right now, extrapolated from the
+// last MEDIA_STATUS on the monotonic clock so we don't have to ask it all
+// the time. Every status we get re-anchors it, and if it keeps being a
+// bit ahead or behind what we predicted (the chromecast clock isn't ours,
+// and playbackRate is just nominal) we slowly adjust the rate we assume.
+class PlaybackClock
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    void update(const double position, const double rate, const bool playing, const Clock::time_point now = Clock::now())
+    {
+        if (isValid() && m_playing && playing && rate == m_rate) {
+            const double elapsed = seconds(now - m_anchorTime);
+            const double error = position - this->position(now);
+
+            // Anything bigger than this is a seek or a stall, not drift
+            if (elapsed >= 1. && std::abs(error) < 1.) {
+                const double observed = (position - m_anchorPosition) / (elapsed * rate);
+                m_correction = std::clamp(m_correction * 0.8 + observed * 0.2, 0.98, 1.02);
+            }
+        } else if (rate != m_rate) {
+            m_correction = 1.;
+        }
+
+        m_anchorPosition = position;
+        m_anchorTime = now;
+        m_rate = rate;
+        m_playing = playing;
+    }
+
+    // We don't know where it is until the next status, e. g. after seeking
+    void reset()
+    {
+        m_anchorPosition = -1.;
+    }
+
+    bool isValid() const
+    {
+        return m_anchorPosition >= 0;
+    }
+
+    // -1 if we don't know
+    double position(const Clock::time_point now = Clock::now()) const
+    {
+        if (!isValid()) {
+            return -1.;
+        }
+        if (!m_playing) {
+            return m_anchorPosition;
+        }
+        return m_anchorPosition + seconds(now - m_anchorTime) * speed();
+    }
+
+    // When it will reach position, time_point::max() if never (paused etc.)
+    Clock::time_point when(const double position) const
+    {
+        if (!isValid() || !m_playing || speed() <= 0) {
+            return Clock::time_point::max();
+        }
+        const std::chrono::duration<double> delta((position - m_anchorPosition) / speed());
+        return m_anchorTime + std::chrono::duration_cast<Clock::duration>(delta);
+    }
+
+    double correction() const { return m_correction; }
+
+private:
+    static double seconds(const Clock::duration duration)
+    {
+        return std::chrono::duration<double>(duration).count();
+    }
+
+    double speed() const
+    {
+        return m_rate * m_correction;
+    }
+
+    double m_anchorPosition = -1.;
+    Clock::time_point m_anchorTime;
+    double m_rate = 1.;
+    double m_correction = 1.;
+    bool m_playing = false;
+};
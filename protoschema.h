@@ -0,0 +1,449 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+// Protobuf messages declared once as a list of fields, each a field number
+// and a pointer to the member it goes in. The encoder and decoder are
+// generated from that, so field numbers and wire types are known at compile
+// time and there's no virtual dispatch per field.
+//
+//   struct Foo { uint32_t a = 0; std::string b; };
+//   using FooSchema = pb::Schema<
+//       pb::Field<1, &Foo::a, pb::Required>,
+//       pb::Field<2, &Foo::b>
+//   >;
+//
+// Supports what the cast protocol uses: integers and enums as varints,
+// strings/bytes as either owned strings or views into the parsed buffer,
+// float and double, submessages and repeated fields.
+namespace pb
+{
+
+enum WireType : uint32_t {
+    Varint = 0,
+    Fixed64 = 1,
+    LengthDelimited = 2,
+    Fixed32 = 5
+};
+
+enum Presence {
+    Optional, // Left out when empty or zero
+    Required  // Always written
+};
+
+using Bytes = std::basic_string<uint8_t>;
+
+// Varints are 7 bits per byte with the top bit set on all but the last one.
+// Keys and most lengths are one or two bytes, so those are unrolled. Longer
+// ones are decoded eight bytes at a time instead of looping over them: a
+// little endian load, the stop bits give the length, and the 7 bit groups
+// are squeezed together with pext or a few shifts. Encoding the same way
+// was slower than the plain loop, everything we write is short.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define PB_FAST_VARINTS 1
+#endif
+
+inline size_t varintSize(uint64_t value)
+{
+    // | 1 so 0 is one byte too, and clz isn't defined for it
+    const int bits = 64 - __builtin_clzll(value | 1);
+    return size_t(bits * 9 + 64) / 64;
+}
+
+#ifdef PB_FAST_VARINTS
+// Takes the low 7 bits of each byte, packed together
+inline uint64_t packVarintBytes(uint64_t bytes)
+{
+#if defined(__BMI2__)
+    return _pext_u64(bytes, 0x7f7f7f7f7f7f7f7fULL);
+#else
+    bytes &= 0x7f7f7f7f7f7f7f7fULL;
+    bytes = (bytes & 0x007f007f007f007fULL) | ((bytes & 0x7f007f007f007f00ULL) >> 1);
+    bytes = (bytes & 0x00003fff00003fffULL) | ((bytes & 0x3fff00003fff0000ULL) >> 2);
+    return (bytes & 0x000000000fffffffULL) | ((bytes & 0x0fffffff00000000ULL) >> 4);
+#endif
+}
+#endif // PB_FAST_VARINTS
+
+// Returns where the varint ends, there has to be room for varintSize() bytes
+inline uint8_t *writeVarint(uint8_t *out, uint64_t value)
+{
+    while (value >= 0x80) {
+        *out++ = uint8_t(value) | 0x80;
+        value >>= 7;
+    }
+    *out++ = uint8_t(value);
+    return out;
+}
+
+// Advances data past the varint, returns false if it is truncated or too long
+inline bool readVarint(const uint8_t *&data, const uint8_t *end, uint64_t *value)
+{
+    if (data < end && *data < 0x80) {
+        *value = *data++;
+        return true;
+    }
+    if (end - data >= 2 && data[1] < 0x80) {
+        *value = (data[0] & 0x7f) | uint64_t(data[1]) << 7;
+        data += 2;
+        return true;
+    }
+#ifdef PB_FAST_VARINTS
+    if (end - data >= ptrdiff_t(sizeof(uint64_t))) {
+        uint64_t bytes;
+        memcpy(&bytes, data, sizeof bytes);
+        const uint64_t stops = ~bytes & 0x8080808080808080ULL;
+        // Longer than 8 bytes only happens for huge or negative numbers
+        if (stops) {
+            // Everything up to and including the first stop bit
+            *value = packVarintBytes(bytes & (stops ^ (stops - 1)));
+            data += __builtin_ctzll(stops) / 8 + 1;
+            return true;
+        }
+    }
+#endif
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && data < end; shift += 7) {
+        const uint8_t byte = *data++;
+        result |= uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Skips a field we don't know about, like protobuf is supposed to
+inline bool skipField(const uint8_t *&data, const uint8_t *end, uint32_t wireType)
+{
+    uint64_t value = 0;
+    switch(wireType) {
+    case Varint:
+        return readVarint(data, end, &value);
+    case Fixed64:
+        value = 8;
+        break;
+    case LengthDelimited:
+        if (!readVarint(data, end, &value)) {
+            return false;
+        }
+        break;
+    case Fixed32:
+        value = 4;
+        break;
+    default: // groups are deprecated, nothing we talk to uses them
+        return false;
+    }
+    if (uint64_t(end - data) < value) {
+        return false;
+    }
+    data += value;
+    return true;
+}
+
+template<typename T>
+struct MemberTraits;
+
+template<typename Class, typename Type>
+struct MemberTraits<Type Class::*> {
+    using Message = Class;
+    using Value = Type;
+};
+
+template<typename T>
+struct IsBytes : std::false_type {};
+template<typename Char>
+struct IsBytes<std::basic_string<Char>> : std::bool_constant<sizeof(Char) == 1> {};
+template<typename Char>
+struct IsBytes<std::basic_string_view<Char>> : std::bool_constant<sizeof(Char) == 1> {};
+
+template<typename T>
+struct IsOptional : std::false_type { using Type = T; };
+template<typename T>
+struct IsOptional<std::optional<T>> : std::true_type { using Type = T; };
+
+template<typename T>
+struct IsRepeated : std::false_type { using Type = T; };
+template<typename T>
+struct IsRepeated<std::vector<T>> : std::true_type { using Type = T; };
+
+template<typename Nested>
+struct SchemaMessage { using Type = typename Nested::Message; };
+template<>
+struct SchemaMessage<void> { using Type = void; };
+
+// How a single value is encoded, without its key. Nested is the Schema of
+// the value if it is a message itself.
+template<typename Value, typename Nested>
+struct Codec
+{
+    static constexpr bool isBytes = IsBytes<Value>::value;
+    static constexpr bool isMessage = !std::is_void_v<Nested>;
+    static_assert(isBytes || isMessage || std::is_integral_v<Value> || std::is_enum_v<Value> || std::is_floating_point_v<Value>, "Unsupported field type");
+    static_assert(!std::is_floating_point_v<Value> || sizeof(Value) == 4 || sizeof(Value) == 8, "Only float and double are supported");
+    static_assert(!isMessage || std::is_same_v<Value, typename SchemaMessage<Nested>::Type>, "Schema is for a different message");
+
+    static constexpr WireType wireType =
+        isBytes || isMessage ? LengthDelimited :
+        std::is_floating_point_v<Value> ? (sizeof(Value) == 4 ? Fixed32 : Fixed64) :
+        Varint;
+
+    static bool isEmpty(const Value &value)
+    {
+        if constexpr (isBytes) {
+            return value.empty();
+        } else if constexpr (isMessage) {
+            return Nested::size(value) == 0;
+        } else {
+            return value == Value{};
+        }
+    }
+
+    static size_t size(const Value &value)
+    {
+        if constexpr (isBytes) {
+            return varintSize(value.size()) + value.size();
+        } else if constexpr (isMessage) {
+            const size_t length = Nested::size(value);
+            return varintSize(length) + length;
+        } else if constexpr (wireType == Varint) {
+            return varintSize(uint64_t(value));
+        } else {
+            return sizeof(Value);
+        }
+    }
+
+    // There has to be room for size() bytes
+    static uint8_t *write(const Value &value, uint8_t *out)
+    {
+        if constexpr (isBytes) {
+            out = writeVarint(out, value.size());
+            memcpy(out, value.data(), value.size());
+            return out + value.size();
+        } else if constexpr (isMessage) {
+            const size_t length = Nested::size(value);
+            out = writeVarint(out, length);
+            return Nested::write(value, out, out + length);
+        } else if constexpr (wireType == Varint) {
+            return writeVarint(out, uint64_t(value));
+        } else {
+            // Little endian on the wire
+            std::conditional_t<sizeof(Value) == 4, uint32_t, uint64_t> bits;
+            memcpy(&bits, &value, sizeof bits);
+            for (size_t i=0; i<sizeof bits; i++) {
+                *out++ = uint8_t(bits >> (i * 8));
+            }
+            return out;
+        }
+    }
+
+    // Messages are merged into what is there, like protobuf does
+    static bool read(Value *value, const uint8_t *&data, const uint8_t *end)
+    {
+        if constexpr (wireType == Fixed32 || wireType == Fixed64) {
+            std::conditional_t<sizeof(Value) == 4, uint32_t, uint64_t> bits = 0;
+            if (size_t(end - data) < sizeof bits) {
+                return false;
+            }
+            for (size_t i=0; i<sizeof bits; i++) {
+                bits |= decltype(bits)(data[i]) << (i * 8);
+            }
+            memcpy(value, &bits, sizeof bits);
+            data += sizeof bits;
+            return true;
+        }
+        uint64_t number = 0;
+        if (!readVarint(data, end, &number)) {
+            return false;
+        }
+        if constexpr (isBytes || isMessage) {
+            if (uint64_t(end - data) < number) {
+                return false;
+            }
+            if constexpr (isBytes) {
+                using Char = typename Value::value_type;
+                *value = Value(reinterpret_cast<const Char*>(data), size_t(number));
+            } else if (!Nested::parse(value, data, size_t(number))) {
+                return false;
+            }
+            data += number;
+        } else {
+            *value = Value(number);
+        }
+        return true;
+    }
+};
+
+// A field in a message. The member can be a std::optional to tell unset and
+// empty apart (which submessages usually need), or a std::vector for repeated
+// fields. Repeated fields are never packed, nothing in the cast protocol uses
+// that.
+template<uint32_t Number, auto Member, Presence presence = Optional, typename Nested = void>
+struct Field
+{
+    using Message = typename MemberTraits<decltype(Member)>::Message;
+    using Value = typename MemberTraits<decltype(Member)>::Value;
+
+    static constexpr bool isRepeated = IsRepeated<Value>::value;
+    static constexpr bool isOptional = IsOptional<Value>::value;
+    using Element = typename std::conditional_t<isRepeated, IsRepeated<Value>, IsOptional<Value>>::Type;
+    using ValueCodec = Codec<Element, Nested>;
+
+    static_assert(Number > 0 && Number < (1u << 29), "Invalid field number");
+    static_assert(presence == Optional || !(isRepeated || isOptional), "Repeated and std::optional fields can't be required");
+
+    static constexpr uint32_t number = Number;
+    static constexpr WireType wireType = ValueCodec::wireType;
+    static constexpr uint32_t key = (Number << 3) | wireType;
+    static constexpr size_t keySize = Number < 16 ? 1 : Number < 2048 ? 2 : Number < 262144 ? 3 : 4;
+
+    static bool isPresent(const Message &message)
+    {
+        if constexpr (presence == Required) {
+            return true;
+        } else if constexpr (isRepeated) {
+            return !(message.*Member).empty();
+        } else if constexpr (isOptional) {
+            return (message.*Member).has_value();
+        } else {
+            return !ValueCodec::isEmpty(message.*Member);
+        }
+    }
+
+    static size_t size(const Message &message)
+    {
+        if (!isPresent(message)) {
+            return 0;
+        }
+        if constexpr (isRepeated) {
+            size_t total = 0;
+            for (const Element &element : message.*Member) {
+                total += keySize + ValueCodec::size(element);
+            }
+            return total;
+        } else {
+            return keySize + ValueCodec::size(element(message));
+        }
+    }
+
+    // Returns where the field ends, or nullptr if it doesn't fit
+    static uint8_t *write(const Message &message, uint8_t *out, const uint8_t *end)
+    {
+        if (!isPresent(message)) {
+            return out;
+        }
+        if (size_t(end - out) < size(message)) {
+            return nullptr;
+        }
+        if constexpr (isRepeated) {
+            for (const Element &element : message.*Member) {
+                out = ValueCodec::write(element, writeVarint(out, key));
+            }
+            return out;
+        } else {
+            return ValueCodec::write(element(message), writeVarint(out, key));
+        }
+    }
+
+    static bool read(Message *message, const uint8_t *&data, const uint8_t *end)
+    {
+        if constexpr (isRepeated) {
+            Element element{};
+            if (!ValueCodec::read(&element, data, end)) {
+                return false;
+            }
+            (message->*Member).push_back(std::move(element));
+            return true;
+        } else if constexpr (isOptional) {
+            if (!(message->*Member)) {
+                (message->*Member).emplace();
+            }
+            return ValueCodec::read(&*(message->*Member), data, end);
+        } else {
+            return ValueCodec::read(&(message->*Member), data, end);
+        }
+    }
+
+private:
+    static const Element &element(const Message &message)
+    {
+        if constexpr (isOptional) {
+            return *(message.*Member);
+        } else {
+            return message.*Member;
+        }
+    }
+};
+
+// A field that is a message of its own, encoded with its schema
+template<uint32_t Number, auto Member, typename Nested, Presence presence = Optional>
+using MessageField = Field<Number, Member, presence, Nested>;
+
+template<typename... Fields>
+struct Schema
+{
+    static_assert(sizeof...(Fields) > 0, "Empty message");
+
+    using Message = typename std::tuple_element_t<0, std::tuple<Fields...>>::Message;
+    static_assert((std::is_same_v<Message, typename Fields::Message> && ...), "Fields belong to different messages");
+
+    static size_t size(const Message &message)
+    {
+        return (Fields::size(message) + ...);
+    }
+
+    // Encodes straight into the caller's buffer in one pass, the lengths of
+    // all the fields are known up front so nothing has to be measured first.
+    // Returns where the message ends, or nullptr if it doesn't fit.
+    static uint8_t *write(const Message &message, uint8_t *out, const uint8_t *end)
+    {
+        ((out = out ? Fields::write(message, out, end) : nullptr), ...);
+        return out;
+    }
+
+    // Fields not in the message keep their current values, unknown ones
+    // are skipped. A known field with the wrong wire type is an error.
+    static bool parse(Message *message, const void *buffer, size_t bufferSize)
+    {
+        const uint8_t *data = static_cast<const uint8_t*>(buffer);
+        const uint8_t *end = data + bufferSize;
+        while (data < end) {
+            uint64_t key = 0;
+            if (!readVarint(data, end, &key) || key > UINT32_MAX) {
+                return false;
+            }
+            bool known = false;
+            const bool ok = (readField<Fields>(message, uint32_t(key), data, end, &known) || ...);
+            if (known ? !ok : !skipField(data, end, uint32_t(key & 0x7))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    template<typename F>
+    static bool readField(Message *message, const uint32_t key, const uint8_t *&data, const uint8_t *end, bool *known)
+    {
+        if (key >> 3 != F::number) {
+            return false;
+        }
+        *known = true;
+        return key == F::key && F::read(message, data, end);
+    }
+};
+
+} // namespace pb
@@ -0,0 +1,330 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cerrno>
+#include <chrono>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <unordered_map>
+
+extern "C" {
+#include <unistd.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+}
+
+namespace reactor
+{
+
+enum EventFlags : uint32_t {
+    Readable = 1 << 0,
+    Writable = 1 << 1,
+};
+
+struct Event {
+    int fd = -1;
+    uint32_t events = 0;
+};
+
+// What actually waits for the file descriptors, so we can compare e. g.
+// epoll against io_uring without touching anything else.
+struct Backend
+{
+    virtual ~Backend() = default;
+
+    virtual bool add(int fd, uint32_t events) = 0;
+    virtual bool modify(int fd, uint32_t events) = 0;
+    virtual bool remove(int fd) = 0;
+
+    // Returns the number of events written to the array, or -1 on error.
+    // Interruption by a signal is not an error, it just returns 0.
+    virtual int wait(Event *events, int maxEvents, int timeoutMs) = 0;
+};
+
+struct EpollBackend : Backend
+{
+    EpollBackend()
+    {
+        fd = epoll_create1(EPOLL_CLOEXEC);
+        if (fd < 0) {
+            perror("Failed to create epoll instance");
+        }
+    }
+
+    ~EpollBackend()
+    {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    bool add(int watchFd, uint32_t events) override
+    {
+        epoll_event event{};
+        event.events = toEpoll(events);
+        event.data.fd = watchFd;
+        return epoll_ctl(fd, EPOLL_CTL_ADD, watchFd, &event) == 0;
+    }
+
+    bool modify(int watchFd, uint32_t events) override
+    {
+        epoll_event event{};
+        event.events = toEpoll(events);
+        event.data.fd = watchFd;
+        return epoll_ctl(fd, EPOLL_CTL_MOD, watchFd, &event) == 0;
+    }
+
+    bool remove(int watchFd) override
+    {
+        return epoll_ctl(fd, EPOLL_CTL_DEL, watchFd, nullptr) == 0;
+    }
+
+    int wait(Event *events, int maxEvents, int timeoutMs) override
+    {
+        epoll_event epollEvents[64];
+        if (maxEvents > 64) {
+            maxEvents = 64;
+        }
+        const int count = epoll_wait(fd, epollEvents, maxEvents, timeoutMs);
+        if (count < 0) {
+            if (errno == EINTR) {
+                return 0;
+            }
+            perror("epoll_wait()");
+            return -1;
+        }
+        for (int i=0; i<count; i++) {
+            events[i].fd = epollEvents[i].data.fd;
+            events[i].events = fromEpoll(epollEvents[i].events);
+        }
+        return count;
+    }
+
+    int fd = -1;
+
+private:
+    static uint32_t toEpoll(uint32_t events)
+    {
+        uint32_t ret = 0;
+        if (events & Readable) ret |= EPOLLIN;
+        if (events & Writable) ret |= EPOLLOUT;
+        return ret;
+    }
+
+    static uint32_t fromEpoll(uint32_t events)
+    {
+        uint32_t ret = 0;
+        // Errors and hangups get reported as readable, so the next read notices
+        if (events & (EPOLLIN | EPOLLHUP | EPOLLERR | EPOLLRDHUP)) ret |= Readable;
+        if (events & EPOLLOUT) ret |= Writable;
+        return ret;
+    }
+};
+
+// Monotonic timer as a file descriptor, so deadlines are just another event
+struct Timer
+{
+    using Clock = std::chrono::steady_clock;
+
+    Timer()
+    {
+        fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (fd < 0) {
+            perror("Failed to create timer");
+        }
+    }
+
+    ~Timer()
+    {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    Timer(const Timer&) = delete;
+    Timer &operator=(const Timer&) = delete;
+
+    // Fires once after delay, and then every interval if it is non-zero
+    bool start(Clock::duration delay, Clock::duration interval = Clock::duration::zero())
+    {
+        // A zero it_value disarms the timer, so make sure we fire
+        if (delay <= Clock::duration::zero()) {
+            delay = std::chrono::nanoseconds(1);
+        }
+        itimerspec spec{};
+        spec.it_value = toTimespec(delay);
+        spec.it_interval = toTimespec(interval);
+        if (timerfd_settime(fd, 0, &spec, nullptr) != 0) {
+            perror("Failed to start timer");
+            return false;
+        }
+        return true;
+    }
+
+    // steady_clock is CLOCK_MONOTONIC on Linux, so we can use absolute deadlines
+    bool startAt(Clock::time_point deadline)
+    {
+        const Clock::duration sinceEpoch = deadline.time_since_epoch();
+        if (sinceEpoch <= Clock::duration::zero()) {
+            return start(Clock::duration::zero());
+        }
+        itimerspec spec{};
+        spec.it_value = toTimespec(sinceEpoch);
+        if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, nullptr) != 0) {
+            perror("Failed to start timer");
+            return false;
+        }
+        return true;
+    }
+
+    void stop()
+    {
+        itimerspec spec{};
+        timerfd_settime(fd, 0, &spec, nullptr);
+    }
+
+    // Returns how many times it has expired since last time
+    uint64_t consume()
+    {
+        uint64_t expirations = 0;
+        if (read(fd, &expirations, sizeof expirations) != sizeof expirations) {
+            return 0;
+        }
+        return expirations;
+    }
+
+    int fd = -1;
+
+private:
+    static timespec toTimespec(Clock::duration duration)
+    {
+        const std::chrono::nanoseconds ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration);
+        timespec ret{};
+        ret.tv_sec = ns.count() / 1000000000;
+        ret.tv_nsec = ns.count() % 1000000000;
+        return ret;
+    }
+};
+
+class Reactor
+{
+public:
+    using Callback = std::function<void(uint32_t events)>;
+
+    explicit Reactor(std::unique_ptr<Backend> backend = std::make_unique<EpollBackend>()) :
+        m_backend(std::move(backend))
+    {
+    }
+
+    ~Reactor()
+    {
+        if (m_signalFd >= 0) {
+            close(m_signalFd);
+        }
+    }
+
+    bool watch(int fd, uint32_t events, Callback callback)
+    {
+        if (fd < 0) {
+            return false;
+        }
+        if (m_callbacks.count(fd)) {
+            if (!m_backend->modify(fd, events)) {
+                perror("Failed to modify watched fd");
+                return false;
+            }
+        } else if (!m_backend->add(fd, events)) {
+            // EPERM means it's a regular file or similar, which the caller might not care about
+            if (errno != EPERM) {
+                perror("Failed to watch fd");
+            }
+            return false;
+        }
+        m_callbacks[fd] = std::make_shared<Callback>(std::move(callback));
+        return true;
+    }
+
+    // Only changes what we wait for, keeps the callback
+    bool setEvents(int fd, uint32_t events)
+    {
+        if (!m_callbacks.count(fd)) {
+            return false;
+        }
+        return m_backend->modify(fd, events);
+    }
+
+    void unwatch(int fd)
+    {
+        if (!m_callbacks.erase(fd)) {
+            return;
+        }
+        m_backend->remove(fd);
+    }
+
+    bool watchTimer(Timer *timer, std::function<void()> callback)
+    {
+        return watch(timer->fd, Readable, [timer, callback](uint32_t) {
+            if (timer->consume()) {
+                callback();
+            }
+        });
+    }
+
+    // Blocks the signals and delivers them through a signalfd instead, so
+    // the handler runs as a normal callback and can do whatever it wants.
+    bool watchSignals(std::initializer_list<int> signals, std::function<void(int)> callback)
+    {
+        sigset_t mask;
+        sigemptyset(&mask);
+        for (const int signal : signals) {
+            sigaddset(&mask, signal);
+        }
+        if (sigprocmask(SIG_BLOCK, &mask, nullptr) != 0) {
+            perror("Failed to block signals");
+            return false;
+        }
+        m_signalFd = signalfd(m_signalFd, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (m_signalFd < 0) {
+            perror("Failed to create signalfd");
+            return false;
+        }
+        const int signalFd = m_signalFd;
+        return watch(signalFd, Readable, [signalFd, callback](uint32_t) {
+            signalfd_siginfo info;
+            while (read(signalFd, &info, sizeof info) == sizeof info) {
+                callback(int(info.ssi_signo));
+            }
+        });
+    }
+
+    // Waits for and dispatches one batch of events, returns false on fatal errors
+    bool runOnce(int timeoutMs = -1)
+    {
+        Event events[64];
+        const int count = m_backend->wait(events, 64, timeoutMs);
+        if (count < 0) {
+            return false;
+        }
+        for (int i=0; i<count; i++) {
+            // Callbacks may unwatch themselves or others, so look it up every time
+            std::unordered_map<int, std::shared_ptr<Callback>>::const_iterator it = m_callbacks.find(events[i].fd);
+            if (it == m_callbacks.end()) {
+                continue;
+            }
+            const std::shared_ptr<Callback> callback = it->second;
+            (*callback)(events[i].events);
+        }
+        return true;
+    }
+
+private:
+    std::unique_ptr<Backend> m_backend;
+    std::unordered_map<int, std::shared_ptr<Callback>> m_callbacks;
+    int m_signalFd = -1;
+};
+
+} // namespace reactor
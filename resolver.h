@@ -0,0 +1,549 @@
+#pragma once
+
+#include "globals.h"
+#include "dns.h"
+#include "reactor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+namespace dns
+{
+
+// A stub resolver for the few hosts we talk to over HTTP. It asks the
+// nameservers from /etc/resolv.conf for A and AAAA records over UDP on the
+// reactor, and remembers the answers for as long as their TTL says.
+// Address literals and /etc/hosts are handled first, like getaddrinfo().
+class Resolver
+{
+public:
+    // IPv6 first, with the port left at 0. Empty if it couldn't be resolved.
+    using Callback = std::function<void(const std::vector<sockaddr_storage> &addresses)>;
+
+    explicit Resolver(reactor::Reactor *reactor) :
+        m_reactor(reactor),
+        m_random(std::random_device()())
+    {
+    }
+
+    // Asks these servers (with their ports) instead of the ones from
+    // /etc/resolv.conf, e. g. a local one to test against
+    Resolver(reactor::Reactor *reactor, std::vector<sockaddr_storage> servers,
+            const std::chrono::milliseconds timeout = std::chrono::seconds(5), const int attempts = 2) :
+        m_reactor(reactor),
+        m_random(std::random_device()()),
+        m_servers(std::move(servers)),
+        m_fixedServers(!m_servers.empty()),
+        m_timeout(timeout),
+        m_attempts(std::max(attempts, 1))
+    {
+    }
+
+    ~Resolver()
+    {
+        for (std::pair<const std::string, std::unique_ptr<Lookup>> &lookup : m_lookups) {
+            cleanup(lookup.second.get());
+        }
+    }
+
+    Resolver(const Resolver&) = delete;
+    Resolver &operator=(const Resolver&) = delete;
+
+    // If we already know the answer the callback is called before this
+    // returns. Returns an ID for cancel().
+    uint64_t resolve(const std::string &host, Callback callback)
+    {
+        const uint64_t id = m_nextId++;
+        std::string key = host;
+        std::transform(key.begin(), key.end(), key.begin(), toLower);
+        if (!key.empty() && key.back() == '.') {
+            key.pop_back();
+        }
+
+        std::vector<sockaddr_storage> addresses;
+        if (parseAddress(key, &addresses) || fromHostsFile(key, &addresses) || fromCache(key, &addresses)) {
+            callback(addresses);
+            return id;
+        }
+
+        std::map<std::string, std::unique_ptr<Lookup>>::iterator it = m_lookups.find(key);
+        if (it == m_lookups.end()) {
+            if (!start(key)) {
+                callback({});
+                return id;
+            }
+            it = m_lookups.find(key);
+        }
+        it->second->waiters.emplace_back(id, std::move(callback));
+        return id;
+    }
+
+    void cancel(const uint64_t id)
+    {
+        for (std::map<std::string, std::unique_ptr<Lookup>>::iterator it = m_lookups.begin(); it != m_lookups.end(); ++it) {
+            std::vector<std::pair<uint64_t, Callback>> &waiters = it->second->waiters;
+            for (size_t i=0; i<waiters.size(); i++) {
+                if (waiters[i].first != id) {
+                    continue;
+                }
+                waiters.erase(waiters.begin() + long(i));
+                if (waiters.empty()) {
+                    cleanup(it->second.get());
+                    m_lookups.erase(it);
+                }
+                return;
+            }
+        }
+    }
+
+private:
+    static constexpr size_t MaxServers = 3; // same as glibc
+    static constexpr uint16_t Port = 53;
+    static constexpr Type Types[2] = { A, AAAA };
+
+    struct Lookup {
+        std::string host;
+        int fd = -1;
+        int family = AF_UNSPEC;
+        reactor::Timer timer;
+        size_t server = 0;
+        int tries = 0;
+
+        // Indexed like Types
+        uint16_t ids[2] = {};
+        bool answered[2] = {};
+        std::vector<sockaddr_storage> addresses[2];
+        uint32_t ttl = UINT32_MAX;
+
+        std::vector<std::pair<uint64_t, Callback>> waiters;
+    };
+
+    struct CacheEntry {
+        std::vector<sockaddr_storage> addresses; // empty if it doesn't exist
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    static bool parseAddress(const std::string &text, std::vector<sockaddr_storage> *addresses)
+    {
+        sockaddr_storage address{};
+        sockaddr_in *ipv4 = reinterpret_cast<sockaddr_in*>(&address);
+        if (inet_pton(AF_INET, text.c_str(), &ipv4->sin_addr) == 1) {
+            ipv4->sin_family = AF_INET;
+            addresses->push_back(address);
+            return true;
+        }
+        // Link local ones can have the interface after a %
+        const size_t percent = text.find('%');
+        sockaddr_in6 *ipv6 = reinterpret_cast<sockaddr_in6*>(&address);
+        if (inet_pton(AF_INET6, text.substr(0, percent).c_str(), &ipv6->sin6_addr) == 1) {
+            ipv6->sin6_family = AF_INET6;
+            if (percent != std::string::npos) {
+                ipv6->sin6_scope_id = if_nametoindex(text.c_str() + percent + 1);
+            }
+            addresses->push_back(address);
+            return true;
+        }
+        return false;
+    }
+
+    static bool sameAddress(const sockaddr_storage &a, const sockaddr_storage &b)
+    {
+        if (a.ss_family != b.ss_family) {
+            return false;
+        }
+        if (a.ss_family == AF_INET) {
+            const sockaddr_in &ipv4a = reinterpret_cast<const sockaddr_in&>(a);
+            const sockaddr_in &ipv4b = reinterpret_cast<const sockaddr_in&>(b);
+            return ipv4a.sin_port == ipv4b.sin_port && ipv4a.sin_addr.s_addr == ipv4b.sin_addr.s_addr;
+        }
+        const sockaddr_in6 &ipv6a = reinterpret_cast<const sockaddr_in6&>(a);
+        const sockaddr_in6 &ipv6b = reinterpret_cast<const sockaddr_in6&>(b);
+        return ipv6a.sin6_port == ipv6b.sin6_port && memcmp(&ipv6a.sin6_addr, &ipv6b.sin6_addr, sizeof(in6_addr)) == 0;
+    }
+
+    static void sortByFamily(std::vector<sockaddr_storage> *addresses)
+    {
+        std::stable_partition(addresses->begin(), addresses->end(), [](const sockaddr_storage &address) {
+            return address.ss_family == AF_INET6;
+        });
+    }
+
+    // Returns the size, or 0 if the name isn't valid
+    static size_t buildQuery(uint8_t *packet, const size_t size, const uint16_t id, const std::string &name, const uint16_t type)
+    {
+        if (name.empty() || name.size() > MaxNameLength || HeaderSize + name.size() + 2 + 4 > size) {
+            return 0;
+        }
+        memset(packet, 0, HeaderSize);
+        packet[0] = uint8_t(id >> 8);
+        packet[1] = uint8_t(id);
+        packet[2] = 0x01; // recursion desired
+        packet[5] = 1; // one question
+
+        size_t pos = HeaderSize;
+        size_t labelStart = 0;
+        while (labelStart <= name.size()) {
+            size_t labelEnd = name.find('.', labelStart);
+            if (labelEnd == std::string::npos) {
+                labelEnd = name.size();
+            }
+            const size_t length = labelEnd - labelStart;
+            if (length == 0 || length > 63) {
+                return 0;
+            }
+            packet[pos++] = uint8_t(length);
+            memcpy(packet + pos, name.data() + labelStart, length);
+            pos += length;
+            labelStart = labelEnd + 1;
+        }
+        packet[pos++] = 0;
+        packet[pos++] = uint8_t(type >> 8);
+        packet[pos++] = uint8_t(type);
+        packet[pos++] = 0;
+        packet[pos++] = ClassIN;
+        return pos;
+    }
+
+    static bool fromHostsFile(const std::string &host, std::vector<sockaddr_storage> *addresses)
+    {
+        std::ifstream file("/etc/hosts");
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream words(line.substr(0, line.find('#')));
+            std::string address, name;
+            if (!(words >> address)) {
+                continue;
+            }
+            while (words >> name) {
+                std::transform(name.begin(), name.end(), name.begin(), toLower);
+                if (name == host) {
+                    parseAddress(address, addresses);
+                    break;
+                }
+            }
+        }
+        sortByFamily(addresses);
+        return !addresses->empty();
+    }
+
+    bool fromCache(const std::string &host, std::vector<sockaddr_storage> *addresses)
+    {
+        std::map<std::string, CacheEntry>::iterator it = m_cache.find(host);
+        if (it == m_cache.end()) {
+            return false;
+        }
+        if (it->second.expires <= std::chrono::steady_clock::now()) {
+            m_cache.erase(it);
+            return false;
+        }
+        *addresses = it->second.addresses;
+        return true;
+    }
+
+    // Only reads it again if it has changed, e. g. we moved to another network
+    void loadConfig()
+    {
+        if (m_fixedServers) {
+            return;
+        }
+        struct stat info;
+        const bool exists = stat("/etc/resolv.conf", &info) == 0;
+        if (exists && !m_servers.empty() && info.st_mtime == m_configTime) {
+            return;
+        }
+        m_configTime = exists ? info.st_mtime : 0;
+        m_servers.clear();
+        m_timeout = std::chrono::seconds(5);
+        m_attempts = 2;
+
+        std::ifstream file("/etc/resolv.conf");
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream words(line.substr(0, line.find_first_of("#;")));
+            std::string keyword, value;
+            if (!(words >> keyword)) {
+                continue;
+            }
+            if (keyword == "nameserver" && words >> value && m_servers.size() < MaxServers) {
+                std::vector<sockaddr_storage> address;
+                if (parseAddress(value, &address)) {
+                    m_servers.push_back(withPort(address[0], Port));
+                }
+            } else if (keyword == "options") {
+                while (words >> value) {
+                    if (value.compare(0, 8, "timeout:") == 0) {
+                        m_timeout = std::chrono::seconds(std::max(atoi(value.c_str() + 8), 1));
+                    } else if (value.compare(0, 9, "attempts:") == 0) {
+                        m_attempts = std::max(atoi(value.c_str() + 9), 1);
+                    }
+                }
+            }
+        }
+        // What glibc does without any
+        if (m_servers.empty()) {
+            std::vector<sockaddr_storage> address;
+            parseAddress("127.0.0.1", &address);
+            m_servers.push_back(withPort(address[0], Port));
+        }
+    }
+
+    static sockaddr_storage withPort(sockaddr_storage address, const uint16_t port)
+    {
+        if (address.ss_family == AF_INET) {
+            reinterpret_cast<sockaddr_in*>(&address)->sin_port = htons(port);
+        } else {
+            reinterpret_cast<sockaddr_in6*>(&address)->sin6_port = htons(port);
+        }
+        return address;
+    }
+
+    bool start(const std::string &host)
+    {
+        loadConfig();
+        std::unique_ptr<Lookup> lookup = std::make_unique<Lookup>();
+        lookup->host = host;
+        std::uniform_int_distribution<uint16_t> distribution;
+        for (uint16_t &id : lookup->ids) {
+            id = distribution(m_random);
+        }
+        Lookup *raw = lookup.get();
+        m_lookups[host] = std::move(lookup);
+
+        m_reactor->watchTimer(&raw->timer, [this, host]() {
+            retry(host);
+        });
+        if (!send(raw)) {
+            cleanup(raw);
+            m_lookups.erase(host);
+            return false;
+        }
+        return true;
+    }
+
+    // Asks the current server for whatever we haven't gotten an answer for
+    bool send(Lookup *lookup)
+    {
+        const sockaddr_storage &server = m_servers[lookup->server % m_servers.size()];
+        // A new socket for every lookup, so the source port is random too
+        if (lookup->fd < 0 || lookup->family != server.ss_family) {
+            if (lookup->fd >= 0) {
+                m_reactor->unwatch(lookup->fd);
+                close(lookup->fd);
+            }
+            lookup->family = server.ss_family;
+            lookup->fd = socket(lookup->family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (lookup->fd < 0) {
+                perror("Failed to open DNS socket");
+                return false;
+            }
+            const std::string host = lookup->host;
+            m_reactor->watch(lookup->fd, reactor::Readable, [this, host](uint32_t) {
+                onPacket(host);
+            });
+        }
+
+        const socklen_t addressSize = server.ss_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+        bool sent = false;
+        for (size_t i=0; i<2; i++) {
+            if (lookup->answered[i]) {
+                continue;
+            }
+            uint8_t packet[HeaderSize + MaxNameLength + 2 + 4];
+            const size_t size = buildQuery(packet, sizeof packet, lookup->ids[i], lookup->host, Types[i]);
+            if (size == 0) {
+                fprintf(stderr, "Can't look up invalid name %s\n", lookup->host.c_str());
+                return false;
+            }
+            if (sendto(lookup->fd, packet, size, 0, reinterpret_cast<const sockaddr*>(&server), addressSize) < 0) {
+                perror("Failed to send DNS query");
+                continue;
+            }
+            sent = true;
+        }
+        lookup->timer.start(m_timeout);
+        // If it failed we let the timer move on to the next server
+        return sent || m_servers.size() > 1;
+    }
+
+    void onPacket(const std::string &host)
+    {
+        std::map<std::string, std::unique_ptr<Lookup>>::iterator it = m_lookups.find(host);
+        if (it == m_lookups.end()) {
+            return;
+        }
+        Lookup *lookup = it->second.get();
+
+        uint8_t packet[4096];
+        sockaddr_storage source{};
+        socklen_t sourceSize = sizeof source;
+        const ssize_t size = recvfrom(lookup->fd, packet, sizeof packet, 0, reinterpret_cast<sockaddr*>(&source), &sourceSize);
+        if (size < 0) {
+            return;
+        }
+        // Only from who we asked, and about what we asked, so it's harder to spoof
+        bool fromServer = false;
+        for (const sockaddr_storage &server : m_servers) {
+            fromServer = fromServer || sameAddress(server, source);
+        }
+        Parser parser(packet, size_t(size));
+        if (!fromServer || !parser.isValid() || !parser.header.isResponse() || parser.header.questions != 1) {
+            return;
+        }
+        int index = -1;
+        for (int i=0; i<2; i++) {
+            if (!lookup->answered[i] && parser.header.id == lookup->ids[i]) {
+                index = i;
+            }
+        }
+        Name name;
+        uint16_t type, qclass;
+        if (index < 0 || !parser.nextQuestion(&name, &type, &qclass) || type != Types[index] || !name.equals(host)) {
+            return;
+        }
+
+        const uint8_t responseCode = parser.header.responseCode();
+        if (responseCode != 0 && responseCode != 3) { // 3 is NXDOMAIN, that's an answer too
+            if (s_verbose) {
+                printf("DNS server returned error %d for %s, trying the next one\n", responseCode, host.c_str());
+            }
+            retry(host);
+            return;
+        }
+
+        // Servers put the CNAMEs before what they point to
+        std::vector<std::string> names = { host };
+        Record record;
+        while (parser.nextRecord(&record) && parser.recordSection() == Parser::Answers) {
+            if ((record.rrclass & ClassMask) != ClassIN) {
+                continue;
+            }
+            bool matches = false;
+            for (const std::string &alias : names) {
+                matches = matches || record.name.equals(alias);
+            }
+            if (!matches) {
+                continue;
+            }
+            lookup->ttl = std::min(lookup->ttl, record.ttl);
+            Name target;
+            if (record.cname(&target)) {
+                names.push_back(target.toString());
+                continue;
+            }
+            sockaddr_storage address{};
+            if (record.type != Types[index]) {
+                continue;
+            } else if (record.a(&reinterpret_cast<sockaddr_in*>(&address)->sin_addr)) {
+                address.ss_family = AF_INET;
+            } else if (record.aaaa(&reinterpret_cast<sockaddr_in6*>(&address)->sin6_addr)) {
+                address.ss_family = AF_INET6;
+            } else {
+                continue;
+            }
+            lookup->addresses[index].push_back(address);
+        }
+        lookup->answered[index] = true;
+        if (lookup->answered[0] && lookup->answered[1]) {
+            finish(host, true);
+        }
+    }
+
+    void retry(const std::string &host)
+    {
+        std::map<std::string, std::unique_ptr<Lookup>>::iterator it = m_lookups.find(host);
+        if (it == m_lookups.end()) {
+            return;
+        }
+        Lookup *lookup = it->second.get();
+        lookup->tries++;
+        if (size_t(lookup->tries) >= size_t(m_attempts) * m_servers.size()) {
+            if (s_verbose) {
+                printf("No answer from any DNS server for %s\n", host.c_str());
+            }
+            finish(host, false);
+            return;
+        }
+        lookup->server = (lookup->server + 1) % m_servers.size();
+        if (!send(lookup)) {
+            finish(host, false);
+        }
+    }
+
+    // Answers are cached, including that it doesn't exist, but not that
+    // the servers didn't answer
+    void finish(const std::string &host, const bool answered)
+    {
+        std::map<std::string, std::unique_ptr<Lookup>>::iterator it = m_lookups.find(host);
+        if (it == m_lookups.end()) {
+            return;
+        }
+        // Take it out first, a callback might look up something else
+        std::unique_ptr<Lookup> lookup = std::move(it->second);
+        m_lookups.erase(it);
+        cleanup(lookup.get());
+
+        std::vector<sockaddr_storage> addresses = lookup->addresses[1];
+        addresses.insert(addresses.end(), lookup->addresses[0].begin(), lookup->addresses[0].end());
+
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (answered) {
+            const uint32_t ttl = addresses.empty() ? DNS_NEGATIVE_TTL : lookup->ttl;
+            for (std::map<std::string, CacheEntry>::iterator entry = m_cache.begin(); entry != m_cache.end();) {
+                entry = entry->second.expires <= now ? m_cache.erase(entry) : std::next(entry);
+            }
+            m_cache[host] = { addresses, now + std::chrono::seconds(ttl) };
+            if (s_verbose) {
+                printf("Resolved %s to %zu addresses, valid for %u seconds\n", host.c_str(), addresses.size(), ttl);
+            }
+        }
+
+        for (const std::pair<uint64_t, Callback> &waiter : lookup->waiters) {
+            waiter.second(addresses);
+        }
+    }
+
+    void cleanup(Lookup *lookup)
+    {
+        if (lookup->fd >= 0) {
+            m_reactor->unwatch(lookup->fd);
+            close(lookup->fd);
+            lookup->fd = -1;
+        }
+        m_reactor->unwatch(lookup->timer.fd);
+    }
+
+    reactor::Reactor *m_reactor;
+    std::mt19937 m_random;
+    uint64_t m_nextId = 1;
+
+    std::vector<sockaddr_storage> m_servers;
+    bool m_fixedServers = false; // not from resolv.conf
+    time_t m_configTime = 0;
+    std::chrono::milliseconds m_timeout = std::chrono::seconds(5);
+    int m_attempts = 2;
+
+    std::map<std::string, std::unique_ptr<Lookup>> m_lookups; // by host
+    std::map<std::string, CacheEntry> m_cache;
+};
+
+} // namespace dns
@@ -0,0 +1,400 @@
+#pragma once
+
+#include "globals.h"
+#include "http.h"
+#include "skipplan.h"
+#include "sponsor.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+}
+
+// Remembers the segments for the videos we've seen, in a memory mapped
+// file so it survives restarts and a lookup is just a couple of memcmps.
+// It's a fixed size hash table, when the slots a video can go in are full
+// the oldest one is thrown out.
+//
+// Old entries are still used, but we fetch them again in the background
+// and update any sessions watching the video if the segments changed.
+// Misses and videos that are queued up are fetched the same way, a few at a
+// time on the reactor.
+class SegmentCache
+{
+public:
+    enum Result {
+        Miss,
+        Fresh,
+        Stale
+    };
+
+    explicit SegmentCache(http::Client *client) :
+        m_client(client)
+    {
+    }
+
+    ~SegmentCache()
+    {
+        for (const std::pair<const std::string, uint64_t> &fetch : m_inFlight) {
+            m_client->cancel(fetch.second);
+        }
+        if (m_header) {
+            munmap(m_header, fileSize());
+        }
+    }
+
+    SegmentCache(const SegmentCache&) = delete;
+    SegmentCache &operator=(const SegmentCache&) = delete;
+
+    // Without a cache file everything is just a miss, so failing isn't fatal
+    bool open()
+    {
+        const std::string path = cachePath();
+        if (path.empty()) {
+            return false;
+        }
+        const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            perror(("Failed to open segment cache " + path).c_str());
+            return false;
+        }
+        struct stat info;
+        bool initialize = fstat(fd, &info) != 0 || size_t(info.st_size) != fileSize();
+        if (initialize && ftruncate(fd, 0) != 0) {
+            perror("Failed to truncate segment cache");
+        }
+        if (initialize && ftruncate(fd, off_t(fileSize())) != 0) {
+            perror("Failed to resize segment cache");
+            ::close(fd);
+            return false;
+        }
+        void *mapped = mmap(nullptr, fileSize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            perror("Failed to map segment cache");
+            return false;
+        }
+        m_header = static_cast<Header*>(mapped);
+        m_entries = reinterpret_cast<Entry*>(m_header + 1);
+
+        if (!initialize && (memcmp(m_header->magic, Magic, sizeof Magic) != 0 || m_header->version != Version)) {
+            initialize = true;
+        }
+        if (initialize) {
+            memset(mapped, 0, fileSize());
+            memcpy(m_header->magic, Magic, sizeof Magic);
+            m_header->version = Version;
+        }
+        if (s_verbose) {
+            printf(" - Using segment cache %s\n", path.c_str());
+        }
+        return true;
+    }
+
+    Result lookup(const std::string &videoId, std::vector<Segment> *segments) const
+    {
+        const Entry *entry = find(videoId);
+        if (!entry) {
+            return Miss;
+        }
+        segments->clear();
+        for (uint32_t i=0; i<entry->count; i++) {
+            segments->push_back({entry->segments[i][0], entry->segments[i][1]});
+        }
+        if (entry->truncated || isExpired(*entry)) {
+            return Stale;
+        }
+        return Fresh;
+    }
+
+    // No segments is stored as well, so we don't ask again every time.
+    // If there are too many they're merged first, and if that's still too
+    // many we keep the first ones and the entry is always stale, so whoever
+    // plays it gets the rest from a background fetch.
+    void store(const std::string &videoId, const std::vector<Segment> &allSegments)
+    {
+        if (!m_header || videoId.empty() || videoId.size() >= sizeof Entry::videoId) {
+            return;
+        }
+        const std::vector<Segment> *stored = &allSegments;
+        std::vector<Segment> merged;
+        bool truncated = false;
+        if (allSegments.size() > MaxSegments) {
+            const SkipPlan plan(allSegments);
+            merged.assign(plan.begin(), plan.end());
+            if (merged.size() > MaxSegments) {
+                fprintf(stderr, " ! %s has %zu segments, only caching the first %zu\n", videoId.c_str(), merged.size(), MaxSegments);
+                merged.resize(MaxSegments);
+                truncated = true;
+            }
+            stored = &merged;
+        }
+        const std::vector<Segment> &segments = *stored;
+
+        Entry *entry = const_cast<Entry*>(find(videoId));
+        if (!entry) {
+            entry = slotFor(videoId);
+        }
+        // Clear the ID first and write it last, so a half written entry
+        // (we crashed, or another instance is reading it) is never used
+        entry->videoId[0] = '\0';
+        entry->fetched = time(nullptr);
+        entry->ttl = segments.empty() ? CACHE_NEGATIVE_TTL : CACHE_TTL;
+        entry->categories = categoriesHash();
+        entry->count = uint32_t(segments.size());
+        entry->truncated = truncated;
+        for (size_t i=0; i<segments.size(); i++) {
+            entry->segments[i][0] = segments[i].begin;
+            entry->segments[i][1] = segments[i].end;
+        }
+        char id[sizeof entry->videoId] = {};
+        memcpy(id, videoId.data(), videoId.size());
+        memcpy(entry->videoId, id, sizeof id);
+    }
+
+    // Stores everything in a response, including the other videos in the
+    // bucket, and returns what we should skip in the one we asked for
+    std::vector<Segment> storeResponse(const std::string &videoId, const std::vector<sponsor::Record> &records)
+    {
+        std::map<std::string, std::vector<Segment>> videos;
+        videos[videoId]; // if it's not in there there's nothing to skip
+        for (const sponsor::Record &record : records) {
+            const std::string &id = record.videoId.empty() ? videoId : record.videoId;
+            std::vector<Segment> &segments = videos[id];
+            if (record.actionType == sponsor::ActionType::Skip) {
+                segments.push_back(record.segment);
+            }
+        }
+        for (const std::pair<const std::string, std::vector<Segment>> &video : videos) {
+            store(video.first, video.second);
+        }
+        return videos[videoId];
+    }
+
+    // Fetches it in the background, unless we're already doing that.
+    // onUpdated is called when it's done.
+    void fetch(const std::string &videoId, const bool urgent = true)
+    {
+        if (videoId.empty() || m_inFlight.count(videoId) || isBackingOff(videoId)) {
+            return;
+        }
+        std::deque<std::string>::iterator queued = std::find(m_queue.begin(), m_queue.end(), videoId);
+        if (queued != m_queue.end()) {
+            if (!urgent) {
+                return;
+            }
+            m_queue.erase(queued);
+        } else if (!urgent && m_queue.size() >= MaxQueued) {
+            return;
+        }
+        if (urgent) {
+            m_queue.push_front(videoId);
+        } else {
+            m_queue.push_back(videoId);
+        }
+        pump();
+    }
+
+    // Nobody is watching it anymore, so don't waste a connection on it
+    void cancel(const std::string &videoId)
+    {
+        std::deque<std::string>::iterator queued = std::find(m_queue.begin(), m_queue.end(), videoId);
+        if (queued != m_queue.end()) {
+            m_queue.erase(queued);
+        }
+        std::map<std::string, uint64_t>::iterator inFlight = m_inFlight.find(videoId);
+        if (inFlight != m_inFlight.end()) {
+            m_client->cancel(inFlight->second);
+            m_inFlight.erase(inFlight);
+            pump();
+        }
+    }
+
+    // For videos that will probably be played soon, so the segments are
+    // ready when they start. Returns false if we already have them, or the
+    // last try failed not long ago. Ones that were too big to cache are
+    // left alone too until they expire, otherwise every status update for a
+    // queue with one of them in it would fetch it again.
+    bool prefetch(const std::string &videoId, const bool urgent)
+    {
+        const Entry *entry = find(videoId);
+        if ((entry && !isExpired(*entry)) || isBackingOff(videoId)) {
+            return false;
+        }
+        fetch(videoId, urgent);
+        return true;
+    }
+
+    // Something will probably start playing soon, so get the connection to
+    // the API ready
+    void warm()
+    {
+        m_client->warm(sponsor::apiHost, sponsor::apiPort);
+    }
+
+    // Called when a background fetch has finished
+    std::function<void(const std::string &videoId, const std::vector<Segment> &segments)> onUpdated;
+
+private:
+    static constexpr char Magic[8] = { 'S', 'Y', 'C', 'A', 'C', 'H', 'E', '\0' };
+    static constexpr uint32_t Version = 1;
+    static constexpr size_t Capacity = 4096;
+    static constexpr size_t MaxSegments = 30;
+    static constexpr size_t ProbeLength = 8;
+    static constexpr size_t MaxQueued = 16;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+    };
+
+    struct Entry {
+        char videoId[16]; // YouTube IDs are 11 characters, empty if unused
+        int64_t fetched;
+        uint32_t ttl;
+        uint32_t categories; // what we asked for, a different set is a different answer
+        uint32_t count;
+        uint32_t truncated; // there were more than we have room for
+        double segments[MaxSegments][2];
+    };
+
+    static size_t fileSize()
+    {
+        return sizeof(Header) + Capacity * sizeof(Entry);
+    }
+
+    static std::string cachePath()
+    {
+        const char *cacheHome = getenv("XDG_CACHE_HOME");
+        std::string directory;
+        if (cacheHome && *cacheHome) {
+            directory = cacheHome;
+        } else if (getenv("HOME")) {
+            directory = std::string(getenv("HOME")) + "/.cache";
+        } else {
+            return "";
+        }
+        mkdir(directory.c_str(), 0700); // fine if it exists
+        return directory + "/sponsoryeet-segments.cache";
+    }
+
+    // FNV-1a
+    static uint32_t hash(const std::string &string, uint32_t hash = 2166136261u)
+    {
+        for (const char c : string) {
+            hash = (hash ^ uint8_t(c)) * 16777619u;
+        }
+        return hash;
+    }
+
+    static uint32_t categoriesHash()
+    {
+        uint32_t ret = 2166136261u;
+        for (const std::string &category : s_categories) {
+            ret = hash(category + ",", ret);
+        }
+        return ret;
+    }
+
+    const Entry *find(const std::string &videoId) const
+    {
+        if (!m_header || videoId.empty() || videoId.size() >= sizeof Entry::videoId) {
+            return nullptr;
+        }
+        const uint32_t categories = categoriesHash();
+        const size_t start = hash(videoId) % Capacity;
+        for (size_t i=0; i<ProbeLength; i++) {
+            const Entry &entry = m_entries[(start + i) % Capacity];
+            if (entry.videoId[0] == '\0') {
+                continue;
+            }
+            if (strncmp(entry.videoId, videoId.c_str(), sizeof entry.videoId) == 0 && entry.categories == categories && entry.count <= MaxSegments) {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+
+    static bool isExpired(const Entry &entry)
+    {
+        return time(nullptr) - entry.fetched >= int64_t(entry.ttl);
+    }
+
+    // An empty slot, or the oldest one
+    Entry *slotFor(const std::string &videoId)
+    {
+        const size_t start = hash(videoId) % Capacity;
+        Entry *oldest = nullptr;
+        for (size_t i=0; i<ProbeLength; i++) {
+            Entry &entry = m_entries[(start + i) % Capacity];
+            if (entry.videoId[0] == '\0') {
+                return &entry;
+            }
+            if (!oldest || entry.fetched < oldest->fetched) {
+                oldest = &entry;
+            }
+        }
+        return oldest;
+    }
+
+    // Forgets about failures that are old enough to try again
+    bool isBackingOff(const std::string &videoId)
+    {
+        const time_t now = time(nullptr);
+        for (std::map<std::string, time_t>::iterator it = m_retryAfter.begin(); it != m_retryAfter.end();) {
+            if (it->second <= now) {
+                it = m_retryAfter.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        return m_retryAfter.count(videoId);
+    }
+
+    void pump()
+    {
+        while (!m_queue.empty() && m_inFlight.size() < SEGMENT_FETCH_CONCURRENCY) {
+            const std::string videoId = m_queue.front();
+            m_queue.pop_front();
+            m_inFlight[videoId] = sponsor::lookup(m_client, videoId, [this, videoId](const bool ok, const std::vector<sponsor::Record> &records) {
+                onFetched(videoId, ok, records);
+            });
+        }
+    }
+
+    void onFetched(const std::string &videoId, const bool ok, const std::vector<sponsor::Record> &records)
+    {
+        m_inFlight.erase(videoId);
+        // Keep serving the old one if it failed, better than nothing
+        if (ok) {
+            m_retryAfter.erase(videoId);
+            const std::vector<Segment> segments = storeResponse(videoId, records);
+            if (onUpdated) {
+                onUpdated(videoId, segments);
+            }
+        } else {
+            m_retryAfter[videoId] = time(nullptr) + SEGMENT_RETRY_DELAY;
+        }
+        pump();
+    }
+
+    Header *m_header = nullptr;
+    Entry *m_entries = nullptr;
+
+    http::Client *m_client;
+    std::deque<std::string> m_queue;
+    std::map<std::string, uint64_t> m_inFlight; // video ID to request ID
+    std::map<std::string, time_t> m_retryAfter; // video ID to when we can try again after it failed
+};
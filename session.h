@@ -0,0 +1,47 @@
+#pragma once
+
+#include "globals.h"
+#include "connection.h"
+#include "reactor.h"
+#include "playbackclock.h"
+#include "skipplan.h"
+#include "castframes.h"
+
+#include <string>
+#include <vector>
+
+// Everything we know about one chromecast we are attached to
+struct Session
+{
+    explicit Session(const std::string &deviceName) :
+        name(deviceName)
+    {
+    }
+
+    Session(const Session&) = delete;
+    Session &operator=(const Session&) = delete;
+
+    const std::string name;
+    Connection connection;
+    bool failed = false;
+
+    // Cast channel
+    std::string dest;
+    std::string mediaSession;
+    int requestId = 1;
+    cc::FrameTemplates frames;
+    bool youtube = false;
+
+    // Playback
+    SkipPlan segments;
+    std::string currentVideo;
+    PlaybackClock clock;
+    double duration = -1.;
+    bool playing = false;
+    PlaybackClock::Clock::time_point lastSeek;
+    time_t lastPing = 0;
+    std::string status;
+
+    reactor::Timer segmentTimer; // when the next segment starts
+    reactor::Timer pingTimer;
+};
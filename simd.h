@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Small helpers for scanning text 16 bytes at a time (32 with AVX2), with a
+// plain loop for whatever is left over and for platforms without SSE2 or NEON.
+namespace simd
+{
+
+template<char... Chars>
+inline bool isAnyOf(const char c)
+{
+    return ((c == Chars) || ...);
+}
+
+// Returns a pointer to the first byte that is one of Chars, or end
+template<char... Chars>
+inline const char *findAny(const char *begin, const char *end)
+{
+#if defined(__SSE2__)
+    while (end - begin >= 16) {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        __m128i matches = _mm_setzero_si128();
+        ((matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(Chars)))), ...);
+        const int mask = _mm_movemask_epi8(matches);
+        if (mask) {
+            return begin + __builtin_ctz(unsigned(mask));
+        }
+        begin += 16;
+    }
+#elif defined(__ARM_NEON)
+    while (end - begin >= 16) {
+        const uint8x16_t chunk = vld1q_u8(reinterpret_cast<const uint8_t*>(begin));
+        uint8x16_t matches = vdupq_n_u8(0);
+        ((matches = vorrq_u8(matches, vceqq_u8(chunk, vdupq_n_u8(uint8_t(Chars))))), ...);
+        // No movemask on NEON, so narrow it to four bits per byte instead
+        const uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(matches), 4)), 0);
+        if (mask) {
+            return begin + __builtin_ctzll(mask) / 4;
+        }
+        begin += 16;
+    }
+#endif
+    for (; begin < end; begin++) {
+        if (isAnyOf<Chars...>(*begin)) {
+            return begin;
+        }
+    }
+    return end;
+}
+
+// Returns a pointer to the first byte with the top bit set, or end
+inline const uint8_t *findNonAscii(const uint8_t *begin, const uint8_t *end)
+{
+#if defined(__AVX2__)
+    while (end - begin >= 32) {
+        const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        const unsigned mask = unsigned(_mm256_movemask_epi8(chunk));
+        if (mask) {
+            return begin + __builtin_ctz(mask);
+        }
+        begin += 32;
+    }
+#endif
+#if defined(__SSE2__)
+    while (end - begin >= 16) {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        const int mask = _mm_movemask_epi8(chunk);
+        if (mask) {
+            return begin + __builtin_ctz(unsigned(mask));
+        }
+        begin += 16;
+    }
+#elif defined(__ARM_NEON)
+    while (end - begin >= 16) {
+        const uint8x16_t chunk = vld1q_u8(begin);
+        // Same as in findAny(), four bits per byte
+        const uint8x16_t high = vcgeq_u8(chunk, vdupq_n_u8(0x80));
+        const uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(high), 4)), 0);
+        if (mask) {
+            return begin + __builtin_ctzll(mask) / 4;
+        }
+        begin += 16;
+    }
+#endif
+    for (; begin < end; begin++) {
+        if (*begin & 0x80) {
+            return begin;
+        }
+    }
+    return end;
+}
+
+// Checks that it's UTF-8 as RFC 3629 has it: no overlong encodings, no
+// surrogates and nothing past U+10FFFF. What we get is almost all ASCII, so
+// that is skipped in bulk with findNonAscii(). Only that part is SIMD, the
+// multi-byte sequences are checked one at a time with plain scalar code.
+inline bool isValidUtf8(const char *text, size_t size)
+{
+    const uint8_t *pos = reinterpret_cast<const uint8_t*>(text);
+    const uint8_t *end = pos + size;
+    pos = findNonAscii(pos, end);
+    while (pos != end) {
+        const uint8_t lead = *pos;
+        size_t length = 0;
+        // The valid range for the second byte depends on the first
+        uint8_t low = 0x80, high = 0xBF;
+        if (lead < 0xC2) { // stray continuation byte or overlong
+            return false;
+        } else if (lead < 0xE0) {
+            length = 2;
+        } else if (lead < 0xF0) {
+            length = 3;
+            if (lead == 0xE0) {
+                low = 0xA0; // overlong
+            } else if (lead == 0xED) {
+                high = 0x9F; // surrogates
+            }
+        } else if (lead < 0xF5) {
+            length = 4;
+            if (lead == 0xF0) {
+                low = 0x90; // overlong
+            } else if (lead == 0xF4) {
+                high = 0x8F; // past U+10FFFF
+            }
+        } else {
+            return false;
+        }
+        if (size_t(end - pos) < length || pos[1] < low || pos[1] > high) {
+            return false;
+        }
+        for (size_t i=2; i<length; i++) {
+            if ((pos[i] & 0xC0) != 0x80) {
+                return false;
+            }
+        }
+        pos += length;
+        // Non-ASCII text tends to come in runs, only go back to skipping
+        // in bulk once we hit ASCII again
+        if (pos != end && *pos < 0x80) {
+            pos = findNonAscii(pos, end);
+        }
+    }
+    return true;
+}
+
+} // namespace simd
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "globals.h"
+
+#include <algorithm>
+#include <vector>
+
+// Segments can overlap or touch (several people submit the same sponsor
+// with slightly different boundaries, or intro + sponsor back to back), so
+// we merge them up front. Then one seek always gets us out of everything
+// in a row, instead of landing inside the next segment and waiting for
+// the seek throttle before skipping again.
+class SkipPlan
+{
+public:
+    SkipPlan() = default;
+
+    SkipPlan(std::vector<Segment> segments)
+    {
+        compile(std::move(segments));
+    }
+
+    void compile(std::vector<Segment> segments)
+    {
+        m_segments.clear();
+        m_cursor = 0;
+
+        std::sort(segments.begin(), segments.end(), [](const Segment &a, const Segment &b) {
+            return a.begin < b.begin;
+        });
+        for (const Segment &segment : segments) {
+            if (!(segment.end > segment.begin)) { // also catches NaN
+                continue;
+            }
+            // We only know the position to the second, so a gap smaller
+            // than that can't be played anyways
+            if (!m_segments.empty() && segment.begin - m_segments.back().end < SKIP_MERGE_GAP) {
+                m_segments.back().end = std::max(m_segments.back().end, segment.end);
+                continue;
+            }
+            m_segments.push_back(segment);
+        }
+    }
+
+    // The segment we're inside of, or the next one coming up, or nullptr
+    // if there's nothing left to skip. A segment includes its beginning but
+    // not its end, which is where we seek to.
+    const Segment *next(const double position) const
+    {
+        if (position < 0 || m_segments.empty()) {
+            return nullptr;
+        }
+        // We usually just move forward, so walking from where we were last
+        // time is normally zero or one step. Fall back to a binary search if
+        // the user seeked backwards or far ahead.
+        if (m_cursor > 0 && m_segments[m_cursor - 1].end > position) {
+            m_cursor = findFirstEndingAfter(position);
+        } else {
+            for (int steps = 0; m_cursor < m_segments.size() && m_segments[m_cursor].end <= position; steps++) {
+                if (steps == 2) {
+                    m_cursor = findFirstEndingAfter(position);
+                    break;
+                }
+                m_cursor++;
+            }
+        }
+        if (m_cursor >= m_segments.size()) {
+            return nullptr;
+        }
+        return &m_segments[m_cursor];
+    }
+
+    // The segment we're inside of, or nullptr
+    const Segment *containing(const double position) const
+    {
+        const Segment *segment = next(position);
+        if (!segment || segment->begin > position) {
+            return nullptr;
+        }
+        return segment;
+    }
+
+    bool empty() const { return m_segments.empty(); }
+    size_t size() const { return m_segments.size(); }
+    std::vector<Segment>::const_iterator begin() const { return m_segments.begin(); }
+    std::vector<Segment>::const_iterator end() const { return m_segments.end(); }
+
+private:
+    size_t findFirstEndingAfter(const double position) const
+    {
+        // Merged segments are sorted by end as well as by beginning
+        return std::upper_bound(m_segments.begin(), m_segments.end(), position, [](const double value, const Segment &segment) {
+            return value < segment.end;
+        }) - m_segments.begin();
+    }
+
+    std::vector<Segment> m_segments;
+    mutable size_t m_cursor = 0;
+};
@@ -1,65 +1,499 @@
 #pragma once
+
+#include "globals.h"
+#include "http.h"
+#include "simd.h"
+#include "sha256.h"
+
 #include <iostream>
-#include <regex>
+#include <cstring>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace sponsor
+{
+
+enum class Category : uint8_t {
+    Unknown,
+    Sponsor,
+    SelfPromo,
+    Interaction,
+    Intro,
+    Outro,
+    Preview,
+    MusicOfftopic,
+    Filler,
+    PoiHighlight,
+    ExclusiveAccess,
+    Chapter
+};
+static const char *categoryNames[] = {
+    "unknown",
+    "sponsor",
+    "selfpromo",
+    "interaction",
+    "intro",
+    "outro",
+    "preview",
+    "music_offtopic",
+    "filler",
+    "poi_highlight",
+    "exclusive_access",
+    "chapter"
+};
+
+enum class ActionType : uint8_t {
+    Unknown,
+    Skip,
+    Mute,
+    Full,
+    Poi,
+    Chapter
+};
+static const char *actionTypeNames[] = {
+    "unknown",
+    "skip",
+    "mute",
+    "full",
+    "poi",
+    "chapter"
+};
+
+template<typename Enum, size_t Count>
+Enum fromName(const char *(&names)[Count], const std::string_view name)
+{
+    for (size_t i=1; i<Count; i++) {
+        if (name == names[i]) {
+            return Enum(i);
+        }
+    }
+    return Enum(0);
+}
 
-static std::vector<double> splitToDouble(std::string string)
+struct Record
 {
-    for (char &c : string) {
-        if (c == ',') {
-            c = ' ';
+    Segment segment;
+    Category category = Category::Unknown;
+    ActionType actionType = ActionType::Skip; // older responses don't have it
+    std::string uuid;
+    std::string videoId; // from the enclosing object, in hash prefix responses
+    double videoDuration = 0.; // 0 if the submitter didn't know
+};
+
+// Incremental JSON parser for the skipSegments responses, it can be fed the
+// body in whatever pieces it arrives in off the socket. It understands JSON
+// in general, but only keeps the objects that have a "segment" array, and
+// skips the contents of every string it doesn't care about (most of the
+// bytes are UUIDs, hashes and descriptions) with simd::findAny().
+class Parser
+{
+public:
+    explicit Parser(std::vector<Record> *records) :
+        m_records(records)
+    {
+    }
+
+    // Returns false on invalid JSON
+    bool feed(const char *data, const size_t size)
+    {
+        const char *pos = data;
+        const char *end = data + size;
+        while (pos < end && !m_error) {
+            if (m_inString) {
+                if (m_escape) {
+                    capture(pos, pos + 1);
+                    m_escape = false;
+                    pos++;
+                    continue;
+                }
+                const char *next = simd::findAny<'"', '\\'>(pos, end);
+                capture(pos, next);
+                if (next == end) {
+                    break;
+                }
+                if (*next == '\\') {
+                    capture(next, next + 1);
+                    m_escape = true;
+                } else {
+                    m_inString = false;
+                    endString();
+                }
+                pos = next + 1;
+                continue;
+            }
+
+            const char *next = simd::findAny<'"', '{', '}', '[', ']', ':', ','>(pos, end);
+            // Numbers, literals and whitespace
+            for (; pos < next; pos++) {
+                if (*pos == ' ' || *pos == '\n' || *pos == '\r' || *pos == '\t') {
+                    continue;
+                }
+                if (m_tokenLength >= sizeof m_token - 1) {
+                    m_error = true;
+                    return false;
+                }
+                m_token[m_tokenLength++] = *pos;
+            }
+            if (next == end) {
+                break;
+            }
+            endToken();
+            structural(*next);
+            pos = next + 1;
+        }
+        return !m_error;
+    }
+
+    // Returns false if the document is invalid or incomplete
+    bool finish()
+    {
+        if (!m_error && !m_inString) {
+            endToken();
+        }
+        return !m_error && !m_inString && m_depth == 0 && m_started;
+    }
+
+private:
+    static constexpr int MaxDepth = 32;
+
+    enum Key : uint8_t {
+        OtherKey,
+        CategoryKey,
+        ActionTypeKey,
+        UuidKey,
+        VideoIdKey,
+        VideoDurationKey,
+        SegmentKey
+    };
+
+    enum StringTarget : uint8_t {
+        Ignored,
+        KeyName,
+        CategoryValue,
+        ActionTypeValue,
+        UuidValue,
+        VideoIdValue
+    };
+
+    struct Level {
+        bool object = false;
+        Key key = OtherKey;
+        bool segmentArray = false;
+        int segmentValues = 0;
+
+        // Only used for objects
+        Record record;
+        bool hasSegment = false;
+    };
+
+    static Key keyFromName(const std::string_view name)
+    {
+        if (name == "category") return CategoryKey;
+        if (name == "actionType") return ActionTypeKey;
+        if (name == "UUID") return UuidKey;
+        if (name == "videoID") return VideoIdKey;
+        if (name == "videoDuration") return VideoDurationKey;
+        if (name == "segment") return SegmentKey;
+        return OtherKey;
+    }
+
+    Level *top()
+    {
+        return m_depth > 0 ? &m_levels[m_depth - 1] : nullptr;
+    }
+
+    void capture(const char *begin, const char *end)
+    {
+        if (m_target != Ignored) {
+            m_string.append(begin, end);
         }
     }
 
-    std::vector<double> ret;
-    const char *begin = string.c_str();
-    char* end = nullptr;
-    for (double timestamp = std::strtod(begin, &end); begin != end; timestamp = std::strtod(begin, &end)) {
-        begin = end;
-        if (errno == ERANGE){
-            std::cout << "range error, got " << timestamp << '\n';
-            errno = 0;
-            return {};
-        }
-        ret.push_back(timestamp);
+    bool push(const bool object)
+    {
+        if (m_depth >= MaxDepth) {
+            m_error = true;
+            return false;
+        }
+        Level &level = m_levels[m_depth++];
+        level.object = object;
+        level.key = OtherKey;
+        level.segmentArray = false;
+        level.segmentValues = 0;
+        level.hasSegment = false;
+        if (object) {
+            level.record = Record();
+        }
+        m_started = true;
+        return true;
+    }
+
+    void structural(const char c)
+    {
+        Level *level = top();
+        switch(c) {
+        case '{':
+            if (!level && m_started) {
+                m_error = true;
+                return;
+            }
+            push(true);
+            m_expectKey = true;
+            break;
+        case '[': {
+            if (!level && m_started) {
+                m_error = true;
+                return;
+            }
+            const bool segmentArray = level && level->object && level->key == SegmentKey;
+            if (!push(false)) {
+                return;
+            }
+            top()->segmentArray = segmentArray;
+            m_expectKey = false;
+            break;
+        }
+        case '}':
+            if (!level || !level->object) {
+                m_error = true;
+                return;
+            }
+            if (level->hasSegment) {
+                emit();
+            }
+            m_depth--;
+            m_expectKey = false;
+            break;
+        case ']':
+            if (!level || level->object) {
+                m_error = true;
+                return;
+            }
+            m_depth--;
+            if (level->segmentArray && level->segmentValues == 2) {
+                top()->hasSegment = true;
+            }
+            m_expectKey = false;
+            break;
+        case ',':
+            if (!level) {
+                m_error = true;
+                return;
+            }
+            m_expectKey = level->object;
+            break;
+        case ':':
+            m_expectKey = false;
+            break;
+        case '"':
+            m_inString = true;
+            m_string.clear();
+            if (m_expectKey) {
+                m_target = KeyName;
+            } else if (level && level->object) {
+                switch(level->key) {
+                case CategoryKey: m_target = CategoryValue; break;
+                case ActionTypeKey: m_target = ActionTypeValue; break;
+                case UuidKey: m_target = UuidValue; break;
+                case VideoIdKey: m_target = VideoIdValue; break;
+                default: m_target = Ignored; break;
+                }
+            } else {
+                m_target = Ignored;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    void endString()
+    {
+        Level *level = top();
+        if (!level) { // a bare string as the whole document
+            m_error = true;
+            return;
+        }
+        switch(m_target) {
+        case KeyName:
+            level->key = keyFromName(m_string);
+            m_expectKey = false;
+            break;
+        case CategoryValue:
+            level->record.category = fromName<Category>(categoryNames, m_string);
+            break;
+        case ActionTypeValue:
+            level->record.actionType = fromName<ActionType>(actionTypeNames, m_string);
+            break;
+        case UuidValue:
+            level->record.uuid = m_string;
+            break;
+        case VideoIdValue:
+            level->record.videoId = m_string;
+            break;
+        default:
+            break;
+        }
+        m_target = Ignored;
+    }
+
+    void endToken()
+    {
+        if (m_tokenLength == 0) {
+            return;
+        }
+        Level *level = top();
+        const size_t length = m_tokenLength;
+        m_tokenLength = 0;
+        if (!level || m_expectKey) {
+            m_error = true;
+            return;
+        }
+
+        const bool isSegmentValue = level->segmentArray;
+        const bool isDuration = level->object && level->key == VideoDurationKey;
+        if (!isSegmentValue && !isDuration) {
+            return;
+        }
+
+        m_token[length] = '\0';
+        char *numberEnd = nullptr;
+        const double number = strtod(m_token, &numberEnd);
+        if (numberEnd != m_token + length) {
+            m_error = true;
+            return;
+        }
+        if (isDuration) {
+            level->record.videoDuration = number;
+            return;
+        }
+        Record &record = m_levels[m_depth - 2].record;
+        if (level->segmentValues == 0) {
+            record.segment.begin = number;
+        } else if (level->segmentValues == 1) {
+            record.segment.end = number;
+        }
+        level->segmentValues++;
+    }
+
+    void emit()
+    {
+        Level &level = m_levels[m_depth - 1];
+        if (level.record.videoId.empty()) {
+            for (int i=m_depth - 2; i>=0; i--) {
+                if (m_levels[i].object && !m_levels[i].record.videoId.empty()) {
+                    level.record.videoId = m_levels[i].record.videoId;
+                    break;
+                }
+            }
+        }
+        m_records->push_back(std::move(level.record));
+        level.record = Record();
+    }
+
+    std::vector<Record> *m_records;
+
+    Level m_levels[MaxDepth];
+    int m_depth = 0;
+    bool m_started = false;
+    bool m_expectKey = false;
+    bool m_error = false;
+
+    bool m_inString = false;
+    bool m_escape = false;
+    StringTarget m_target = Ignored;
+    std::string m_string;
+
+    char m_token[64];
+    size_t m_tokenLength = 0;
+};
+
+// Only the ones for this video that we should actually seek past, the rest
+// are e. g. chapters, or other videos in the same hash prefix bucket
+inline std::vector<Segment> skippable(const std::vector<Record> &records, const std::string &videoId)
+{
+    std::vector<Segment> ret;
+    ret.reserve(records.size());
+    for (const Record &record : records) {
+        if (record.actionType == ActionType::Skip && (record.videoId.empty() || record.videoId == videoId)) {
+            ret.push_back(record.segment);
+        }
     }
     return ret;
 }
 
-std::vector<Segment> downloadSegments(const std::string &videoId)
+static const char *apiHost = "sponsor.ajay.app";
+static constexpr int apiPort = 443;
+
+// Asks for the segments in the background. done gets false if we couldn't
+// get an answer, and true with no records if there is nothing to skip.
+// Returns the request ID, for cancelling it.
+//
+// We only send the first few characters of the SHA-256 of the video ID, so
+// the server doesn't know exactly what we're watching. The records for all
+// the other videos in the same bucket are returned as well (with videoId
+// set), they're useful for the cache.
+inline uint64_t lookup(http::Client *client, const std::string &videoId, std::function<void(bool ok, const std::vector<Record> &records)> done)
 {
-    if (videoId.empty()) {
-        puts("Got empty videoId");
-        return {};
-    }
-    std::string query = "?videoID=" + videoId;
+    const std::string prefix = sha256::toHex(sha256::hash(videoId)).substr(0, SPONSOR_HASH_PREFIX);
+    std::string query;
     for (const std::string &category : s_categories) {
-        query += "&category=" + category;
+        query += (query.empty() ? "?category=" : "&category=") + category;
     }
 
-    std::string json = downloadFile("sponsor.ajay.app", 443, "/api/skipSegments" + query);
-    if (json.empty()) {
-        puts("Failed to download segments to skip");
-        return {};
-    }
+    // Parser points into it, so it can't move
+    struct State {
+        std::vector<Record> records;
+        Parser parser{&records};
+        bool valid = true;
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
 
-    std::regex segmentsRegex(R"--("segment"\s*:\[([^\]]+)\])--");
-    std::vector<Segment> segments;
-    std::sregex_iterator it = std::sregex_iterator(json.begin(), json.end(), segmentsRegex);
-    for (; it != std::sregex_iterator(); it++) {
-        const std::smatch match = *it;
-        std::string segmentsArray = match[1].str();
-        std::vector<double> numbers = splitToDouble(segmentsArray);
-        if (numbers.size() != 2) {
-            std::cout << "Invalid segment " << segmentsArray << std::endl;
-            return {};
-        }
-        if (s_verbose) {
-            std::cout << "Got segment " << numbers[0] << " -> " << numbers[1] << std::endl;
-        }
-        segments.push_back({numbers[0], numbers[1]});
-    }
-    std::cout << " - Got " << segments.size() << " skip segments for " << videoId << std::endl;
+    return client->get(apiHost, apiPort, "/api/skipSegments/" + prefix + query, [state](const char *data, size_t size) {
+        state->valid = state->parser.feed(data, size);
+        return state->valid;
+    }, [state, videoId, done](const int status) {
+        std::vector<Record> &records = state->records;
+        if (status == 404) { // It's what it says when there's nothing to skip
+            std::cout << " - No skip segments for " << videoId << std::endl;
+            records.clear();
+            done(true, records);
+            return;
+        }
+        if (status != 200) {
+            puts("Failed to download segments to skip");
+            records.clear();
+            done(false, records);
+            return;
+        }
+        if (!state->valid || !state->parser.finish()) {
+            puts("Invalid JSON in list of segments to skip");
+            records.clear();
+            done(false, records);
+            return;
+        }
 
-    return segments;
+        size_t count = 0;
+        for (const Record &record : records) {
+            if (!record.videoId.empty() && record.videoId != videoId) {
+                continue;
+            }
+            count++;
+            if (s_verbose) {
+                std::cout << "Got segment " << record.segment.begin << " -> " << record.segment.end
+                    << " (" << categoryNames[int(record.category)] << ", " << actionTypeNames[int(record.actionType)] << ")" << std::endl;
+            }
+        }
+        std::cout << " - Got " << count << " skip segments for " << videoId;
+        if (count != records.size()) {
+            std::cout << " (and " << records.size() - count << " for other videos)";
+        }
+        std::cout << std::endl;
+        done(true, records);
+    });
 }
 
+} // namespace sponsor
@@ -18,6 +18,7 @@ static SSL_CTX *(*EXT_SSL_CTX_new)(const SSL_METHOD *) = nullptr;
 static SSL_METHOD * (*EXT_TLS_client_method) () = NULL;
 static int (*EXT_SSL_connect)     (SSL *) = nullptr;
 static int (*EXT_SSL_get_error) (SSL*, int) = nullptr;
+static int (*EXT_SSL_pending)     (const SSL *) = nullptr;
 static int (*EXT_SSL_read)        (SSL *, void *, int) = nullptr;
 static int (*EXT_SSL_set_fd)      (SSL *, int) = nullptr;
 static int (*EXT_SSL_write)       (SSL *, const void *, int) = nullptr;
@@ -36,6 +37,7 @@ static bool resolveSymbols(void *libHandle)
     RESOLVE_SYMBOL(SSL_CTX*, SSL_CTX_new, const SSL_METHOD*);
     RESOLVE_SYMBOL(int, SSL_connect, SSL*);
     RESOLVE_SYMBOL(int, SSL_get_error, SSL*, int);
+    RESOLVE_SYMBOL(int, SSL_pending, const SSL*);
     RESOLVE_SYMBOL(int, SSL_read, SSL*, void*, int);
     RESOLVE_SYMBOL(int, SSL_set_fd, SSL*, int);
     RESOLVE_SYMBOL(int, SSL_write, SSL*, const void*, int);
@@ -55,6 +57,7 @@ static bool resolveSymbols(void *libHandle)
         EXT_SSL_free &&
         EXT_SSL_get_error &&
         EXT_SSL_new &&
+        EXT_SSL_pending &&
         EXT_SSL_read &&
         EXT_SSL_write &&
         EXT_SSL_set_fd &&
@@ -99,6 +102,7 @@ static bool attemptOpen(const std::string &file)
         EXT_SSL_free = nullptr;
         EXT_SSL_get_error = nullptr;
         EXT_SSL_new = nullptr;
+        EXT_SSL_pending = nullptr;
         EXT_SSL_read = nullptr;
         EXT_SSL_write = nullptr;
         EXT_SSL_set_fd = nullptr;
@@ -180,6 +184,11 @@ SSL *SSL_new(SSL_CTX *ctx)
     return (SSL*)EXT_SSL_new((::SSL_CTX*)ctx);
 }
 
+int SSL_pending(const SSL *ssl)
+{
+    return EXT_SSL_pending((const ::SSL*)ssl);
+}
+
 int SSL_read(SSL *ssl, void *buf, int num)
 {
     return EXT_SSL_read((::SSL*)ssl, buf, num);
@@ -9,6 +9,11 @@ namespace ssl
 
     static constexpr int SSL_VERIFY_NONE = 0;
 
+    static constexpr int SSL_ERROR_WANT_READ = 2;
+    static constexpr int SSL_ERROR_WANT_WRITE = 3;
+    static constexpr int SSL_ERROR_SYSCALL = 5;
+    static constexpr int SSL_ERROR_ZERO_RETURN = 6;
+
     bool initialize();
 
     void SSL_CTX_free(SSL_CTX *ctx);
@@ -18,6 +23,7 @@ namespace ssl
     void SSL_free(SSL *ssl);
     int SSL_get_error(SSL *ssl, int rc);
     SSL *SSL_new(SSL_CTX *ctx);
+    int SSL_pending(const SSL *ssl);
     int SSL_read(SSL *ssl, void *buf, int num);
     int SSL_set_fd(SSL *ssl, int fd);
     int SSL_write(SSL *ssl, const void *buf, int num);
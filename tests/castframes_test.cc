@@ -0,0 +1,73 @@
+// Frames from FrameWriter parsed back, from tiny ones up to the biggest a
+// chromecast takes.
+
+#include "castframes.h"
+#include "check.h"
+
+#include <string>
+
+// Checks the frame length and that it parses, returns the payload
+static std::string parseFrame(const std::basic_string_view<uint8_t> frame)
+{
+    CHECK(frame.size() > sizeof(uint32_t));
+    if (frame.size() <= sizeof(uint32_t)) {
+        return "";
+    }
+    uint32_t length = 0;
+    memcpy(&length, frame.data(), sizeof length);
+    CHECK(ntohl(length) == frame.size() - sizeof(uint32_t));
+
+    CastMessageView message;
+    CHECK(message.parse(frame.data() + sizeof(uint32_t), frame.size() - sizeof(uint32_t)));
+    CHECK(message._namespace_id == cc::ns::Media);
+    CHECK(message._source_id == "sender-0");
+    CHECK(message._destination_id == "session-1");
+    return std::string(message._payload_utf8);
+}
+
+static std::string write(cc::FrameTemplates *templates, const std::string &text)
+{
+    cc::FrameWriter writer(templates->header("session-1", cc::ns::Media));
+    writer.append(text);
+    return parseFrame(writer.finish());
+}
+
+int main()
+{
+    cc::FrameTemplates templates;
+
+    CHECK(write(&templates, "{\"type\": \"GET_STATUS\"}") == "{\"type\": \"GET_STATUS\"}");
+
+    // Around where it moves to the heap, and where the payload length gets longer
+    for (const size_t size : { size_t(100), size_t(127), size_t(128), size_t(2000), size_t(2048), size_t(3000), size_t(16383), size_t(16384), size_t(60000) }) {
+        const std::string payload(size, 'x');
+        CHECK(write(&templates, payload) == payload);
+    }
+
+    // Numbers after it moved
+    {
+        cc::FrameWriter writer(templates.header("session-1", cc::ns::Media));
+        writer.append(std::string(3000, 'x')).append(-2147483647 - 1).append(" ").append(1e300);
+        const std::string payload = parseFrame(writer.finish());
+        CHECK(payload == std::string(3000, 'x') + std::to_string(-2147483647 - 1) + " " + std::to_string(1e300));
+    }
+
+    // The biggest that fits, and one byte more
+    const size_t headerSize = templates.header("session-1", cc::ns::Media).size();
+    const size_t maxPayload = cc::FrameWriter::MaxMessageSize - headerSize - 3;
+    CHECK(write(&templates, std::string(maxPayload, 'x')).size() == maxPayload);
+    {
+        cc::FrameWriter writer(templates.header("session-1", cc::ns::Media));
+        writer.append(std::string(maxPayload + 1, 'x'));
+        CHECK(writer.finish().empty());
+    }
+
+    // Way too big fails without writing anywhere it shouldn't
+    {
+        cc::FrameWriter writer(templates.header("session-1", cc::ns::Media));
+        writer.append(std::string(100000, 'x')).append(1).append(1.);
+        CHECK(writer.finish().empty());
+    }
+
+    return checkResult("castframes");
+}
@@ -0,0 +1,56 @@
+// Numbers in the payload that don't fit in the ints they go in are left out,
+// instead of being converted into whatever. Same for a media session ID that
+// isn't just digits, since that one is sent back as it is.
+
+#include "castjson.h"
+#include "check.h"
+
+#include <string>
+
+static cc::PayloadFields scan(const std::string &payload)
+{
+    cc::PayloadFields fields;
+    CHECK(cc::scanPayload(payload, &fields));
+    return fields;
+}
+
+static std::string withIds(const std::string &currentItemId, const std::string &itemId, const std::string &playerState)
+{
+    return "{\"type\":\"MEDIA_STATUS\",\"status\":[{\"currentItemId\":" + currentItemId +
+        ",\"items\":[{\"itemId\":" + itemId + ",\"media\":{\"contentId\":\"dQw4w9WgXcQ\"}}]" +
+        ",\"customData\":{\"playerState\":" + playerState + "}}]}";
+}
+
+int main()
+{
+    cc::PayloadFields fields = scan(withIds("7", "-3", "1081"));
+    CHECK(fields.currentItemId == 7);
+    CHECK(fields.queueItemCount == 1 && fields.queueItems[0].itemId == -3);
+    CHECK(fields.hasCustomPlayerState && fields.customPlayerState == 1081);
+
+    // The largest and smallest that fit
+    fields = scan(withIds("2147483647", "-2147483648", "1e3"));
+    CHECK(fields.currentItemId == 2147483647);
+    CHECK(fields.queueItems[0].itemId == -2147483648);
+    CHECK(fields.hasCustomPlayerState && fields.customPlayerState == 1000);
+
+    for (const char *number : { "2147483648", "-2147483649", "1e300", "-1e300", "1e400", "1.5", "-" }) {
+        fields = scan(withIds(number, number, number));
+        CHECK(fields.currentItemId == -1);
+        CHECK(fields.queueItemCount == 1 && fields.queueItems[0].itemId == -1);
+        CHECK(!fields.hasCustomPlayerState);
+    }
+
+    // A broken one doesn't hide a good one later on
+    fields = scan("{\"playerState\":1e99,\"customData\":{\"playerState\":1081}}");
+    CHECK(fields.hasCustomPlayerState && fields.customPlayerState == 1081);
+
+    // Only digits for the media session, the first one that is
+    CHECK(scan("{\"mediaSessionId\":1234}").mediaSessionId == "1234");
+    for (const char *id : { "-1", "1e5", "1.5", "+1", "-" }) {
+        CHECK(scan(std::string("{\"mediaSessionId\":") + id + "}").mediaSessionId.empty());
+    }
+    CHECK(scan("{\"mediaSessionId\":-1e5,\"status\":[{\"mediaSessionId\":7}]}").mediaSessionId == "7");
+
+    return checkResult("castjson");
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdio>
+
+// Just enough to not need a test framework: every failed check is printed,
+// and the test fails at the end if there were any.
+static int s_failedChecks = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #condition); \
+        s_failedChecks++; \
+    } \
+} while (0)
+
+static int checkResult(const char *name)
+{
+    if (s_failedChecks) {
+        fprintf(stderr, "%s: %d checks failed\n", name, s_failedChecks);
+        return 1;
+    }
+    printf("%s: all good\n", name);
+    return 0;
+}
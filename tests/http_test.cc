@@ -0,0 +1,306 @@
+// The HTTP response decoding, fed the responses the way they can come off a
+// kept alive connection: split anywhere, or several in one read. Gzipped
+// ones too, and what happens to those when there's no zlib to load.
+
+#include "http.h"
+#include "check.h"
+
+#include <string>
+#include <vector>
+
+struct Response
+{
+    int status = -1;
+    std::string body;
+    bool keepAlive = false;
+};
+
+// Like the client does it, one decoder for the connection that is reset
+// after each response. Returns false if any of it was invalid.
+static bool decode(const std::string &stream, const std::vector<size_t> &splits, std::vector<Response> *responses, const bool closed = false)
+{
+    responses->clear();
+    http::ResponseDecoder decoder;
+    Response current;
+    const http::DataCallback onData = [&](const char *data, size_t size) {
+        current.body.append(data, size);
+        return true;
+    };
+
+    size_t start = 0;
+    std::vector<size_t> ends = splits;
+    ends.push_back(stream.size());
+    for (const size_t end : ends) {
+        size_t offset = start;
+        while (offset < end) {
+            size_t consumed = 0;
+            if (!decoder.feed(stream.data() + offset, end - offset, onData, &consumed)) {
+                return false;
+            }
+            offset += consumed;
+            if (decoder.isDone()) {
+                current.status = decoder.status;
+                current.keepAlive = decoder.keepAlive;
+                responses->push_back(current);
+                current = Response();
+                decoder.reset();
+            }
+        }
+        start = end;
+    }
+    if (closed && decoder.isStarted()) {
+        if (!decoder.finish()) {
+            return false;
+        }
+        current.status = decoder.status;
+        current.keepAlive = decoder.keepAlive;
+        responses->push_back(current);
+    }
+    return true;
+}
+
+// Split in two at every offset, and in pieces of every size up to a few
+static void checkEverySplit(const std::string &stream, const std::vector<Response> &expected, const bool closed = false)
+{
+    std::vector<std::vector<size_t>> allSplits;
+    for (size_t split=0; split<=stream.size(); split++) {
+        allSplits.push_back({split});
+    }
+    for (size_t pieceSize=1; pieceSize<8; pieceSize++) {
+        std::vector<size_t> splits;
+        for (size_t split=pieceSize; split<stream.size(); split += pieceSize) {
+            splits.push_back(split);
+        }
+        allSplits.push_back(splits);
+    }
+
+    for (const std::vector<size_t> &splits : allSplits) {
+        std::vector<Response> responses;
+        CHECK(decode(stream, splits, &responses, closed));
+        CHECK(responses.size() == expected.size());
+        if (responses.size() != expected.size()) {
+            return;
+        }
+        for (size_t i=0; i<expected.size(); i++) {
+            CHECK(responses[i].status == expected[i].status);
+            CHECK(responses[i].body == expected[i].body);
+            CHECK(responses[i].keepAlive == expected[i].keepAlive);
+        }
+    }
+}
+
+static void testContentLength()
+{
+    const std::string response =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: application/json\r\n"
+        "content-length: 13\r\n"
+        "\r\n"
+        "[{\"a\":\"b\"}]\r\n";
+    checkEverySplit(response, {{200, "[{\"a\":\"b\"}]\r\n", true}});
+
+    // The body can look like anything
+    checkEverySplit("HTTP/1.1 404 Not Found\r\nContent-Length: 8\r\n\r\n\r\n\r\nHTTP", {{404, "\r\n\r\nHTTP", true}});
+
+    // Nothing at all
+    checkEverySplit("HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n", {{200, "", true}});
+    checkEverySplit("HTTP/1.1 204 No Content\r\n\r\n", {{204, "", true}});
+
+    // The server says it won't take more
+    checkEverySplit("HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 2\r\n\r\nok", {{200, "ok", false}});
+    checkEverySplit("HTTP/1.0 200 OK\r\nContent-Length: 2\r\n\r\nok", {{200, "ok", false}});
+    checkEverySplit("HTTP/1.0 200 OK\r\nConnection: keep-alive\r\nContent-Length: 2\r\n\r\nok", {{200, "ok", true}});
+}
+
+static void testUntilClosed()
+{
+    // Without a length it's over when the connection is
+    const std::string response = "HTTP/1.1 200 OK\r\n\r\nall of this";
+    checkEverySplit(response, {{200, "all of this", false}}, true);
+
+    std::vector<Response> responses;
+    CHECK(decode(response, {}, &responses));
+    CHECK(responses.empty());
+
+    // Closed before the end of one with a length isn't a response
+    CHECK(!decode("HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\nshort", {}, &responses, true));
+}
+
+static void testChunked()
+{
+    const std::string response =
+        "HTTP/1.1 200 OK\r\n"
+        "Transfer-Encoding: chunked\r\n"
+        "\r\n"
+        "5\r\n"
+        "hello\r\n"
+        "1;name=value;other=\"quoted\"\r\n"
+        " \r\n"
+        "A \r\n"
+        "0123456789\r\n"
+        "0\r\n"
+        "X-Trailer: one\r\n"
+        "Another-Trailer: two\r\n"
+        "\r\n";
+    checkEverySplit(response, {{200, "hello 0123456789", true}});
+
+    // Upper case hex, and no trailers
+    checkEverySplit("HTTP/1.1 200 OK\r\ntransfer-encoding: Chunked\r\n\r\n1F\r\n" + std::string(31, 'x') + "\r\n0\r\n\r\n", {{200, std::string(31, 'x'), true}});
+
+    // Bare newlines, like some servers send
+    checkEverySplit("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n2\nok\n0\n\n", {{200, "ok", true}});
+
+    std::vector<Response> responses;
+    for (const char *invalid : {
+            "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n",
+            "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n2x\r\nok\r\n0\r\n\r\n",
+            "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n2\r\nokay\r\n0\r\n\r\n",
+    }) {
+        CHECK(!decode(invalid, {}, &responses));
+    }
+    // Chunk headers that never end
+    CHECK(!decode("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n1;" + std::string(2000, 'x'), {}, &responses));
+}
+
+static void testInformational()
+{
+    const std::string response =
+        "HTTP/1.1 100 Continue\r\n"
+        "\r\n"
+        "HTTP/1.1 103 Early Hints\r\n"
+        "Link: </style.css>; rel=preload\r\n"
+        "\r\n"
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Length: 4\r\n"
+        "\r\n"
+        "done";
+    checkEverySplit(response, {{200, "done", true}});
+}
+
+static void testPipelined()
+{
+    const std::string first = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nfirst";
+    const std::string second = "HTTP/1.1 404 Not Found\r\nTransfer-Encoding: chunked\r\n\r\n6\r\nsecond\r\n0\r\n\r\n";
+    const std::string third = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\nConnection: close\r\n\r\nthird";
+    checkEverySplit(first + second + third, {{200, "first", true}, {404, "second", true}, {200, "third", false}});
+
+    // Everything in one read, the decoder stops at the end of each one
+    std::vector<Response> responses;
+    CHECK(decode(first + second, {}, &responses));
+    CHECK(responses.size() == 2);
+
+    http::ResponseDecoder decoder;
+    size_t consumed = 0;
+    const std::string both = first + second;
+    CHECK(decoder.feed(both.data(), both.size(), [](const char*, size_t) { return true; }, &consumed));
+    CHECK(consumed == first.size());
+    CHECK(decoder.isDone() && decoder.status == 200);
+}
+
+static void testInvalid()
+{
+    std::vector<Response> responses;
+    CHECK(!decode("SSH-2.0-OpenSSH_9.6\r\n\r\n", {}, &responses));
+    CHECK(!decode("HTTP/1.1 200 OK\r\nContent-Encoding: br\r\nContent-Length: 1\r\n\r\nx", {}, &responses));
+
+    // A head that never ends
+    std::string huge = "HTTP/1.1 200 OK\r\n";
+    while (huge.size() < 70 * 1024) {
+        huge += "X-Padding: " + std::string(100, 'x') + "\r\n";
+    }
+    CHECK(!decode(huge, {}, &responses));
+
+    // And the body callback can stop it
+    http::ResponseDecoder decoder;
+    const std::string response = "HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\nnope";
+    size_t consumed = 0;
+    CHECK(!decoder.feed(response.data(), response.size(), [](const char*, size_t) { return false; }, &consumed));
+}
+
+// gzip -n of a skipSegments response
+static const std::string smallGzip(
+    "\x1f\x8b\x08\x00\x00\x00\x00\x00\x02\x03\x8b\xae\x56\x2a\xcb\x4c\x49\xcd\xf7\x74\x51\xb2\x52\x4a\x09\x2c"
+    "\x37\x29\xb7\x0c\x4f\x8f\x48\x0e\x54\xd2\x51\x2a\x4e\x4d\xcf\x4d\xcd\x2b\x29\x56\xb2\x8a\xae\x86\x71\x80"
+    "\x6c\x43\x3d\x53\x1d\x43\x03\x3d\x23\xd3\xd8\x5a\x20\x04\x00\x9f\x0b\xbb\x7e\x40\x00\x00\x00", 75);
+static const std::string smallBody = "[{\"videoID\":\"dQw4w9WgXcQ\",\"segments\":[{\"segment\":[1.5,10.25]}]}]";
+
+// And of 100000 'x's, a lot more than the inflater has room for at once
+static const std::string bigGzip =
+    std::string("\x1f\x8b\x08\x00\x00\x00\x00\x00\x02\x03\xed\xc1\x31\x01\x00\x00\x00\xc2\xa0\xda\x8b\x6f\x0d\x0f\xa0", 25) +
+    std::string(96, '\0') +
+    std::string("\x80\x57\x03\x71\x11\x07\xfe\xa0\x86\x01\x00", 11);
+static const std::string bigBody(100000, 'x');
+
+static std::string gzipped(const std::string &compressed)
+{
+    return "HTTP/1.1 200 OK\r\nContent-Encoding: gzip\r\nContent-Length: " + std::to_string(compressed.size()) + "\r\n\r\n" + compressed;
+}
+
+static std::string chunked(const std::string &body, const size_t chunkSize)
+{
+    std::string ret;
+    for (size_t i=0; i<body.size(); i += chunkSize) {
+        const std::string chunk = body.substr(i, chunkSize);
+        char size[32];
+        snprintf(size, sizeof size, "%zx\r\n", chunk.size());
+        ret += size + chunk + "\r\n";
+    }
+    return ret + "0\r\n\r\n";
+}
+
+// Has to run before zlib is loaded
+static void testGzipWithoutZlib()
+{
+    CHECK(!zlib::isLoaded());
+
+    // We don't ask for it then, but if a server sends it anyway it's an
+    // error, not garbage handed to the parser
+    std::vector<Response> responses;
+    CHECK(!decode(gzipped(smallGzip), {}, &responses));
+    CHECK(responses.empty());
+
+    // Everything else still works, also on the same connection afterwards
+    checkEverySplit("HTTP/1.1 200 OK\r\nContent-Encoding: identity\r\nContent-Length: 2\r\n\r\nok", {{200, "ok", true}});
+}
+
+static void testGzip()
+{
+    checkEverySplit(gzipped(smallGzip), {{200, smallBody, true}});
+    checkEverySplit(gzipped(bigGzip), {{200, bigBody, true}});
+
+    // Chunked, and until the connection closes
+    checkEverySplit("HTTP/1.1 200 OK\r\nContent-Encoding: gzip\r\nTransfer-Encoding: chunked\r\n\r\n" + chunked(bigGzip, 7), {{200, bigBody, true}});
+    checkEverySplit("HTTP/1.1 200 OK\r\nContent-Encoding: gzip\r\n\r\n" + smallGzip, {{200, smallBody, false}}, true);
+
+    // The inflater is reused for the next response on the connection, and
+    // plain ones in between don't confuse it
+    checkEverySplit(gzipped(smallGzip) + "HTTP/1.1 404 Not Found\r\nContent-Length: 9\r\n\r\nNot Found" + gzipped(bigGzip) + gzipped(smallGzip),
+            {{200, smallBody, true}, {404, "Not Found", true}, {200, bigBody, true}, {200, smallBody, true}});
+
+    // Cut off, or broken
+    std::vector<Response> responses;
+    CHECK(!decode(gzipped(smallGzip.substr(0, smallGzip.size() - 4)), {}, &responses));
+    CHECK(!decode("HTTP/1.1 200 OK\r\nContent-Encoding: gzip\r\n\r\n" + smallGzip.substr(0, 40), {}, &responses, true));
+    std::string broken = smallGzip;
+    broken[20] = char(~broken[20]);
+    CHECK(!decode(gzipped(broken), {}, &responses));
+    CHECK(!decode(gzipped("not gzip at all"), {}, &responses));
+}
+
+int main()
+{
+    testGzipWithoutZlib();
+    if (zlib::initialize()) {
+        testGzip();
+    } else {
+        puts("http: no zlib, skipping the gzip tests");
+    }
+
+    testContentLength();
+    testUntilClosed();
+    testChunked();
+    testInformational();
+    testPipelined();
+    testInvalid();
+    return checkResult("http");
+}
@@ -0,0 +1,279 @@
+// The browser against a stand-in chromecast on this machine, on a group and
+// port of its own so it doesn't bother (or hear) anything real.
+
+#include "mdns.h"
+#include "check.h"
+
+extern "C" {
+#include <arpa/inet.h>
+}
+
+static std::vector<uint8_t> encodeName(const std::string &name)
+{
+    std::vector<uint8_t> encoded;
+    size_t start = 0;
+    while (start < name.size()) {
+        size_t end = name.find('.', start);
+        if (end == std::string::npos) {
+            end = name.size();
+        }
+        encoded.push_back(uint8_t(end - start));
+        encoded.insert(encoded.end(), name.begin() + long(start), name.begin() + long(end));
+        start = end + 1;
+    }
+    encoded.push_back(0);
+    return encoded;
+}
+
+static void append16(std::vector<uint8_t> *packet, const uint16_t value)
+{
+    packet->push_back(uint8_t(value >> 8));
+    packet->push_back(uint8_t(value));
+}
+
+static void append32(std::vector<uint8_t> *packet, const uint32_t value)
+{
+    append16(packet, uint16_t(value >> 16));
+    append16(packet, uint16_t(value));
+}
+
+static void appendRecord(std::vector<uint8_t> *packet, const std::string &name, const uint16_t type, const uint32_t ttl, const std::vector<uint8_t> &data)
+{
+    const std::vector<uint8_t> encoded = encodeName(name);
+    packet->insert(packet->end(), encoded.begin(), encoded.end());
+    append16(packet, type);
+    append16(packet, dns::ClassIN);
+    append32(packet, ttl);
+    append16(packet, uint16_t(data.size()));
+    packet->insert(packet->end(), data.begin(), data.end());
+}
+
+// What a chromecast answers with: the PTR for the instance, and the SRV, TXT
+// and A records describing it
+static std::vector<uint8_t> announcement(const std::string &instance, const uint32_t ttl)
+{
+    const std::string fullName = instance + "." + std::string(mdns::queryName);
+    const std::string host = instance + ".local";
+
+    std::vector<uint8_t> packet;
+    append16(&packet, 0);
+    append16(&packet, 0x8400); // response, authoritative
+    append16(&packet, 0);
+    append16(&packet, 4);
+    append16(&packet, 0);
+    append16(&packet, 0);
+
+    appendRecord(&packet, std::string(mdns::queryName), dns::PTR, ttl, encodeName(fullName));
+
+    std::vector<uint8_t> srv;
+    append16(&srv, 0);
+    append16(&srv, 0);
+    append16(&srv, 8009);
+    const std::vector<uint8_t> target = encodeName(host);
+    srv.insert(srv.end(), target.begin(), target.end());
+    appendRecord(&packet, fullName, dns::SRV, ttl, srv);
+
+    std::vector<uint8_t> txt;
+    for (const std::string &entry : { "id=" + instance, std::string("fn=Test TV"), std::string("md=Test") }) {
+        txt.push_back(uint8_t(entry.size()));
+        txt.insert(txt.end(), entry.begin(), entry.end());
+    }
+    appendRecord(&packet, fullName, dns::TXT, ttl, txt);
+
+    std::vector<uint8_t> address(4);
+    inet_pton(AF_INET, "192.0.2.77", address.data());
+    appendRecord(&packet, host, dns::A, ttl, address);
+    return packet;
+}
+
+struct Query
+{
+    std::chrono::steady_clock::time_point time;
+    bool unicastResponse = false;
+    std::map<std::string, uint32_t> knownAnswers; // instance -> TTL
+};
+
+// Listens on the group like a chromecast would, and records the queries
+struct StandInDevice
+{
+    StandInDevice(reactor::Reactor *reactor, const std::vector<mdns::Interface> &interfaces, const mdns::Group &group) :
+        m_reactor(reactor),
+        m_group(group)
+    {
+        fd = mdns::openSocket(interfaces, group);
+        for (const mdns::Interface &interface : interfaces) {
+            if (interface.hasIpv4) {
+                m_interfaceIndex = interface.index;
+                break;
+            }
+        }
+        if (fd >= 0) {
+            reactor->watch(fd, reactor::Readable, [this](uint32_t) {
+                onPacket();
+            });
+        }
+    }
+
+    ~StandInDevice()
+    {
+        if (fd >= 0) {
+            m_reactor->unwatch(fd);
+            close(fd);
+        }
+    }
+
+    void onPacket()
+    {
+        uint8_t packet[9000];
+        iovec iov;
+        iov.iov_base = packet;
+        iov.iov_len = sizeof packet;
+        alignas(cmsghdr) uint8_t control[CMSG_SPACE(sizeof(in_pktinfo))];
+        msghdr message{};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof control;
+        const ssize_t size = recvmsg(fd, &message, 0);
+        if (size <= 0) {
+            return;
+        }
+        // The browser sends a copy on every interface, only count one of them
+        const cmsghdr *header = CMSG_FIRSTHDR(&message);
+        if (!header || header->cmsg_level != IPPROTO_IP || header->cmsg_type != IP_PKTINFO) {
+            return;
+        }
+        in_pktinfo info;
+        memcpy(&info, CMSG_DATA(header), sizeof info);
+        if (unsigned(info.ipi_ifindex) != m_interfaceIndex) {
+            return;
+        }
+
+        dns::Parser parser(packet, size_t(size));
+        if (!parser.isValid() || parser.header.isResponse()) { // our own answers come back too
+            return;
+        }
+        dns::Name name;
+        uint16_t type = 0, qclass = 0;
+        if (!parser.nextQuestion(&name, &type, &qclass) || !name.equals(mdns::queryName) || type != dns::PTR) {
+            return;
+        }
+        Query query;
+        query.time = std::chrono::steady_clock::now();
+        query.unicastResponse = qclass & dns::UnicastResponse;
+        dns::Record record;
+        while (parser.nextRecord(&record)) {
+            dns::Name instance;
+            if (record.type == dns::PTR && record.ptr(&instance)) {
+                query.knownAnswers[std::string(instance.firstLabel())] = record.ttl;
+            }
+        }
+        queries.push_back(query);
+
+        if (!reply.empty()) {
+            // Always multicast, a unicast reply could land on either of the
+            // two sockets sharing the port
+            mdns::sendData(fd, reply.data(), reply.size(), m_interfaceIndex, m_group);
+            reply.clear();
+        }
+    }
+
+    int fd = -1;
+    std::vector<Query> queries;
+    std::vector<uint8_t> reply; // sent once, for the next query
+
+private:
+    reactor::Reactor *m_reactor;
+    mdns::Group m_group;
+    unsigned m_interfaceIndex = 0;
+};
+
+static bool waitForQueries(reactor::Reactor *reactor, const StandInDevice &device, const size_t count)
+{
+    const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (device.queries.size() < count && std::chrono::steady_clock::now() < deadline) {
+        reactor->runOnce(50);
+    }
+    return device.queries.size() >= count;
+}
+
+static bool within(const std::chrono::steady_clock::duration duration, const int minMs, const int maxMs)
+{
+    return duration >= std::chrono::milliseconds(minMs) && duration <= std::chrono::milliseconds(maxMs);
+}
+
+int main()
+{
+    mdns::Group group;
+    group.address = "239.255.53.53";
+    group.port = uint16_t(20000 + getpid() % 30000);
+
+    const std::vector<mdns::Interface> interfaces = mdns::listInterfaces();
+    bool hasIpv4 = false;
+    for (const mdns::Interface &interface : interfaces) {
+        hasIpv4 = hasIpv4 || interface.hasIpv4;
+    }
+    if (!hasIpv4) {
+        puts("mdns: no IPv4 multicast interface, skipping");
+        return 77;
+    }
+
+    reactor::Reactor reactor;
+    StandInDevice device(&reactor, interfaces, group);
+    CHECK(device.fd >= 0);
+    device.reply = announcement("Test-1234", 120);
+
+    mdns::Browser browser;
+    browser.group = group;
+    CHECK(browser.open());
+    const std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    CHECK(browser.start(&reactor));
+
+    // The first one asks for a unicast response, and goes out after 20-120ms
+    CHECK(waitForQueries(&reactor, device, 1));
+    if (device.queries.size() < 1) {
+        return checkResult("mdns");
+    }
+    CHECK(device.queries[0].unicastResponse);
+    CHECK(device.queries[0].knownAnswers.empty());
+    CHECK(within(device.queries[0].time - started, 15, 300));
+
+    // Which the device answered, so it is known from now on
+    CHECK(waitForQueries(&reactor, device, 3));
+    if (device.queries.size() < 3) {
+        return checkResult("mdns");
+    }
+    CHECK(browser.find("Test-1234"));
+
+    // Then a second later, and two seconds after that
+    const std::chrono::steady_clock::duration firstInterval = device.queries[1].time - device.queries[0].time;
+    const std::chrono::steady_clock::duration secondInterval = device.queries[2].time - device.queries[1].time;
+    CHECK(within(firstInterval, 900, 1300));
+    CHECK(within(secondInterval, 1900, 2300));
+
+    // Those are the normal kind, and list what we know with the TTL it has left
+    for (size_t i=1; i<3; i++) {
+        CHECK(!device.queries[i].unicastResponse);
+        CHECK(device.queries[i].knownAnswers.size() == 1);
+        CHECK(device.queries[i].knownAnswers.count("Test-1234"));
+    }
+    const uint32_t ttl = device.queries[1].knownAnswers["Test-1234"];
+    const uint32_t laterTtl = device.queries[2].knownAnswers["Test-1234"];
+    CHECK(ttl >= 118 && ttl <= 120);
+    CHECK(laterTtl >= 116 && laterTtl < ttl);
+
+    // Starting over goes back to a quick unicast query and a second between them
+    const std::chrono::steady_clock::time_point requeried = std::chrono::steady_clock::now();
+    CHECK(browser.requery());
+    CHECK(browser.queryCount == 0);
+    CHECK(waitForQueries(&reactor, device, 5));
+    if (device.queries.size() < 5) {
+        return checkResult("mdns");
+    }
+    CHECK(device.queries[3].unicastResponse);
+    CHECK(within(device.queries[3].time - requeried, 15, 300));
+    CHECK(!device.queries[4].unicastResponse);
+    CHECK(within(device.queries[4].time - device.queries[3].time, 900, 1300));
+
+    return checkResult("mdns");
+}
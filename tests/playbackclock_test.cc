@@ -0,0 +1,160 @@
+// The playback clock with made up status updates, on a made up clock so it
+// doesn't depend on how fast this runs.
+
+#include "playbackclock.h"
+#include "check.h"
+
+#include <cmath>
+
+using Clock = PlaybackClock::Clock;
+
+static Clock::time_point at(const double seconds)
+{
+    return Clock::time_point() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds + 1000.));
+}
+
+static bool near(const double a, const double b, const double tolerance = 1e-6)
+{
+    return std::abs(a - b) <= tolerance;
+}
+
+static double secondsBetween(const Clock::time_point a, const Clock::time_point b)
+{
+    return std::chrono::duration<double>(b - a).count();
+}
+
+// A chromecast that runs at speed times the nominal rate, sending a status
+// every interval seconds from start until end
+static void play(PlaybackClock *clock, const double speed, const double rate, const double start, const double end, const double interval = 5.)
+{
+    for (double t=start; t<=end; t += interval) {
+        clock->update(t * speed * rate, rate, true, at(t));
+    }
+}
+
+static void testUnknown()
+{
+    PlaybackClock clock;
+    CHECK(!clock.isValid());
+    CHECK(clock.position(at(0)) == -1.);
+    CHECK(clock.when(10.) == Clock::time_point::max());
+
+    clock.update(10., 1., true, at(0));
+    CHECK(clock.isValid());
+    clock.reset();
+    CHECK(!clock.isValid());
+    CHECK(clock.when(20.) == Clock::time_point::max());
+}
+
+static void testExtrapolation()
+{
+    PlaybackClock clock;
+    clock.update(10., 1., true, at(0));
+    CHECK(near(clock.position(at(2.5)), 12.5));
+    CHECK(near(secondsBetween(at(0), clock.when(30.)), 20.));
+
+    // Twice the speed gets there in half the time
+    clock.update(10., 2., true, at(0));
+    CHECK(near(clock.position(at(1)), 12.));
+    CHECK(near(secondsBetween(at(0), clock.when(30.)), 10.));
+    CHECK(clock.correction() == 1.);
+}
+
+static void testPaused()
+{
+    PlaybackClock clock;
+    clock.update(42., 1., false, at(0));
+    CHECK(clock.position(at(100)) == 42.);
+    CHECK(clock.when(50.) == Clock::time_point::max());
+
+    // Paused in between doesn't count as drift when it continues
+    play(&clock, 1., 1., 0., 20.);
+    clock.update(20., 1., false, at(25));
+    clock.update(20., 1., true, at(60));
+    clock.update(20.5, 1., true, at(60.5));
+    clock.update(25., 1., true, at(65));
+    CHECK(clock.correction() == 1.);
+}
+
+static void testDrift()
+{
+    // A chromecast that is 1% fast, the correction gets there
+    PlaybackClock fast;
+    play(&fast, 1.01, 1., 0., 300.);
+    CHECK(near(fast.correction(), 1.01, 1e-4));
+    // And the prediction follows it
+    CHECK(near(fast.position(at(310)), 310 * 1.01, 1e-2));
+    CHECK(near(secondsBetween(at(300), fast.when(320 * 1.01)), 20., 1e-2));
+
+    PlaybackClock slow;
+    play(&slow, 0.995, 1., 0., 300.);
+    CHECK(near(slow.correction(), 0.995, 1e-4));
+
+    // Not at the nominal rate, the correction is relative to it
+    PlaybackClock faster;
+    play(&faster, 1.01, 1.5, 0., 300.);
+    CHECK(near(faster.correction(), 1.01, 1e-4));
+
+    // But never more than 2% either way
+    PlaybackClock wayFast;
+    play(&wayFast, 1.10, 1., 0., 300.);
+    CHECK(wayFast.correction() == 1.02);
+    PlaybackClock waySlow;
+    play(&waySlow, 0.90, 1., 0., 300.);
+    CHECK(waySlow.correction() == 0.98);
+
+    // Updates less than a second apart are too noisy to learn anything from
+    PlaybackClock often;
+    play(&often, 1.01, 1., 0., 30., 0.5);
+    CHECK(often.correction() == 1.);
+}
+
+static void testSeeks()
+{
+    PlaybackClock clock;
+    play(&clock, 1.01, 1., 0., 300.);
+    const double correction = clock.correction();
+    CHECK(correction > 1.);
+
+    // An error of a second or more is a seek, or it got stuck, not drift
+    clock.update(600., 1., true, at(305));
+    CHECK(clock.correction() == correction);
+    CHECK(near(clock.position(at(306)), 600. + correction));
+    clock.update(300., 1., true, at(310));
+    CHECK(clock.correction() == correction);
+    clock.update(300. + 5. * correction + 1.05, 1., true, at(315));
+    CHECK(clock.correction() == correction);
+
+    // Just under that still counts
+    clock.update(clock.position(at(320)) + 0.95, 1., true, at(320));
+    CHECK(clock.correction() > correction);
+}
+
+static void testRateChange()
+{
+    PlaybackClock clock;
+    play(&clock, 1.01, 1., 0., 300.);
+    CHECK(clock.correction() > 1.);
+
+    // What we learned was for the old rate
+    clock.update(400., 2., true, at(305));
+    CHECK(clock.correction() == 1.);
+    CHECK(near(clock.position(at(306)), 402.));
+
+    // Also when it changes while paused
+    play(&clock, 1.01, 1., 0., 300.);
+    clock.update(300., 1., false, at(305));
+    clock.update(300., 1.25, false, at(306));
+    CHECK(clock.correction() == 1.);
+}
+
+int main()
+{
+    testUnknown();
+    testExtrapolation();
+    testPaused();
+    testDrift();
+    testSeeks();
+    testRateChange();
+    return checkResult("playbackclock");
+}
@@ -0,0 +1,239 @@
+// Schemas with submessages, repeated and floating point fields, checked
+// against what protoc encodes for the same messages. The auth ones are the
+// deviceauth namespace from cast_channel.proto.
+
+#include "protoschema.h"
+#include "check.h"
+
+#include <optional>
+#include <vector>
+
+enum SignatureAlgorithm : uint32_t {
+    UNSPECIFIED = 0,
+    RSASSA_PKCS1v15 = 1,
+    RSASSA_PSS = 2
+};
+
+enum HashAlgorithm : uint32_t {
+    SHA1 = 0,
+    SHA256 = 1
+};
+
+struct AuthChallenge
+{
+    SignatureAlgorithm signature_algorithm = UNSPECIFIED;
+    pb::Bytes sender_nonce;
+    HashAlgorithm hash_algorithm = SHA1;
+};
+
+using AuthChallengeSchema = pb::Schema<
+    pb::Field<1, &AuthChallenge::signature_algorithm>,
+    pb::Field<2, &AuthChallenge::sender_nonce>,
+    pb::Field<3, &AuthChallenge::hash_algorithm>
+>;
+
+struct AuthResponse
+{
+    pb::Bytes signature;
+    pb::Bytes client_auth_certificate;
+    std::vector<pb::Bytes> intermediate_certificate;
+    SignatureAlgorithm signature_algorithm = UNSPECIFIED;
+    pb::Bytes sender_nonce;
+    HashAlgorithm hash_algorithm = SHA1;
+    pb::Bytes crl;
+};
+
+using AuthResponseSchema = pb::Schema<
+    pb::Field<1, &AuthResponse::signature, pb::Required>,
+    pb::Field<2, &AuthResponse::client_auth_certificate, pb::Required>,
+    pb::Field<3, &AuthResponse::intermediate_certificate>,
+    pb::Field<4, &AuthResponse::signature_algorithm>,
+    pb::Field<5, &AuthResponse::sender_nonce>,
+    pb::Field<6, &AuthResponse::hash_algorithm>,
+    pb::Field<7, &AuthResponse::crl>
+>;
+
+struct AuthError
+{
+    enum ErrorType : uint32_t {
+        INTERNAL_ERROR = 0,
+        NO_TLS = 1,
+        SIGNATURE_ALGORITHM_UNAVAILABLE = 2
+    };
+    ErrorType error_type = INTERNAL_ERROR;
+};
+
+using AuthErrorSchema = pb::Schema<
+    pb::Field<1, &AuthError::error_type, pb::Required>
+>;
+
+struct DeviceAuthMessage
+{
+    std::optional<AuthChallenge> challenge;
+    std::optional<AuthResponse> response;
+    std::optional<AuthError> error;
+};
+
+using DeviceAuthMessageSchema = pb::Schema<
+    pb::MessageField<1, &DeviceAuthMessage::challenge, AuthChallengeSchema>,
+    pb::MessageField<2, &DeviceAuthMessage::response, AuthResponseSchema>,
+    pb::MessageField<3, &DeviceAuthMessage::error, AuthErrorSchema>
+>;
+
+struct Sample
+{
+    double position = 0;
+    float volume = 0;
+    std::vector<uint32_t> ids;
+    bool muted = false;
+};
+
+using SampleSchema = pb::Schema<
+    pb::Field<1, &Sample::position>,
+    pb::Field<2, &Sample::volume>,
+    pb::Field<3, &Sample::ids>,
+    pb::Field<4, &Sample::muted>
+>;
+
+static pb::Bytes bytes(const char *text)
+{
+    return pb::Bytes(reinterpret_cast<const uint8_t*>(text));
+}
+
+template<typename Schema>
+static pb::Bytes encode(const typename Schema::Message &message)
+{
+    pb::Bytes encoded(Schema::size(message), 0);
+    const uint8_t *end = Schema::write(message, &encoded[0], encoded.data() + encoded.size());
+    CHECK(end == encoded.data() + encoded.size());
+
+    // And one byte less doesn't fit
+    if (!encoded.empty()) {
+        pb::Bytes tooSmall(encoded.size() - 1, 0);
+        CHECK(!Schema::write(message, &tooSmall[0], tooSmall.data() + tooSmall.size()));
+    }
+    return encoded;
+}
+
+static void testChallenge()
+{
+    // An empty submessage is still there
+    DeviceAuthMessage message;
+    message.challenge.emplace();
+    const pb::Bytes encoded = encode<DeviceAuthMessageSchema>(message);
+    CHECK(encoded == pb::Bytes({0x0a, 0x00}));
+
+    DeviceAuthMessage parsed;
+    CHECK(DeviceAuthMessageSchema::parse(&parsed, encoded.data(), encoded.size()));
+    CHECK(parsed.challenge.has_value());
+    CHECK(!parsed.response.has_value());
+    CHECK(!parsed.error.has_value());
+
+    // Nothing set is nothing at all
+    CHECK(DeviceAuthMessageSchema::size(DeviceAuthMessage()) == 0);
+}
+
+static void testResponse()
+{
+    DeviceAuthMessage message;
+    AuthResponse &response = message.response.emplace();
+    response.signature = bytes("sig");
+    response.client_auth_certificate = bytes("cert");
+    response.intermediate_certificate = { bytes("ica1"), bytes("ica2") };
+    response.signature_algorithm = RSASSA_PKCS1v15;
+    response.hash_algorithm = SHA256;
+
+    const pb::Bytes expected = {
+        0x12, 0x1b,
+        0x0a, 0x03, 's', 'i', 'g',
+        0x12, 0x04, 'c', 'e', 'r', 't',
+        0x1a, 0x04, 'i', 'c', 'a', '1',
+        0x1a, 0x04, 'i', 'c', 'a', '2',
+        0x20, 0x01,
+        0x30, 0x01
+    };
+    const pb::Bytes encoded = encode<DeviceAuthMessageSchema>(message);
+    CHECK(encoded == expected);
+
+    DeviceAuthMessage parsed;
+    CHECK(DeviceAuthMessageSchema::parse(&parsed, encoded.data(), encoded.size()));
+    CHECK(!parsed.challenge.has_value());
+    CHECK(parsed.response.has_value());
+    if (parsed.response) {
+        CHECK(parsed.response->signature == bytes("sig"));
+        CHECK(parsed.response->client_auth_certificate == bytes("cert"));
+        CHECK(parsed.response->intermediate_certificate == std::vector<pb::Bytes>({ bytes("ica1"), bytes("ica2") }));
+        CHECK(parsed.response->signature_algorithm == RSASSA_PKCS1v15);
+        CHECK(parsed.response->hash_algorithm == SHA256);
+        CHECK(parsed.response->crl.empty());
+    }
+
+    // A submessage that claims to be longer than what's left
+    pb::Bytes truncated = expected;
+    truncated.pop_back();
+    CHECK(!DeviceAuthMessageSchema::parse(&parsed, truncated.data(), truncated.size()));
+
+    // Or one that is broken inside
+    pb::Bytes broken = expected;
+    broken[3] = 0x30; // signature longer than the submessage
+    CHECK(!DeviceAuthMessageSchema::parse(&parsed, broken.data(), broken.size()));
+}
+
+static void testError()
+{
+    // Required fields are written even when they're zero
+    DeviceAuthMessage message;
+    message.error.emplace();
+    const pb::Bytes encoded = encode<DeviceAuthMessageSchema>(message);
+    CHECK(encoded == pb::Bytes({0x1a, 0x02, 0x08, 0x00}));
+
+    // Unknown fields inside a submessage are skipped
+    const pb::Bytes withUnknown = {0x1a, 0x05, 0x08, 0x01, 0x78, 0x96, 0x01};
+    DeviceAuthMessage parsed;
+    CHECK(DeviceAuthMessageSchema::parse(&parsed, withUnknown.data(), withUnknown.size()));
+    CHECK(parsed.error.has_value() && parsed.error->error_type == AuthError::NO_TLS);
+}
+
+static void testScalars()
+{
+    Sample sample;
+    sample.position = 12.5;
+    sample.volume = 0.25f;
+    sample.ids = { 1, 300 };
+    sample.muted = true;
+
+    const pb::Bytes expected = {
+        0x09, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x29, 0x40,
+        0x15, 0x00, 0x00, 0x80, 0x3e,
+        0x18, 0x01,
+        0x18, 0xac, 0x02,
+        0x20, 0x01
+    };
+    const pb::Bytes encoded = encode<SampleSchema>(sample);
+    CHECK(encoded == expected);
+
+    Sample parsed;
+    CHECK(SampleSchema::parse(&parsed, encoded.data(), encoded.size()));
+    CHECK(parsed.position == 12.5);
+    CHECK(parsed.volume == 0.25f);
+    CHECK(parsed.ids == std::vector<uint32_t>({ 1, 300 }));
+    CHECK(parsed.muted);
+
+    // Fixed size values cut short
+    for (const size_t size : { size_t(5), size_t(12) }) {
+        Sample truncated;
+        CHECK(!SampleSchema::parse(&truncated, expected.data(), size));
+    }
+
+    // Zero is left out, like any other optional field
+    CHECK(SampleSchema::size(Sample()) == 0);
+}
+
+int main()
+{
+    testChallenge();
+    testResponse();
+    testError();
+    testScalars();
+    return checkResult("protoschema");
+}
@@ -0,0 +1,337 @@
+// The resolver against stand-in DNS servers on localhost, which answer
+// however the test tells them to.
+
+#include "resolver.h"
+#include "check.h"
+
+#include <functional>
+
+extern "C" {
+#include <arpa/inet.h>
+}
+
+struct Query {
+    uint16_t id = 0;
+    std::string name;
+    uint16_t type = 0;
+    std::vector<uint8_t> question; // as it was in the packet
+};
+
+static std::vector<uint8_t> encodeName(const std::string &name)
+{
+    std::vector<uint8_t> encoded;
+    size_t start = 0;
+    while (start < name.size()) {
+        size_t end = name.find('.', start);
+        if (end == std::string::npos) {
+            end = name.size();
+        }
+        encoded.push_back(uint8_t(end - start));
+        encoded.insert(encoded.end(), name.begin() + long(start), name.begin() + long(end));
+        start = end + 1;
+    }
+    encoded.push_back(0);
+    return encoded;
+}
+
+static void append16(std::vector<uint8_t> *packet, const uint16_t value)
+{
+    packet->push_back(uint8_t(value >> 8));
+    packet->push_back(uint8_t(value));
+}
+
+static void append32(std::vector<uint8_t> *packet, const uint32_t value)
+{
+    append16(packet, uint16_t(value >> 16));
+    append16(packet, uint16_t(value));
+}
+
+// A response to build up, the question is copied from the query
+struct Response
+{
+    Response(const Query &query, const uint8_t responseCode = 0)
+    {
+        append16(&packet, query.id);
+        append16(&packet, uint16_t(0x8180 | responseCode)); // response, recursion desired and available
+        append16(&packet, 1);
+        append16(&packet, 0); // answers, filled in by add()
+        append16(&packet, 0);
+        append16(&packet, 0);
+        packet.insert(packet.end(), query.question.begin(), query.question.end());
+    }
+
+    Response &add(const std::string &name, const uint16_t type, const uint32_t ttl, const std::vector<uint8_t> &data)
+    {
+        const std::vector<uint8_t> encoded = encodeName(name);
+        packet.insert(packet.end(), encoded.begin(), encoded.end());
+        append16(&packet, type);
+        append16(&packet, dns::ClassIN);
+        append32(&packet, ttl);
+        append16(&packet, uint16_t(data.size()));
+        packet.insert(packet.end(), data.begin(), data.end());
+        packet[7]++;
+        return *this;
+    }
+
+    Response &a(const std::string &name, const char *address, const uint32_t ttl = 300)
+    {
+        std::vector<uint8_t> data(4);
+        inet_pton(AF_INET, address, data.data());
+        return add(name, dns::A, ttl, data);
+    }
+
+    Response &aaaa(const std::string &name, const char *address, const uint32_t ttl = 300)
+    {
+        std::vector<uint8_t> data(16);
+        inet_pton(AF_INET6, address, data.data());
+        return add(name, dns::AAAA, ttl, data);
+    }
+
+    Response &cname(const std::string &name, const std::string &target, const uint32_t ttl = 300)
+    {
+        return add(name, dns::CNAME, ttl, encodeName(target));
+    }
+
+    std::vector<uint8_t> packet;
+};
+
+// Calls the handler for every query, and sends back whatever it returns
+struct StandInServer
+{
+    using Handler = std::function<std::vector<Response>(const Query &query)>;
+
+    explicit StandInServer(reactor::Reactor *reactor) :
+        m_reactor(reactor)
+    {
+        fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        sockaddr_in *ipv4 = reinterpret_cast<sockaddr_in*>(&address);
+        ipv4->sin_family = AF_INET;
+        ipv4->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t size = sizeof(sockaddr_in);
+        if (bind(fd, reinterpret_cast<sockaddr*>(&address), size) != 0 || getsockname(fd, reinterpret_cast<sockaddr*>(&address), &size) != 0) {
+            perror("Failed to set up stand-in DNS server");
+        }
+        reactor->watch(fd, reactor::Readable, [this](uint32_t) {
+            onQuery();
+        });
+    }
+
+    ~StandInServer()
+    {
+        m_reactor->unwatch(fd);
+        close(fd);
+    }
+
+    void onQuery()
+    {
+        uint8_t packet[512];
+        sockaddr_storage source{};
+        socklen_t sourceSize = sizeof source;
+        const ssize_t size = recvfrom(fd, packet, sizeof packet, 0, reinterpret_cast<sockaddr*>(&source), &sourceSize);
+        if (size < ssize_t(dns::HeaderSize)) {
+            return;
+        }
+        Query query;
+        query.id = dns::read16(packet);
+        size_t pos = dns::HeaderSize;
+        while (pos < size_t(size) && packet[pos]) {
+            if (!query.name.empty()) {
+                query.name += '.';
+            }
+            query.name.append(reinterpret_cast<const char*>(packet + pos + 1), packet[pos]);
+            pos += 1 + packet[pos];
+        }
+        if (pos + 5 > size_t(size)) {
+            return;
+        }
+        query.type = dns::read16(packet + pos + 1);
+        query.question.assign(packet + dns::HeaderSize, packet + pos + 5);
+        queries.push_back(query);
+
+        for (const Response &response : handler(query)) {
+            sendto(fd, response.packet.data(), response.packet.size(), 0, reinterpret_cast<sockaddr*>(&source), sourceSize);
+        }
+    }
+
+    int fd = -1;
+    sockaddr_storage address{};
+    Handler handler = [](const Query&) { return std::vector<Response>(); };
+    std::vector<Query> queries;
+
+private:
+    reactor::Reactor *m_reactor;
+};
+
+static std::string toString(const sockaddr_storage &address)
+{
+    char buffer[INET6_ADDRSTRLEN] = {};
+    if (address.ss_family == AF_INET) {
+        inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in&>(address).sin_addr, buffer, sizeof buffer);
+    } else {
+        inet_ntop(AF_INET6, &reinterpret_cast<const sockaddr_in6&>(address).sin6_addr, buffer, sizeof buffer);
+    }
+    return buffer;
+}
+
+// Resolves it and runs the reactor until the answer is there, returns the addresses as text
+static std::vector<std::string> resolve(reactor::Reactor *reactor, dns::Resolver *resolver, const std::string &host, bool *answeredRightAway = nullptr)
+{
+    bool done = false;
+    std::vector<std::string> result;
+    resolver->resolve(host, [&](const std::vector<sockaddr_storage> &addresses) {
+        for (const sockaddr_storage &address : addresses) {
+            result.push_back(toString(address));
+        }
+        done = true;
+    });
+    if (answeredRightAway) {
+        *answeredRightAway = done;
+    }
+    const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!done && std::chrono::steady_clock::now() < deadline) {
+        reactor->runOnce(100);
+    }
+    CHECK(done);
+    return result;
+}
+
+static void testAnswer()
+{
+    reactor::Reactor reactor;
+    StandInServer server(&reactor);
+    server.handler = [](const Query &query) {
+        Response response(query);
+        if (query.type == dns::A) {
+            response.a(query.name, "192.0.2.1", 1);
+        } else {
+            response.aaaa(query.name, "2001:db8::1", 1);
+        }
+        return std::vector<Response>{response};
+    };
+    dns::Resolver resolver(&reactor, {server.address});
+
+    const std::vector<std::string> addresses = resolve(&reactor, &resolver, "api.example.test");
+    CHECK(addresses == std::vector<std::string>({"2001:db8::1", "192.0.2.1"}));
+    CHECK(server.queries.size() == 2);
+
+    // Cached
+    bool answeredRightAway = false;
+    CHECK(resolve(&reactor, &resolver, "API.example.test.", &answeredRightAway) == addresses);
+    CHECK(answeredRightAway);
+    CHECK(server.queries.size() == 2);
+
+    // Until the TTL runs out
+    usleep(1100 * 1000);
+    CHECK(resolve(&reactor, &resolver, "api.example.test", &answeredRightAway) == addresses);
+    CHECK(!answeredRightAway);
+    CHECK(server.queries.size() == 4);
+}
+
+static void testCname()
+{
+    reactor::Reactor reactor;
+    StandInServer server(&reactor);
+    server.handler = [](const Query &query) {
+        Response response(query);
+        response.cname(query.name, "alias.example.test").cname("alias.example.test", "target.example.test");
+        if (query.type == dns::A) {
+            response.a("target.example.test", "192.0.2.2");
+            // Not what we asked for, so it doesn't count
+            response.a("unrelated.example.test", "192.0.2.66");
+        }
+        return std::vector<Response>{response};
+    };
+    dns::Resolver resolver(&reactor, {server.address});
+    CHECK(resolve(&reactor, &resolver, "www.example.test") == std::vector<std::string>({"192.0.2.2"}));
+}
+
+static void testNxdomain()
+{
+    reactor::Reactor reactor;
+    StandInServer server(&reactor);
+    server.handler = [](const Query &query) {
+        return std::vector<Response>{Response(query, 3)};
+    };
+    dns::Resolver resolver(&reactor, {server.address});
+    CHECK(resolve(&reactor, &resolver, "missing.example.test").empty());
+    CHECK(server.queries.size() == 2);
+
+    // It not existing is cached too, for DNS_NEGATIVE_TTL
+    bool answeredRightAway = false;
+    CHECK(resolve(&reactor, &resolver, "missing.example.test", &answeredRightAway).empty());
+    CHECK(answeredRightAway);
+    CHECK(server.queries.size() == 2);
+}
+
+static void testSpoofing()
+{
+    reactor::Reactor reactor;
+    StandInServer server(&reactor);
+    server.handler = [](const Query &query) {
+        std::vector<Response> responses;
+        if (query.type != dns::A) {
+            responses.emplace_back(query);
+            return responses;
+        }
+        // Wrong ID
+        Query wrongId = query;
+        wrongId.id++;
+        responses.push_back(Response(wrongId).a(query.name, "192.0.2.66"));
+
+        // Right ID, but for some other name
+        Query wrongQuestion = query;
+        wrongQuestion.question = encodeName("evil.example.test");
+        wrongQuestion.question.insert(wrongQuestion.question.end(), query.question.end() - 4, query.question.end());
+        responses.push_back(Response(wrongQuestion).a("evil.example.test", "192.0.2.66"));
+
+        // Right ID and name, but another type
+        Query wrongType = query;
+        wrongType.question[wrongType.question.size() - 3] = dns::AAAA;
+        responses.push_back(Response(wrongType).aaaa(query.name, "2001:db8::66"));
+
+        // And finally the real one
+        responses.push_back(Response(query).a(query.name, "192.0.2.3"));
+        return responses;
+    };
+    dns::Resolver resolver(&reactor, {server.address});
+    CHECK(resolve(&reactor, &resolver, "spoofed.example.test") == std::vector<std::string>({"192.0.2.3"}));
+}
+
+static void testRetry()
+{
+    reactor::Reactor reactor;
+    StandInServer silent(&reactor);
+    StandInServer answering(&reactor);
+    answering.handler = [](const Query &query) {
+        Response response(query);
+        if (query.type == dns::A) {
+            response.a(query.name, "192.0.2.4");
+        }
+        return std::vector<Response>{response};
+    };
+    dns::Resolver resolver(&reactor, {silent.address, answering.address}, std::chrono::milliseconds(200));
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    CHECK(resolve(&reactor, &resolver, "retry.example.test") == std::vector<std::string>({"192.0.2.4"}));
+    CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(200));
+    CHECK(silent.queries.size() == 2);
+    CHECK(answering.queries.size() == 2);
+
+    // Nobody answering at all gives up eventually, and isn't cached
+    answering.handler = silent.handler;
+    CHECK(resolve(&reactor, &resolver, "nobody.example.test").empty());
+    CHECK(silent.queries.size() == 6);
+    CHECK(answering.queries.size() == 6);
+    CHECK(resolve(&reactor, &resolver, "nobody.example.test").empty());
+    CHECK(silent.queries.size() == 10);
+}
+
+int main()
+{
+    testAnswer();
+    testCname();
+    testNxdomain();
+    testSpoofing();
+    testRetry();
+    return checkResult("resolver");
+}
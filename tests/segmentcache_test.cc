@@ -0,0 +1,167 @@
+// The segment cache in a file of its own, in a temporary directory.
+
+#include "segmentcache.h"
+#include "check.h"
+
+extern "C" {
+#include <arpa/inet.h>
+}
+
+static std::vector<Segment> spaced(const int count, const double length)
+{
+    std::vector<Segment> segments;
+    for (int i=0; i<count; i++) {
+        segments.push_back({i * 10., i * 10. + length});
+    }
+    return segments;
+}
+
+static bool operator==(const Segment &a, const Segment &b)
+{
+    return a.begin == b.begin && a.end == b.end;
+}
+
+static void testStore(http::Client *client)
+{
+    SegmentCache cache(client);
+    CHECK(cache.open());
+
+    std::vector<Segment> segments;
+    CHECK(cache.lookup("aaaaaaaaaaa", &segments) == SegmentCache::Miss);
+
+    cache.store("aaaaaaaaaaa", spaced(5, 5));
+    CHECK(cache.lookup("aaaaaaaaaaa", &segments) == SegmentCache::Fresh);
+    CHECK(segments == spaced(5, 5));
+
+    // Nothing to skip is remembered too
+    cache.store("bbbbbbbbbbb", {});
+    segments = spaced(1, 1);
+    CHECK(cache.lookup("bbbbbbbbbbb", &segments) == SegmentCache::Fresh);
+    CHECK(segments.empty());
+
+    // Too many, but they overlap, so they fit once merged
+    std::vector<Segment> overlapping = spaced(20, 5);
+    for (const Segment &segment : spaced(20, 5)) {
+        overlapping.push_back({segment.begin + 2, segment.end + 2});
+    }
+    cache.store("ccccccccccc", overlapping);
+    CHECK(cache.lookup("ccccccccccc", &segments) == SegmentCache::Fresh);
+    CHECK(segments == spaced(20, 7));
+
+    // Too many even then, so we keep the first ones and it needs fetching
+    cache.store("ddddddddddd", spaced(40, 5));
+    CHECK(cache.lookup("ddddddddddd", &segments) == SegmentCache::Stale);
+    CHECK(segments == spaced(30, 5));
+    // Only when it's played though, not ahead of time on every status update
+    CHECK(!cache.prefetch("ddddddddddd", false));
+    CHECK(!cache.prefetch("ddddddddddd", true));
+
+    // It's all still there next time
+    SegmentCache reopened(client);
+    CHECK(reopened.open());
+    CHECK(reopened.lookup("aaaaaaaaaaa", &segments) == SegmentCache::Fresh);
+    CHECK(segments == spaced(5, 5));
+    CHECK(reopened.lookup("ddddddddddd", &segments) == SegmentCache::Stale);
+}
+
+// Says nothing exists, so every fetch fails right away
+struct NxdomainServer
+{
+    explicit NxdomainServer(reactor::Reactor *reactor) :
+        m_reactor(reactor)
+    {
+        fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        sockaddr_in *ipv4 = reinterpret_cast<sockaddr_in*>(&address);
+        ipv4->sin_family = AF_INET;
+        ipv4->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t size = sizeof(sockaddr_in);
+        if (bind(fd, reinterpret_cast<sockaddr*>(&address), size) != 0 || getsockname(fd, reinterpret_cast<sockaddr*>(&address), &size) != 0) {
+            perror("Failed to set up stand-in DNS server");
+        }
+        reactor->watch(fd, reactor::Readable, [this](uint32_t) {
+            uint8_t packet[512];
+            sockaddr_storage source{};
+            socklen_t sourceSize = sizeof source;
+            const ssize_t size = recvfrom(fd, packet, sizeof packet, 0, reinterpret_cast<sockaddr*>(&source), &sourceSize);
+            if (size < ssize_t(dns::HeaderSize)) {
+                return;
+            }
+            packet[2] = 0x81; // response, recursion desired
+            packet[3] = 0x83; // recursion available, NXDOMAIN
+            sendto(fd, packet, size_t(size), 0, reinterpret_cast<sockaddr*>(&source), sourceSize);
+        });
+    }
+
+    ~NxdomainServer()
+    {
+        m_reactor->unwatch(fd);
+        close(fd);
+    }
+
+    int fd = -1;
+    sockaddr_storage address{};
+
+private:
+    reactor::Reactor *m_reactor;
+};
+
+static void testFailedFetch()
+{
+    reactor::Reactor reactor;
+    NxdomainServer server(&reactor);
+    dns::Resolver resolver(&reactor, {server.address});
+    http::Client client(&reactor, &resolver);
+    SegmentCache cache(&client);
+    CHECK(cache.open());
+
+    bool updated = false;
+    cache.onUpdated = [&](const std::string&, const std::vector<Segment>&) {
+        updated = true;
+    };
+
+    // Asking again while it's being fetched is fine, once it has failed we
+    // leave it alone for a while instead of trying on every status update
+    CHECK(cache.prefetch("eeeeeeeeeee", false));
+    const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (cache.prefetch("eeeeeeeeeee", false) && std::chrono::steady_clock::now() < deadline) {
+        reactor.runOnce(20);
+    }
+    CHECK(!cache.prefetch("eeeeeeeeeee", false));
+    CHECK(!cache.prefetch("eeeeeeeeeee", true));
+    CHECK(!updated);
+
+    // Other videos aren't affected
+    CHECK(cache.prefetch("fffffffffff", false));
+}
+
+int main()
+{
+    // Fetching needs it, even if it never gets as far as connecting. The
+    // distribution might keep it somewhere we don't look, dlopen() knows.
+    bool haveSsl = ssl::initialize();
+    if (!haveSsl) {
+        setenv("SPONSORYEET_SSL_LIB", "libssl.so", 0);
+        haveSsl = ssl::initialize();
+    }
+    if (!haveSsl) {
+        puts("segmentcache: no OpenSSL, skipping");
+        return 77;
+    }
+
+    char directory[] = "/tmp/segmentcache_test.XXXXXX";
+    if (!mkdtemp(directory)) {
+        perror("Failed to create temporary directory");
+        return 1;
+    }
+    setenv("XDG_CACHE_HOME", directory, 1);
+
+    reactor::Reactor reactor;
+    dns::Resolver resolver(&reactor);
+    http::Client client(&reactor, &resolver);
+    testStore(&client);
+    testFailedFetch();
+
+    unlink((std::string(directory) + "/sponsoryeet-segments.cache").c_str());
+    rmdir(directory);
+    return checkResult("segmentcache");
+}
@@ -0,0 +1,43 @@
+// Known answers for the SHA-256 we use for the API lookup, from FIPS 180-4
+// and around where the padding needs an extra block.
+
+#include "sha256.h"
+#include "check.h"
+
+#include <string>
+
+static std::string hexHash(const std::string &message)
+{
+    return sha256::toHex(sha256::hash(message));
+}
+
+// Fed a few bytes at a time, so the blocks are filled up in pieces
+static std::string hexHashInPieces(const std::string &message, const size_t pieceSize)
+{
+    sha256::Hasher hasher;
+    for (size_t i=0; i<message.size(); i += pieceSize) {
+        hasher.update(message.data() + i, std::min(pieceSize, message.size() - i));
+    }
+    return sha256::toHex(hasher.finish());
+}
+
+int main()
+{
+    CHECK(hexHash("") == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    CHECK(hexHash("abc") == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+
+    // The length still fits after the padding, just barely doesn't, and a
+    // whole block of message
+    CHECK(hexHash(std::string(55, 'a')) == "9f4390f8d30c2dd92ec9f095b65e2b9ae9b0a925a5258e241c9f1e910f734318");
+    CHECK(hexHash("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq") == "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+    CHECK(hexHash(std::string(64, 'a')) == "ffe054fe7ae0cb6dc65c3af9b61d5209f439851db43d0ba5997337df154668eb");
+
+    const std::string million(1000000, 'a');
+    const std::string millionHash = "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0";
+    CHECK(hexHash(million) == millionHash);
+    for (const size_t pieceSize : { size_t(1), size_t(7), size_t(63), size_t(65), size_t(1000) }) {
+        CHECK(hexHashInPieces(million, pieceSize) == millionHash);
+    }
+
+    return checkResult("sha256");
+}
@@ -0,0 +1,149 @@
+// The UTF-8 check and the ASCII skipping it's built on, with the sequences
+// at every offset so they end up on both sides of the 16 and 32 byte chunks.
+// Built twice, with and without -mavx2, so both chunk sizes are covered.
+
+#include "simd.h"
+#include "check.h"
+
+#include <string>
+#include <vector>
+
+// Decodes every code point and checks it, the slow and obvious way
+static bool referenceIsValidUtf8(const std::string &text)
+{
+    const uint8_t *pos = reinterpret_cast<const uint8_t*>(text.data());
+    const uint8_t *end = pos + text.size();
+    while (pos < end) {
+        size_t length = 0;
+        uint32_t codePoint = 0;
+        if (*pos < 0x80) {
+            pos++;
+            continue;
+        } else if ((*pos & 0xE0) == 0xC0) {
+            length = 2;
+            codePoint = *pos & 0x1F;
+        } else if ((*pos & 0xF0) == 0xE0) {
+            length = 3;
+            codePoint = *pos & 0x0F;
+        } else if ((*pos & 0xF8) == 0xF0) {
+            length = 4;
+            codePoint = *pos & 0x07;
+        } else {
+            return false;
+        }
+        if (size_t(end - pos) < length) {
+            return false;
+        }
+        for (size_t i=1; i<length; i++) {
+            if ((pos[i] & 0xC0) != 0x80) {
+                return false;
+            }
+            codePoint = codePoint << 6 | (pos[i] & 0x3F);
+        }
+        static const uint32_t shortest[] = { 0, 0, 0x80, 0x800, 0x10000 };
+        if (codePoint < shortest[length] || (codePoint >= 0xD800 && codePoint <= 0xDFFF) || codePoint > 0x10FFFF) {
+            return false;
+        }
+        pos += length;
+    }
+    return true;
+}
+
+static bool isValid(const std::string &text)
+{
+    return simd::isValidUtf8(text.data(), text.size());
+}
+
+int main()
+{
+#if defined(__AVX2__)
+    if (!__builtin_cpu_supports("avx2")) {
+        puts("simd: no AVX2, skipping");
+        return 77;
+    }
+#endif
+
+    // findNonAscii() finds it wherever it is
+    for (size_t size=0; size<100; size++) {
+        for (size_t position=0; position<=size; position++) {
+            std::vector<uint8_t> buffer(size, 'x');
+            if (position < size) {
+                buffer[position] = 0x80;
+            }
+            CHECK(simd::findNonAscii(buffer.data(), buffer.data() + size) == buffer.data() + position);
+        }
+    }
+
+    const std::vector<std::pair<std::string, bool>> sequences = {
+        { "\xC2\x80", true },
+        { "\xDF\xBF", true },
+        { "\xE0\xA0\x80", true },
+        { "\xED\x9F\xBF", true }, // just below the surrogates
+        { "\xEE\x80\x80", true }, // just above them
+        { "\xF0\x90\x80\x80", true },
+        { "\xF4\x8F\xBF\xBF", true }, // U+10FFFF
+        { "\xE3\x81\x82\xE3\x81\x84", true }, // a run of them
+        { "\xC0\x80", false }, // overlong
+        { "\xC1\xBF", false },
+        { "\xE0\x80\x80", false },
+        { "\xE0\x9F\xBF", false },
+        { "\xF0\x80\x80\x80", false },
+        { "\xF0\x8F\xBF\xBF", false },
+        { "\xED\xA0\x80", false }, // surrogates
+        { "\xED\xBF\xBF", false },
+        { "\xF4\x90\x80\x80", false }, // past U+10FFFF
+        { "\xF5\x80\x80\x80", false },
+        { "\xFF", false },
+        { "\x80", false }, // continuation without a lead
+        { "\xC2\x41", false }, // not a continuation
+        { "\xE3\x81\x41", false },
+        { "\xF0\x90\x80\x41", false },
+    };
+    for (const std::pair<std::string, bool> &sequence : sequences) {
+        CHECK(referenceIsValidUtf8(sequence.first) == sequence.second);
+        for (size_t offset=0; offset<70; offset++) {
+            // Alone, followed by more ASCII, and as the start of a longer run
+            const std::string prefix(offset, 'x');
+            CHECK(isValid(prefix + sequence.first) == sequence.second);
+            CHECK(isValid(prefix + sequence.first + std::string(40, 'y')) == sequence.second);
+            CHECK(isValid(prefix + sequence.first + "\xC3\xA9" + std::string(40, 'y')) == sequence.second);
+        }
+    }
+
+    // Cut off, with the end right at a chunk boundary and with ASCII after
+    for (const std::pair<std::string, bool> &sequence : sequences) {
+        if (!sequence.second || sequence.first.size() > 4) { // only the single ones
+            continue;
+        }
+        for (size_t length=1; length<sequence.first.size(); length++) {
+            const std::string cut = sequence.first.substr(0, length);
+            for (const size_t boundary : { size_t(16), size_t(32), size_t(48), size_t(64) }) {
+                const std::string text = std::string(boundary - length, 'x') + cut;
+                CHECK(text.size() == boundary);
+                CHECK(!referenceIsValidUtf8(text));
+                CHECK(!isValid(text));
+                CHECK(!isValid(text + std::string(40, 'y')));
+            }
+        }
+    }
+
+    // And every byte pair, in and across chunks, compared with the reference
+    for (int first=0x80; first<=0xFF; first++) {
+        for (int second=0; second<=0xFF; second++) {
+            for (const size_t offset : { size_t(0), size_t(14), size_t(15), size_t(31), size_t(33) }) {
+                std::string text(offset, 'x');
+                text += char(first);
+                text += char(second);
+                text += "\x80\x80";
+                CHECK(isValid(text) == referenceIsValidUtf8(text));
+                text += std::string(20, 'z');
+                CHECK(isValid(text) == referenceIsValidUtf8(text));
+            }
+        }
+    }
+
+    CHECK(isValid(""));
+    CHECK(isValid(std::string(1000, 'a')));
+
+    return checkResult("simd");
+}
@@ -0,0 +1,187 @@
+// The skip plan merging, and that the cursor and binary search always find
+// the same segment as looking through all of them would.
+
+#include "skipplan.h"
+#include "check.h"
+
+#include <cmath>
+#include <random>
+
+// The obvious way to find it, for comparison
+static const Segment *bruteForceNext(const SkipPlan &plan, const double position)
+{
+    if (position < 0) {
+        return nullptr;
+    }
+    for (const Segment &segment : plan) {
+        if (segment.end > position) {
+            return &segment;
+        }
+    }
+    return nullptr;
+}
+
+static bool matches(const SkipPlan &plan, const double position)
+{
+    return plan.next(position) == bruteForceNext(plan, position);
+}
+
+static bool isSegment(const Segment *segment, const double begin, const double end)
+{
+    return segment && segment->begin == begin && segment->end == end;
+}
+
+static void testEmpty()
+{
+    SkipPlan plan;
+    CHECK(plan.empty());
+    CHECK(plan.size() == 0);
+    CHECK(!plan.next(0));
+    CHECK(!plan.next(100));
+    CHECK(!plan.containing(0));
+
+    // Nothing left after throwing out the ones that make no sense
+    plan.compile({{10., 10.}, {20., 15.}, {NAN, 5.}, {5., NAN}});
+    CHECK(plan.empty());
+    CHECK(!plan.next(0));
+}
+
+static void testMerging()
+{
+    // Overlapping
+    SkipPlan plan({{5., 10.}, {8., 12.}});
+    CHECK(plan.size() == 1);
+    CHECK(isSegment(plan.next(0), 5., 12.));
+
+    // Touching
+    plan.compile({{5., 10.}, {10., 15.}});
+    CHECK(plan.size() == 1);
+    CHECK(isSegment(plan.next(0), 5., 15.));
+
+    // A gap too small to play
+    plan.compile({{5., 10.}, {10. + SKIP_MERGE_GAP / 2, 20.}});
+    CHECK(plan.size() == 1);
+    CHECK(isSegment(plan.next(0), 5., 20.));
+
+    // But not one that's big enough
+    plan.compile({{5., 10.}, {10. + SKIP_MERGE_GAP, 20.}});
+    CHECK(plan.size() == 2);
+    CHECK(isSegment(plan.next(0), 5., 10.));
+    CHECK(isSegment(plan.next(10.), 10. + SKIP_MERGE_GAP, 20.));
+
+    // One inside another doesn't make it shorter
+    plan.compile({{5., 30.}, {10., 20.}});
+    CHECK(plan.size() == 1);
+    CHECK(isSegment(plan.next(0), 5., 30.));
+
+    // Order doesn't matter, and a whole chain becomes one
+    plan.compile({{40., 50.}, {9.5, 15.25}, {100., 110.}, {5., 10.}, {15.5, 20.}});
+    CHECK(plan.size() == 3);
+    CHECK(isSegment(plan.next(0), 5., 20.));
+    CHECK(isSegment(plan.next(20.), 40., 50.));
+    CHECK(isSegment(plan.next(50.), 100., 110.));
+    CHECK(!plan.next(110.));
+}
+
+static void testBoundaries()
+{
+    const SkipPlan plan({{5., 10.}});
+    CHECK(!plan.containing(4.99));
+    CHECK(plan.containing(5.));
+    CHECK(plan.containing(9.99));
+    // The end is where we seek to, so that's not in it anymore
+    CHECK(!plan.containing(10.));
+    CHECK(isSegment(plan.next(4.), 5., 10.));
+    CHECK(!plan.next(-1.));
+}
+
+static std::vector<Segment> randomSegments(std::mt19937_64 &random, const int count, const double length)
+{
+    std::uniform_real_distribution<double> position(0., length);
+    std::uniform_real_distribution<double> duration(0.1, 30.);
+    std::vector<Segment> segments;
+    for (int i=0; i<count; i++) {
+        const double begin = position(random);
+        segments.push_back({begin, begin + duration(random)});
+    }
+    return segments;
+}
+
+static void testCursor()
+{
+    std::mt19937_64 random(42);
+    const SkipPlan plan(randomSegments(random, 200, 10000.));
+    CHECK(plan.size() > 10);
+
+    // Playing along, a step at a time
+    for (double position = 0.; position < 10100.; position += 0.25) {
+        CHECK(matches(plan, position));
+    }
+
+    // Seeking back to the start after getting to the end
+    CHECK(matches(plan, 10050.));
+    CHECK(matches(plan, 0.));
+    CHECK(matches(plan, 1.));
+
+    // Backwards into the segment right before
+    const Segment *segment = plan.next(5000.);
+    CHECK(segment);
+    if (segment) {
+        CHECK(matches(plan, segment->end + 0.5));
+        CHECK(matches(plan, segment->end - 0.01));
+        CHECK(plan.containing(segment->begin) == segment);
+    }
+
+    // Far ahead, past lots of segments so it has to search
+    CHECK(matches(plan, 0.));
+    CHECK(matches(plan, 9000.));
+    CHECK(matches(plan, 9000.5));
+
+    // And all over the place
+    std::uniform_real_distribution<double> anywhere(-10., 10100.);
+    for (int i=0; i<100000; i++) {
+        const double position = anywhere(random);
+        CHECK(matches(plan, position));
+        const Segment *inside = plan.containing(position);
+        const Segment *expected = bruteForceNext(plan, position);
+        CHECK(inside == (expected && expected->begin <= position ? expected : nullptr));
+    }
+
+    // Recompiling starts over
+    SkipPlan replanned(randomSegments(random, 50, 1000.));
+    CHECK(matches(replanned, 900.));
+    replanned.compile(randomSegments(random, 50, 1000.));
+    CHECK(matches(replanned, 0.));
+    CHECK(matches(replanned, 500.));
+}
+
+// The merged segments never overlap or come closer than the gap, and cover
+// everything the input did
+static void testRandomMerges()
+{
+    std::mt19937_64 random(7);
+    for (int i=0; i<1000; i++) {
+        const std::vector<Segment> segments = randomSegments(random, 1 + int(random() % 50), 600.);
+        const SkipPlan plan(segments);
+        for (std::vector<Segment>::const_iterator it = plan.begin(); it != plan.end(); ++it) {
+            CHECK(it->end > it->begin);
+            if (it + 1 != plan.end()) {
+                CHECK((it + 1)->begin - it->end >= SKIP_MERGE_GAP);
+            }
+        }
+        for (const Segment &segment : segments) {
+            const Segment *merged = plan.containing(segment.begin);
+            CHECK(merged && merged->begin <= segment.begin && merged->end >= segment.end);
+        }
+    }
+}
+
+int main()
+{
+    testEmpty();
+    testMerging();
+    testBoundaries();
+    testCursor();
+    testRandomMerges();
+    return checkResult("skipplan");
+}
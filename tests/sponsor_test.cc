@@ -0,0 +1,172 @@
+// The skipSegments response parser, fed the same responses split at every
+// offset, since it gets the body in whatever pieces come off the socket.
+
+#include "sponsor.h"
+#include "check.h"
+
+#include <string>
+#include <vector>
+
+// What /api/skipSegments/<hash prefix> returns, with the strings we don't
+// care about made a bit nastier
+static const std::string hashPrefixResponse = R"json([
+  {
+    "videoID": "dQw4w9WgXcQ",
+    "hash": "a8b0f2c63e1d4b5f7c9a0e2d4f6b8c0a1e3d5f7b9c1e3a5d7f9b1c3e5a7d9f1b",
+    "segments": [
+      {"category": "sponsor", "actionType": "skip", "segment": [1.5, 10.25], "UUID": "6b2a\"d1", "locked": 0, "votes": 5, "videoDuration": 212.061, "userID": "x", "description": "He said \"use code [YEET]\" {twice} \\"},
+      {"category": "chapter", "actionType": "chapter", "segment": [30, 45], "UUID": "c4f1", "videoDuration": 0, "description": "Verse \\\" ]}"}
+    ]
+  },
+  {
+    "videoID": "yPYZpwSpKmA",
+    "hash": "a8b0e91d",
+    "segments": [{"segment": [100, 1.2e2], "category": "selfpromo", "UUID": "\u0041\n", "actionType": "mute"}]
+  }
+])json";
+
+// The older form for a single video, the records don't say which one
+static const std::string videoResponse = R"json([{"category":"intro","actionType":"skip","segment":[0,5.5],"UUID":"aa","videoDuration":60},{"category":"outro","segment":[55,60],"UUID":"bb","videoDuration":60}])json";
+
+static bool parse(const std::string &json, std::vector<sponsor::Record> *records, const size_t split)
+{
+    records->clear();
+    sponsor::Parser parser(records);
+    bool ok = parser.feed(json.data(), split);
+    ok = parser.feed(json.data() + split, json.size() - split) && ok;
+    return parser.finish() && ok;
+}
+
+static bool sameRecords(const std::vector<sponsor::Record> &a, const std::vector<sponsor::Record> &b)
+{
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i=0; i<a.size(); i++) {
+        if (a[i].segment.begin != b[i].segment.begin || a[i].segment.end != b[i].segment.end ||
+                a[i].category != b[i].category || a[i].actionType != b[i].actionType ||
+                a[i].uuid != b[i].uuid || a[i].videoId != b[i].videoId || a[i].videoDuration != b[i].videoDuration) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void testHashPrefix()
+{
+    std::vector<sponsor::Record> records;
+    CHECK(parse(hashPrefixResponse, &records, hashPrefixResponse.size()));
+    CHECK(records.size() == 3);
+    if (records.size() != 3) {
+        return;
+    }
+    CHECK(records[0].segment.begin == 1.5 && records[0].segment.end == 10.25);
+    CHECK(records[0].category == sponsor::Category::Sponsor);
+    CHECK(records[0].actionType == sponsor::ActionType::Skip);
+    CHECK(records[0].uuid == "6b2a\\\"d1"); // escapes are kept as they are
+    CHECK(records[0].videoId == "dQw4w9WgXcQ");
+    CHECK(records[0].videoDuration == 212.061);
+
+    CHECK(records[1].category == sponsor::Category::Chapter);
+    CHECK(records[1].actionType == sponsor::ActionType::Chapter);
+    CHECK(records[1].videoId == "dQw4w9WgXcQ");
+
+    CHECK(records[2].segment.begin == 100 && records[2].segment.end == 120);
+    CHECK(records[2].category == sponsor::Category::SelfPromo);
+    CHECK(records[2].actionType == sponsor::ActionType::Mute);
+    CHECK(records[2].uuid == "\\u0041\\n");
+    CHECK(records[2].videoId == "yPYZpwSpKmA");
+
+    // Only the one to skip in the video we asked for
+    const std::vector<Segment> segments = sponsor::skippable(records, "dQw4w9WgXcQ");
+    CHECK(segments.size() == 1 && segments[0].begin == 1.5 && segments[0].end == 10.25);
+
+    // Wherever it's split, escapes and all, it comes out the same
+    const std::vector<sponsor::Record> whole = records;
+    for (size_t split=0; split<=hashPrefixResponse.size(); split++) {
+        CHECK(parse(hashPrefixResponse, &records, split));
+        CHECK(sameRecords(records, whole));
+    }
+
+    // And a byte at a time
+    records.clear();
+    sponsor::Parser parser(&records);
+    for (const char c : hashPrefixResponse) {
+        CHECK(parser.feed(&c, 1));
+    }
+    CHECK(parser.finish());
+    CHECK(sameRecords(records, whole));
+}
+
+static void testWithoutVideoId()
+{
+    std::vector<sponsor::Record> records;
+    for (size_t split=0; split<=videoResponse.size(); split++) {
+        CHECK(parse(videoResponse, &records, split));
+        CHECK(records.size() == 2);
+    }
+    if (records.size() != 2) {
+        return;
+    }
+    CHECK(records[0].videoId.empty() && records[1].videoId.empty());
+    CHECK(records[1].actionType == sponsor::ActionType::Skip); // not there means skip
+
+    // They're for whatever video we asked about
+    const std::vector<Segment> segments = sponsor::skippable(records, "dQw4w9WgXcQ");
+    CHECK(segments.size() == 2);
+    CHECK(segments[0].begin == 0 && segments[0].end == 5.5);
+    CHECK(segments[1].begin == 55 && segments[1].end == 60);
+}
+
+static void testDepth()
+{
+    // As deep as it goes, and one more
+    std::vector<sponsor::Record> records;
+    const std::string deepest = std::string(32, '[') + std::string(32, ']');
+    CHECK(parse(deepest, &records, 16));
+    const std::string tooDeep = std::string(33, '[') + std::string(33, ']');
+    for (const size_t split : { size_t(0), size_t(32), size_t(33) }) {
+        CHECK(!parse(tooDeep, &records, split));
+    }
+
+    // Objects count too
+    std::string objects;
+    for (int i=0; i<33; i++) {
+        objects += "{\"a\":";
+    }
+    objects += "1" + std::string(33, '}');
+    CHECK(!parse(objects, &records, objects.size() / 2));
+}
+
+static void testInvalid()
+{
+    std::vector<sponsor::Record> records;
+    for (const char *json : {
+            "",
+            "[",
+            "[{\"segment\":[1,2]}",
+            "[{\"segment\":[1,2]}]]",
+            "[{\"segment\":[1,2]}] []",
+            "[{\"segment\":[1,two]}]",
+            "[{\"segment\":[1,2],\"UUID\":\"unterminated}]",
+            "[{\"segment\":[1,2]]}",
+            "\"just a string\"",
+            "[{1:2}]"
+    }) {
+        const std::string text = json;
+        CHECK(!parse(text, &records, text.size() / 2));
+    }
+
+    // Segments that aren't two numbers aren't used
+    CHECK(parse("[{\"segment\":[1]},{\"segment\":[1,2,3]},{\"segment\":[]}]", &records, 5));
+    CHECK(records.empty());
+}
+
+int main()
+{
+    testHashPrefix();
+    testWithoutVideoId();
+    testDepth();
+    testInvalid();
+    return checkResult("sponsor");
+}
@@ -0,0 +1,137 @@
+// Checks the fast varint decoding against the plain byte loop it replaced.
+// Built twice, with and without -mbmi2, so both ways of packing the bytes
+// are covered.
+
+#include "protoschema.h"
+#include "check.h"
+
+#include <random>
+#include <vector>
+
+// The old ec_protobuf.h get_varint(), the decoding everything is compared to
+static bool referenceReadVarint(const uint8_t *&data, int &length, uint64_t &out)
+{
+    if (length <= 0) {
+        return false;
+    }
+    int bits = 0;
+    out = 0;
+    do {
+        out |= (*data & uint64_t(0x7F)) << bits;
+        if (!(*data & 0x80)) {
+            data++;
+            length--;
+            return true;
+        }
+        bits += 7;
+        data++;
+        length--;
+    } while (length > 0 && bits < 64);
+    return false;
+}
+
+// Decodes it both ways and compares the result, the value and what was consumed
+static void compare(const std::vector<uint8_t> &input)
+{
+    const uint8_t *fast = input.data();
+    uint64_t fastValue = 0;
+    const bool fastOk = pb::readVarint(fast, input.data() + input.size(), &fastValue);
+
+    const uint8_t *reference = input.data();
+    int length = int(input.size());
+    uint64_t referenceValue = 0;
+    const bool referenceOk = referenceReadVarint(reference, length, referenceValue);
+
+    CHECK(fastOk == referenceOk);
+    if (fastOk && referenceOk) {
+        CHECK(fastValue == referenceValue);
+        CHECK(fast == reference);
+    }
+}
+
+int main()
+{
+#if defined(__BMI2__)
+    if (!__builtin_cpu_supports("bmi2")) {
+        puts("No BMI2 on this CPU, skipping");
+        return 77;
+    }
+    puts("Testing the pext path");
+#else
+    puts("Testing the portable path");
+#endif
+    std::mt19937_64 random(1337);
+
+    // Random bytes, mostly with the continuation bit set so we get long
+    // varints, truncated ones and too long ones
+    for (int i=0; i<2000000; i++) {
+        std::vector<uint8_t> input(random() % 16);
+        const uint64_t bits = random();
+        for (size_t j=0; j<input.size(); j++) {
+            input[j] = uint8_t(random());
+            if ((bits >> j) & 3) {
+                input[j] |= 0x80;
+            }
+        }
+        compare(input);
+    }
+
+    // Everything that can be encoded, and all the ways to cut it short
+    for (int bits=0; bits<=64; bits++) {
+        for (int i=0; i<1000; i++) {
+            uint64_t value = bits == 64 ? random() | 1ULL << 63 : random() & ((1ULL << bits) - 1);
+            uint8_t encoded[16] = {};
+            const size_t size = pb::writeVarint(encoded, value) - encoded;
+            CHECK(size == pb::varintSize(value));
+
+            // With garbage after it, so it's read with the fast path too
+            std::vector<uint8_t> input(encoded, encoded + size);
+            input.resize(size + random() % 8, 0xff);
+            const uint8_t *data = input.data();
+            uint64_t decoded = 0;
+            CHECK(pb::readVarint(data, input.data() + input.size(), &decoded));
+            CHECK(decoded == value);
+            CHECK(size_t(data - input.data()) == size);
+            compare(input);
+
+            for (size_t length=0; length<size; length++) {
+                data = encoded;
+                CHECK(!pb::readVarint(data, encoded + length, &decoded));
+                compare(std::vector<uint8_t>(encoded, encoded + length));
+            }
+        }
+    }
+
+    // Ten bytes is as long as they get, negative numbers always take that
+    for (int i=0; i<100000; i++) {
+        std::vector<uint8_t> input(10);
+        for (int j=0; j<9; j++) {
+            input[j] = uint8_t(random()) | 0x80;
+        }
+        input[9] = uint8_t(random()) & 0x7f;
+        compare(input);
+
+        // And an eleventh is one too many
+        input[9] |= 0x80;
+        input.push_back(0x01);
+        compare(input);
+        const uint8_t *data = input.data();
+        uint64_t value = 0;
+        CHECK(!pb::readVarint(data, input.data() + input.size(), &value));
+    }
+
+#ifdef PB_FAST_VARINTS
+    // The packing on its own, for every length it gets used for
+    for (int i=0; i<1000000; i++) {
+        const int length = 1 + int(random() % 8);
+        const uint64_t bytes = random() & (length == 8 ? ~0ULL : (1ULL << (length * 8)) - 1);
+        uint64_t expected = 0;
+        for (int j=0; j<length; j++) {
+            expected |= ((bytes >> (j * 8)) & 0x7f) << (j * 7);
+        }
+        CHECK(pb::packVarintBytes(bytes) == expected);
+    }
+#endif
+
+    return checkResult("varint");
+}
@@ -1,32 +1,12 @@
 #pragma once
 
-inline std::string regexExtract(const std::string &regexstr, const std::string &payload)
-{
-    std::regex regex(regexstr);
-    std::smatch match;
-    if (!std::regex_search(payload, match, regex) || match.size() != 2) {
-        //std::cerr << "Failed to get match for '" << regexstr << "' in:\n" << payload << std::endl;
-        return "";
-    }
-    return match[1].str();
-}
-
-inline bool extractNumber(const std::string &regex, const std::string &payload, double *number)
-{
-    const std::string numberString = regexExtract(regex, payload);
-    if (numberString.empty()) {
-        //std::cerr << "Failed to extract number '" << regex << "'" << std::endl;
-        return false;
-    }
-    char *endptr = nullptr;
-    const char *startptr = numberString.c_str();
-    const double converted = strtod(startptr, &endptr);
-    if (endptr == startptr || errno == ERANGE || !std::isfinite(converted)) {
-        return false;
-    }
-    *number = converted;
+#include <string>
+#include <vector>
 
-    return true;
+extern "C" {
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 }
 
 inline std::vector<std::string> stringSplit(const std::string &string, const char delimiter)
@@ -46,3 +26,20 @@ inline std::vector<std::string> stringSplit(const std::string &string, const cha
 
     return ret;
 }
+
+// ip:port, or [ip]:port for IPv6
+inline std::string addressToString(const sockaddr *address)
+{
+    char buffer[INET6_ADDRSTRLEN] = {};
+    if (address->sa_family == AF_INET) {
+        const sockaddr_in *ipv4 = reinterpret_cast<const sockaddr_in*>(address);
+        inet_ntop(AF_INET, &ipv4->sin_addr, buffer, sizeof buffer);
+        return std::string(buffer) + ":" + std::to_string(ntohs(ipv4->sin_port));
+    }
+    if (address->sa_family == AF_INET6) {
+        const sockaddr_in6 *ipv6 = reinterpret_cast<const sockaddr_in6*>(address);
+        inet_ntop(AF_INET6, &ipv6->sin6_addr, buffer, sizeof buffer);
+        return "[" + std::string(buffer) + "]:" + std::to_string(ntohs(ipv6->sin6_port));
+    }
+    return "(unknown address family " + std::to_string(address->sa_family) + ")";
+}